@@ -31,6 +31,7 @@
       'src/cpu.cc',
       'src/gc.cc',
       'src/heap.cc',
+      'src/heap-snapshot.cc',
       'src/lexer.cc',
       'src/parser.cc',
       'src/scope.cc',
@@ -51,7 +51,95 @@ struct Error;
 
 class Isolate {
  public:
+  typedef void (*OutOfMemoryCallback)();
+
+  // Single garbage collection, reported to `GCCallback`
+  struct GCEvent {
+    enum Type {
+      kScavenge,
+      kMarkStart,
+      kMarkFinish,
+      kCompact
+    };
+
+    Type type;
+
+    // Time spent in collection, in microseconds
+    uint64_t pause;
+
+    // Bytes of objects moved within new (or old, for compaction) space,
+    // and bytes of objects moved from new space to old space
+    uint32_t bytes_copied;
+    uint32_t bytes_promoted;
+
+    // Space sizes before and after collection (all sizes are in bytes)
+    uint32_t new_space_before;
+    uint32_t new_space_after;
+    uint32_t old_space_before;
+    uint32_t old_space_after;
+    uint32_t large_space_before;
+    uint32_t large_space_after;
+
+    // Weak handles and weak callbacks visited by collector
+    uint32_t weak_references;
+  };
+
+  typedef void (*GCCallback)(const GCEvent* event);
+
+  struct HeapStatistics {
+    uint32_t new_space_size;
+    uint32_t new_space_used;
+    uint32_t new_space_limit;
+    uint32_t old_space_size;
+    uint32_t large_space_size;
+    uint32_t total_size;
+    uint32_t heap_limit;
+
+    // Native memory reported by `AdjustExternalMemory`
+    int64_t external_memory;
+
+    // Number of collections of each type since isolate creation
+    uint32_t scavenges;
+    uint32_t mark_cycles;
+    uint32_t compactions;
+
+    // Total time spent in collections, in microseconds
+    uint64_t total_pause;
+  };
+
+  // Heap and GC configuration (all sizes are in bytes)
+  struct Options {
+    Options();
+
+    // Must be a power of two
+    uint32_t page_size;
+
+    // New space is collected once it grows over its limit, the limit
+    // is adjusted between these sizes by survival rate and GC cost
+    uint32_t new_space_size;
+    uint32_t max_new_space_size;
+
+    // Same for old space (with large objects), 0 - no maximum
+    uint32_t old_space_size;
+    uint32_t max_old_space_size;
+
+    // Old space limit is live size multiplied by this factor
+    double growth_factor;
+
+    // Hard cap on live heap size, 0 - no cap. When it's exceeded even
+    // after full GC, `oom_callback` is invoked (it may release handles).
+    // Once it returns, running script is terminated: `Function::Call()`
+    // returns nil and `Isolate::HasError()` is true. Isolate stays usable,
+    // limit is checked again after the next full GC.
+    uint32_t heap_limit;
+    OutOfMemoryCallback oom_callback;
+
+    // Use `gc_threads` threads for new space collection (1 - serial GC)
+    int gc_threads;
+  };
+
   Isolate();
+  explicit Isolate(const Options& options);
   ~Isolate();
 
   static Isolate* GetCurrent();
@@ -62,6 +150,36 @@ class Isolate {
 
   Array* StackTrace();
 
+  // Back heap with transparent huge pages (only where OS supports them)
+  void EnableHugePages();
+
+  // Return heap pages that weren't reused for `ms` milliseconds to OS
+  void SetPageUncommitDelay(int ms);
+
+  void GetHeapStatistics(HeapStatistics* stats);
+
+  // Invoke `callback` after every collection, NULL - disable
+  void SetGCCallback(GCCallback callback);
+
+  // Report `delta` bytes of native memory allocated (or freed, if negative)
+  // on behalf of heap objects, i.e. by CData or CWrapper that release it
+  // in their weak callbacks. Collection is triggered when it grows too
+  // much. Returns total amount of reported memory.
+  int64_t AdjustExternalMemory(int64_t delta);
+
+  // Use idle time for GC work: scavenge, incremental marking, sweeping and
+  // giving unused pages back to OS. `budget_us` is a relative time budget
+  // in microseconds (counted from the call, not an absolute deadline),
+  // only steps that are expected to fit into it are done. Returns true if
+  // GC has more work left (call it again on the next idle period), false
+  // if there is nothing to do until more objects are allocated.
+  // NOTE: Values that aren't held by handles may be moved by it
+  bool IdleNotification(uint64_t budget_us);
+
+  // Write graph of heap objects with their retained sizes to `filename`
+  // (JSON, see tools/heap-snapshot.py), returns false on I/O error
+  bool WriteHeapSnapshot(const char* filename);
+
   static void EnableFullgenLogging();
   static void DisableFullgenLogging();
   static void EnableHIRLogging();
@@ -70,6 +188,7 @@ class Isolate {
   static void DisableLIRLogging();
 
  protected:
+  void Init(const Options& options);
   void SetError(Error* err);
 
   internal::Heap* heap;
@@ -207,6 +326,9 @@ class String : public Value {
   const char* Value();
   uint32_t Length();
 
+  // Substring sharing memory with this string (range is clamped)
+  String* Slice(uint32_t offset, uint32_t length);
+
   static const ValueType tag = kString;
 };
 
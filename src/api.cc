@@ -29,6 +29,7 @@
 #include "isolate.h"
 #include "heap.h"
 #include "heap-inl.h"
+#include "heap-snapshot.h"
 #include "code-space.h"
 #include "fullgen.h"
 #include "fullgen-inl.h"
@@ -77,10 +78,41 @@ TYPES_LIST(METHODS_ENUM)
 
 static Isolate* current_isolate = NULL;
 
+Isolate::Options::Options() : page_size(2 * 1024 * 1024),
+                               new_space_size(4 * 1024 * 1024),
+                               max_new_space_size(32 * 1024 * 1024),
+                               old_space_size(8 * 1024 * 1024),
+                               max_old_space_size(0),
+                               growth_factor(2.0),
+                               heap_limit(0),
+                               oom_callback(NULL),
+                               gc_threads(1) {
+}
+
+
 Isolate::Isolate() {
+  Init(Options());
+}
+
+
+Isolate::Isolate(const Options& options) {
+  Init(options);
+}
+
+
+void Isolate::Init(const Options& options) {
   IsolateData::GetCurrent()->isolate = this;
 
-  heap = new Heap(2 * 1024 * 1024);
+  heap = new Heap(options.page_size);
+
+  GC* gc = heap->gc();
+  gc->threads(options.gc_threads);
+  gc->new_space_size(options.new_space_size, options.max_new_space_size);
+  gc->old_space_size(options.old_space_size, options.max_old_space_size);
+  gc->growth_factor(options.growth_factor);
+  gc->heap_limit(options.heap_limit);
+  gc->oom_callback(options.oom_callback);
+
   space = new CodeSpace(heap);
   error = NULL;
 
@@ -113,6 +145,12 @@ Error* Isolate::GetError() {
 void Isolate::PrintError() {
   if (!HasError()) return;
 
+  // Errors raised while running the script have no source location
+  if (error->source == NULL) {
+    fprintf(stderr, "Error: %s\n", error->message);
+    return;
+  }
+
   fprintf(stderr,
           "Error on line %s#%d: %s\n",
           error->filename,
@@ -135,6 +173,66 @@ Array* Isolate::StackTrace() {
 }
 
 
+void Isolate::EnableHugePages() {
+  heap->page_pool()->huge_pages(true);
+}
+
+
+void Isolate::SetPageUncommitDelay(int ms) {
+  heap->page_pool()->uncommit_delay(ms);
+}
+
+
+void Isolate::GetHeapStatistics(HeapStatistics* stats) {
+  GC* gc = heap->gc();
+
+  stats->new_space_size = heap->new_space()->size();
+  stats->new_space_used = heap->new_space()->used();
+  stats->new_space_limit = heap->new_space()->size_limit();
+  stats->old_space_size = heap->old_space()->size();
+  stats->large_space_size = heap->large_space()->size();
+  stats->total_size = stats->new_space_size +
+                      stats->old_space_size +
+                      stats->large_space_size;
+  stats->heap_limit = gc->heap_limit();
+  stats->external_memory = gc->external_memory();
+  stats->scavenges = gc->scavenges();
+  stats->mark_cycles = gc->mark_cycles();
+  stats->compactions = gc->compactions();
+  stats->total_pause = gc->total_pause();
+}
+
+
+void Isolate::SetGCCallback(GCCallback callback) {
+  heap->gc()->gc_callback(callback);
+}
+
+
+int64_t Isolate::AdjustExternalMemory(int64_t delta) {
+  return heap->gc()->AdjustExternalMemory(delta);
+}
+
+
+bool Isolate::IdleNotification(uint64_t budget_us) {
+  bool more = heap->gc()->IdleNotification(*heap->last_stack(),
+                                           *heap->last_frame(),
+                                           budget_us);
+
+  // There's no script to terminate, `oom_callback` was the only report
+  heap->gc()->out_of_memory(false);
+
+  return more;
+}
+
+
+bool Isolate::WriteHeapSnapshot(const char* filename) {
+  HeapSnapshot snapshot(heap);
+  snapshot.Take();
+
+  return snapshot.Write(filename);
+}
+
+
 void Isolate::EnableFullgenLogging() {
   Fullgen::EnableLogging();
 }
@@ -262,6 +360,7 @@ bool Value::Is() {
   Heap::HeapTag tag = Heap::kTagNil;
 
   switch (T::tag) {
+    case kNone: return true;
     case kNil: tag = Heap::kTagNil; break;
     case kNumber: tag = Heap::kTagNumber; break;
     case kBoolean: tag = Heap::kTagBoolean; break;
@@ -387,7 +486,21 @@ uint32_t Function::Argc() {
 
 
 Value* Function::Call(uint32_t argc, Value* argv[]) {
-  return ISOLATE->space->Run(addr(), argc, argv);
+  bool terminated;
+  Value* result = ISOLATE->space->Run(addr(), argc, argv, &terminated);
+  if (!terminated) return result;
+
+  // Script was terminated, because heap is over `heap_limit`
+  Error* error = new Error();
+  error->message = "Heap limit exceeded";
+  error->line = 0;
+  error->offset = 0;
+  error->filename = NULL;
+  error->source = NULL;
+  error->length = 0;
+  ISOLATE->SetError(error);
+
+  return result;
 }
 
 
@@ -469,6 +582,16 @@ uint32_t String::Length() {
 }
 
 
+String* String::Slice(uint32_t offset, uint32_t length) {
+  uint32_t total = HString::Length(addr());
+  if (offset > total) offset = total;
+  if (length > total - offset) length = total - offset;
+
+  return Cast<String>(HString::NewSlice(
+        ISOLATE->heap, addr(), offset, length));
+}
+
+
 Object* Object::New() {
   return Cast<Object>(HObject::NewEmpty(ISOLATE->heap));
 }
@@ -479,7 +602,9 @@ void Object::Set(Value* key, Value* value) {
                                         addr(),
                                         key->addr(),
                                         1);
+  ISOLATE->heap->MarkingBarrier(*slot);
   *slot = value->addr();
+  ISOLATE->heap->RecordSlot(HObject::Map(addr()), slot);
 }
 
 
@@ -532,7 +657,9 @@ void Array::Set(int64_t key, Value* value) {
                                         addr(),
                                         HNumber::ToPointer(key),
                                         1);
+  ISOLATE->heap->MarkingBarrier(*slot);
   *slot = value->addr();
+  ISOLATE->heap->RecordSlot(HObject::Map(addr()), slot);
 }
 
 
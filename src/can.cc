@@ -126,6 +126,33 @@ candor::Value* APIToString(uint32_t argc, candor::Value* argv[]) {
 }
 
 
+// --trace-gc
+bool trace_gc = false;
+
+// --heap-snapshot=<file>
+const char* heap_snapshot = NULL;
+
+void TraceGC(const candor::Isolate::GCEvent* event) {
+  static const char* types[] = { "scavenge", "mark-start", "mark-finish",
+                                 "compact" };
+
+  fprintf(stderr,
+          "[gc] %-11s %.3f ms, new %uK->%uK, old %uK->%uK, large %uK->%uK, "
+          "copied %uK, promoted %uK, weak %u\n",
+          types[event->type],
+          event->pause / 1000.0,
+          event->new_space_before >> 10,
+          event->new_space_after >> 10,
+          event->old_space_before >> 10,
+          event->old_space_after >> 10,
+          event->large_space_before >> 10,
+          event->large_space_after >> 10,
+          event->bytes_copied >> 10,
+          event->bytes_promoted >> 10,
+          event->weak_references);
+}
+
+
 candor::Object* CreateGlobal() {
   candor::Object* obj = candor::Object::New();
 
@@ -169,6 +196,7 @@ char* PrependGlobals(List* list) {
 
 void StartRepl() {
   candor::Isolate isolate;
+  if (trace_gc) isolate.SetGCCallback(TraceGC);
   candor::Object* global = CreateGlobal();
 
   List list;
@@ -224,17 +252,36 @@ void StartRepl() {
 
 
 int main(int argc, char** argv) {
-  if (argc < 2) {
+  // Skip binary name
+  argc--;
+  argv++;
+
+  // Parse flags
+  while (argc > 0 && strncmp(argv[0], "--", 2) == 0) {
+    if (strcmp(argv[0], "--trace-gc") == 0) {
+      trace_gc = true;
+    } else if (strncmp(argv[0], "--heap-snapshot=", 16) == 0) {
+      heap_snapshot = argv[0] + 16;
+    } else {
+      fprintf(stderr, "Unknown flag: %s\n", argv[0]);
+      return 1;
+    }
+    argc--;
+    argv++;
+  }
+
+  if (argc < 1) {
     // Start repl
     StartRepl();
   } else {
     candor::Isolate isolate;
+    if (trace_gc) isolate.SetGCCallback(TraceGC);
 
     // Load script and run
     off_t size = 0;
-    const char* script = ReadContents(argv[1], &size);
+    const char* script = ReadContents(argv[0], &size);
 
-    candor::Function* code = candor::Function::New(argv[1], script, size);
+    candor::Function* code = candor::Function::New(argv[0], script, size);
     delete script;
 
     if (isolate.HasError()) {
@@ -242,9 +289,24 @@ int main(int argc, char** argv) {
       exit(1);
     }
 
-    code->SetContext(CreateGlobal());
+    // Script, its globals and result are snapshot's roots
+    candor::Handle<candor::Function> fn(code);
+    candor::Handle<candor::Object> global(CreateGlobal());
+    fn->SetContext(*global);
+
+    candor::Handle<candor::Value> result(fn->Call(0, NULL));
+
+    // Script was terminated
+    if (isolate.HasError()) {
+      isolate.PrintError();
+      exit(1);
+    }
+
+    if (heap_snapshot != NULL && !isolate.WriteHeapSnapshot(heap_snapshot)) {
+      fprintf(stderr, "Failed to write heap snapshot to: %s\n", heap_snapshot);
+    }
 
-    int ret = code->Call(0, NULL)->ToNumber()->IntegralValue();
+    int ret = result->ToNumber()->IntegralValue();
     fflush(stdout);
     return ret;
   }
@@ -22,7 +22,8 @@
 
 #include "code-space.h"
 
-#include <stdlib.h>  // NULL
+#include <stdio.h>  // fprintf
+#include <stdlib.h>  // NULL, abort
 #include <string.h>  // memcpy, memset
 #include <sys/mman.h>  // mmap
 
@@ -47,7 +48,7 @@
 namespace candor {
 namespace internal {
 
-CodeSpace::CodeSpace(Heap* heap) : heap_(heap) {
+CodeSpace::CodeSpace(Heap* heap) : heap_(heap), exit_(NULL) {
   stubs_ = new Stubs(this);
   entry_ = stubs()->GetEntryStub();
   heap->code_space(this);
@@ -191,7 +192,9 @@ char* CodeSpace::Compile(const char* filename,
         LGen lir(&hir, chunk->filename(), head->value());
 
         // Generate Masm code
-        lir.Generate(&masm, heap()->source_map());
+        lir.Generate(&masm,
+                     heap()->source_map(),
+                     heap()->safepoint_map());
       }
     } else {
       Fullgen f(heap(), &r, chunk->filename());
@@ -215,28 +218,69 @@ char* CodeSpace::Compile(const char* filename,
                                chunk->source(),
                                chunk->source_len(),
                                chunk->addr());
+  heap()->safepoint_map()->Commit(chunk->addr());
 
   return chunk->addr();
 }
 
 
-char* CodeSpace::CreatePIC() {
+PIC* CodeSpace::CreatePIC() {
   PIC* p = new PIC(this);
 
   pics_.Push(p);
+  p->Generate();
 
-  return p->Generate();
+  return p;
 }
 
 
-Value* CodeSpace::Run(char* fn, uint32_t argc, Value* argv[]) {
+void CodeSpace::MarkShapes() {
+  List<PIC*, EmptyClass>::Item* item = pics_.head();
+  for (; item != NULL; item = item->next()) {
+    item->value()->MarkShapes();
+  }
+}
+
+
+Value* CodeSpace::Run(char* fn,
+                      uint32_t argc,
+                      Value* argv[],
+                      bool* terminated) {
+  *terminated = false;
   if (fn == HNil::New() || HValue::IsUnboxed(fn)) {
     return reinterpret_cast<Value*>(HNil::New());
   }
 
-  return reinterpret_cast<Code>(entry_)(fn,
-                                        HNumber::Tag(argc),
-                                        argv);
+  // Generated code doesn't need any cleanup, only C++ side of the heap
+  // should forget about its frames
+  jmp_buf exit;
+  jmp_buf* parent = exit_;
+  char* last_stack = *heap()->last_stack();
+  char* last_frame = *heap()->last_frame();
+
+  Value* result;
+  if (setjmp(exit) == 0) {
+    exit_ = &exit;
+    result = reinterpret_cast<Code>(entry_)(fn, HNumber::Tag(argc), argv);
+  } else {
+    *heap()->last_stack() = last_stack;
+    *heap()->last_frame() = last_frame;
+    *terminated = true;
+    result = reinterpret_cast<Value*>(HNil::New());
+  }
+  exit_ = parent;
+
+  return result;
+}
+
+
+void CodeSpace::Unwind() {
+  if (exit_ == NULL) {
+    fprintf(stderr, "Fatal error: no script to terminate\n");
+    abort();
+  }
+
+  longjmp(*exit_, 1);
 }
 
 
@@ -23,6 +23,8 @@
 #ifndef _SRC_CODE_SPACE_H_
 #define _SRC_CODE_SPACE_H_
 
+#include <setjmp.h>  // jmp_buf
+
 #include "utils.h"  // List
 
 namespace candor {
@@ -59,7 +61,10 @@ class CodeSpace {
   CodeChunk* CreateChunk(const char* filename,
                          const char* source,
                          uint32_t length);
-  char* CreatePIC();
+  PIC* CreatePIC();
+
+  // Mark shapes cached by all PICs
+  void MarkShapes();
 
   void Put(CodeChunk* chunk, Masm* masm);
   char* Compile(const char* filename,
@@ -68,7 +73,11 @@ class CodeSpace {
                 char** root,
                 Error** error);
 
-  Value* Run(char* fn, uint32_t argc, Value* argv[]);
+  // `terminated` is set if script was terminated by `Unwind()`
+  Value* Run(char* fn, uint32_t argc, Value* argv[], bool* terminated);
+
+  // Throw away stack frames up to the innermost `Run()`
+  void Unwind();
 
   inline Heap* heap() { return heap_; }
   inline Stubs* stubs() { return stubs_; }
@@ -77,6 +86,7 @@ class CodeSpace {
   Heap* heap_;
   Stubs* stubs_;
   char* entry_;
+  jmp_buf* exit_;
   CodePageList pages_;
   List<PIC*, EmptyClass> pics_;
   CodeChunkList chunks_;
@@ -26,6 +26,8 @@
 #include <stdint.h>  // int32_t and others
 #include <unistd.h>  // intptr_t
 #include <assert.h>  // assert
+#include <string.h>  // memcpy
+#include <sched.h>  // sched_yield
 
 #include "heap.h"
 #include "heap-inl.h"
@@ -42,59 +44,1407 @@ void GC::GCValue::Relocate(char* address) {
 }
 
 
-void GC::CollectGarbage(char* stack_top) {
+StackIterator::StackIterator(Heap* heap, char* stack_top, char* frame)
+    : heap_(heap),
+      slot_(reinterpret_cast<char**>(stack_top)),
+      frame_(reinterpret_cast<char**>(frame)),
+      safepoint_(NULL) {
+}
+
+
+char** StackIterator::Next() {
+  while (slot_ != NULL) {
+    // Frame's end: skip saved frame pointer and return address, and
+    // continue with caller's frame
+    if (slot_ == frame_) {
+      safepoint_ = heap_->safepoint_map()->Get(*(frame_ + 1));
+      slot_ = frame_ + 2;
+      frame_ = reinterpret_cast<char**>(*frame_);
+      continue;
+    }
+
+    // Skip C++ frames, entry frame holds stack and frame pointers of
+    // the previous JIT frames
+    if (static_cast<uint32_t>(reinterpret_cast<intptr_t>(*slot_)) ==
+            Heap::kEnterFrameTag) {
+      frame_ = reinterpret_cast<char**>(*(slot_ + 2));
+      slot_ = reinterpret_cast<char**>(*(slot_ + 1));
+      safepoint_ = NULL;
+      continue;
+    }
+
+    char** slot = slot_++;
+
+    // Optimized frame: skip argc and spill slots with dead values
+    if (safepoint_ != NULL) {
+      int index = static_cast<int>(frame_ - slot) - 3;
+      if (index >= -2 && index < safepoint_->spill_count() &&
+          (index < 0 || !safepoint_->IsLive(index))) {
+        continue;
+      }
+    }
+
+    return slot;
+  }
+
+  return NULL;
+}
+
+
+GC::GC(Heap* heap) : heap_(heap),
+                     gc_type_(kNone),
+                     threads_(0),
+                     workers_(NULL),
+                     idle_workers_(0),
+                     sweeper_done_(false),
+                     growth_factor_(2.0),
+                     heap_limit_(0),
+                     oom_callback_(NULL),
+                     out_of_memory_(false),
+                     last_old_gc_(GetTimeUs()),
+                     old_gc_time_(0),
+                     shapes_recycled_(false),
+                     marking_allocated_(0),
+                     marking_work_(0),
+                     marked_bytes_(0),
+                     scavenge_time_(0),
+                     scavenge_bytes_(0),
+                     external_memory_(0),
+                     external_memory_limit_(kExternalMemoryLimit),
+                     gc_callback_(NULL),
+                     scavenges_(0),
+                     mark_cycles_(0),
+                     compactions_(0),
+                     total_pause_(0) {
+  pthread_mutex_init(&allocation_mutex_, NULL);
+  threads(1);
+
+  uint32_t page_size = heap->page_pool()->page_size();
+  new_space_size(page_size << 1, page_size << 4);
+  old_space_size(page_size << 2, 0);
+}
+
+
+GC::~GC() {
+  if (heap()->old_space()->is_sweeping()) {
+    pthread_join(sweeper_thread_, NULL);
+    heap()->old_space()->FinishSweeping();
+  }
+  threads(0);
+  pthread_mutex_destroy(&allocation_mutex_);
+}
+
+
+void GC::threads(int value) {
+  for (int i = 0; i < threads_; i++) delete workers_[i];
+  delete[] workers_;
+  workers_ = NULL;
+
+  threads_ = value;
+  if (threads_ == 0) return;
+
+  workers_ = new GCWorker*[threads_];
+  for (int i = 0; i < threads_; i++) workers_[i] = new GCWorker(this, i);
+}
+
+
+void GC::new_space_size(uint32_t initial, uint32_t max) {
+  new_space_size_ = initial;
+  max_new_space_size_ = max;
+  new_space_target_ = initial;
+  last_scavenge_ = GetTimeUs();
+  heap()->new_space()->size_limit(initial);
+}
+
+
+void GC::CollectGarbage(char* stack_top, char* frame) {
   assert(grey_items()->length() == 0);
   assert(black_items()->length() == 0);
+  assert(promoted_items()->length() == 0);
+
+  // __$gc() isn't setting needs_gc() attribute
+  if (heap()->needs_gc() == Heap::kGCNone) {
+    heap()->needs_gc(Heap::kGCNewSpace);
+  }
+
+  uint64_t start = GetTimeUs();
+  StartEvent();
+
+  // Give back memory of pages that weren't reused for a while
+  heap()->page_pool()->Uncommit();
+
+  // Pick up sweeper's results, old space GC can't start without them
+  if (heap()->old_space()->is_sweeping() &&
+      (sweeper_done_ || heap()->needs_gc() == Heap::kGCOldSpace)) {
+    // Compact old space only if it's too fragmented after sweeping
+    if (FinishSweeping()) {
+      heap()->needs_gc(Heap::kGCOldSpace);
+    } else {
+      CheckHeapLimit(stack_top, frame);
+    }
+  }
+
+  // Shape table is full: compact (without evacuation, if no pages were
+  // selected) to free shapes of dead objects
+  bool recycle_shapes = heap()->needs_gc() == Heap::kGCOldSpace &&
+                        heap()->shapes()->length() >= Heap::kMaxShapes &&
+                        !shapes_recycled_;
+
+  // Old space is marked incrementally and swept in background
+  if (heap()->needs_gc() == Heap::kGCOldSpace &&
+      heap()->old_space()->evacuated_pages()->length() == 0 &&
+      !recycle_shapes) {
+    Isolate::GCEvent::Type type;
+    if (!heap()->is_marking()) {
+      type = Isolate::GCEvent::kMarkStart;
+      StartMarking(stack_top, frame);
+    } else {
+      type = Isolate::GCEvent::kMarkFinish;
+      FinishMarking(stack_top, frame);
+      mark_cycles_++;
+    }
+    old_gc_time_ += GetTimeUs() - start;
+
+    heap()->needs_gc(Heap::kGCNone);
+    ReportEvent(type, start);
+    return;
+  }
+
+  switch (heap()->needs_gc()) {
+    case Heap::kGCNewSpace: gc_type(kNewSpace); break;
+    case Heap::kGCOldSpace: gc_type(kOldSpace); break;
+    default:
+      UNEXPECTED
+      break;
+  }
+
+  if (gc_type() == kNewSpace) {
+    uint32_t before = heap()->new_space()->used();
+
+    Scavenge(stack_top, frame);
+
+    event_.bytes_copied = heap()->new_space()->used();
+    HValueList::Item* item = promoted_items()->head();
+    for (; item != NULL; item = item->next()) {
+      event_.bytes_promoted += item->value()->Size();
+    }
+    UpdateNewSpaceLimit(before,
+                        event_.bytes_copied + event_.bytes_promoted,
+                        start);
+    scavenge_time_ = GetTimeUs() - start;
+    scavenge_bytes_ = before;
+    scavenges_++;
+
+    // Let allocation sites decide where to put their next objects
+    AllocationSiteList::Item* site = heap()->allocation_sites()->head();
+    for (; site != NULL; site = site->next()) {
+      site->value()->Digest();
+    }
+
+    // Native memory of tenured objects is released only after marking,
+    // don't let it grow while marking is done in small steps
+    if (IsExternalMemoryFull()) heap()->needs_gc(Heap::kGCOldSpace);
+  } else {
+    Compact(stack_top, frame);
+    old_gc_time_ += GetTimeUs() - start;
+    compactions_++;
+  }
+
+  RebuildRememberedSet();
+
+  GCType type = gc_type();
+  gc_type(kNone);
+
+  // Make marking progress on every scavenge
+  if (heap()->is_marking()) MarkingStep();
+
+  ReportEvent(type == kNewSpace ? Isolate::GCEvent::kScavenge :
+                                  Isolate::GCEvent::kCompact,
+              start);
+
+  if (type != kNewSpace || heap()->needs_gc() == Heap::kGCNewSpace) {
+    // Reset GC flag
+    heap()->needs_gc(Heap::kGCNone);
+  } else {
+    // Or call gc for old_space space
+    CollectGarbage(stack_top, frame);
+  }
+}
+
+
+bool GC::IdleNotification(char* stack_top, char* frame, uint64_t budget) {
+  uint64_t deadline = GetTimeUs() + budget;
+  Space* new_space = heap()->new_space();
+  Space* old_space = heap()->old_space();
+
+  // Collection requested by allocator will happen anyway, better now
+  if (heap()->needs_gc() != Heap::kGCNone) CollectGarbage(stack_top, frame);
+
+  // Scavenge if new space is mostly full and there's enough time for it
+  bool needs_scavenge = static_cast<uint64_t>(new_space->used()) * 100 >=
+      static_cast<uint64_t>(new_space->size_limit()) * kIdleScavengeRatio;
+  if (needs_scavenge && GetTimeUs() + EstimateScavengeTime() <= deadline) {
+    heap()->needs_gc(Heap::kGCNewSpace);
+    CollectGarbage(stack_top, frame);
+    needs_scavenge = false;
+  }
+
+  // Help background sweeper and pick up its results
+  if (old_space->is_sweeping()) {
+    while (GetTimeUs() < deadline && old_space->SweepNextPage()) {
+    }
+
+    if (GetTimeUs() < deadline) {
+      if (FinishSweeping()) {
+        heap()->needs_gc(Heap::kGCOldSpace);
+        CollectGarbage(stack_top, frame);
+      } else {
+        CheckHeapLimit(stack_top, frame);
+      }
+    }
+  }
+
+  // Start marking a bit earlier than allocator would
+  if (!heap()->is_marking() &&
+      !old_space->is_sweeping() &&
+      old_space->evacuated_pages()->length() == 0 &&
+      (static_cast<uint64_t>(old_space->size()) +
+          heap()->large_space()->size()) * 100 >=
+          static_cast<uint64_t>(old_space_limit_) * kIdleMarkingRatio &&
+      GetTimeUs() < deadline) {
+    heap()->needs_gc(Heap::kGCOldSpace);
+    CollectGarbage(stack_top, frame);
+  }
+
+  // Mark until deadline, and finish marking if nothing is left
+  while (heap()->is_marking() && GetTimeUs() < deadline) {
+    MarkingStep(kIdleMarkingStepSize);
+    if (heap()->needs_gc() == Heap::kGCOldSpace) {
+      CollectGarbage(stack_top, frame);
+    }
+  }
+
+  // Give back memory of pages that weren't reused for a while
+  heap()->page_pool()->Uncommit();
+
+  return needs_scavenge ||
+         heap()->needs_gc() != Heap::kGCNone ||
+         heap()->is_marking() ||
+         old_space->is_sweeping();
+}
+
+
+uint64_t GC::EstimateScavengeTime() {
+  // No scavenges yet - assume it is fast
+  if (scavenge_bytes_ == 0) return 0;
+
+  return scavenge_time_ * heap()->new_space()->used() / scavenge_bytes_;
+}
+
+
+int64_t GC::AdjustExternalMemory(int64_t delta) {
+  external_memory_ += delta;
+
+  // Weak callbacks are the only way to release it, ask for collection
+  // at the next safepoint (new space first, as young objects die earlier)
+  if (delta > 0 &&
+      IsExternalMemoryFull() &&
+      heap()->needs_gc() == Heap::kGCNone) {
+    heap()->needs_gc(Heap::kGCNewSpace);
+  }
+
+  return external_memory_;
+}
+
+
+bool GC::IsExternalMemoryFull() {
+  return external_memory_ > external_memory_limit_;
+}
+
+
+void GC::StartEvent() {
+  memset(&event_, 0, sizeof(event_));
+  event_.new_space_before = heap()->new_space()->size();
+  event_.old_space_before = heap()->old_space()->size();
+  event_.large_space_before = heap()->large_space()->size();
+}
+
+
+void GC::ReportEvent(Isolate::GCEvent::Type type, uint64_t start) {
+  event_.type = type;
+  event_.pause = GetTimeUs() - start;
+  event_.new_space_after = heap()->new_space()->size();
+  event_.old_space_after = heap()->old_space()->size();
+  event_.large_space_after = heap()->large_space()->size();
+  total_pause_ += event_.pause;
+
+  if (gc_callback_ != NULL) gc_callback_(&event_);
+}
+
+
+void GC::Compact(char* stack_top, char* frame) {
+  // Keys in stub cache may move
+  heap()->stub_cache()->Clear();
+
+  // Every live tenured object will be visited and checked again
+  ClearRememberedSet();
+
+  // Add referenced in C++ land values to the grey list
+  ColourPersistentHandles();
+
+  // Colour on-stack registers
+  ColourFrames(stack_top, frame);
+
+  // Reset marks for items from external space
+  while (black_items()->length() != 0) {
+    GCValue* value = black_items()->Shift();
+    assert(value->value()->IsSoftGCMarked());
+    value->value()->ResetSoftGCMark();
+
+    // Tenured objects that weren't moved may still point into new space
+    if (value->value()->Generation() >= Heap::kMinOldSpaceGeneration) {
+      promoted_items()->Push(value->value());
+    }
+  }
+
+  RelocateWeakHandles();
+  RelocateStringTable();
+
+  // Visit all weak references and call callbacks if some of them are dead
+  HandleWeakReferences();
+
+  // Every live object was visited, its shape is marked
+  RecycleShapes();
+
+  heap()->old_space()->ReleaseEvacuatedPages();
+}
+
+
+void GC::Scavenge(char* stack_top, char* frame) {
+  // Keys in stub cache may move
+  heap()->stub_cache()->Clear();
+
+  // Survivors are copied here and scanned in allocation order
+  tmp_space(new Space(heap(), heap()->new_space()->page_size()));
+
+  // C++ handles
+  HValueRefMap::Item* item = heap()->references()->head();
+  for (; item != NULL; item = item->next_scalar()) {
+    HValueReference* ref = item->value();
+    if (!ref->is_persistent()) continue;
+
+    ScavengeSlot(reinterpret_cast<char**>(ref->reference()));
+    ScavengeSlot(reinterpret_cast<char**>(ref->valueptr()));
+  }
+
+  // Tenured objects pointing into new space
+  HValueList::Item* host = heap()->remembered_set()->head();
+  for (; host != NULL; host = host->next()) {
+    ScavengeObject(host->value());
+  }
+  ScavengeCards();
+
+  // On-stack values
+  StackIterator it(heap(), stack_top, frame);
+  char** slot;
+  while ((slot = it.Next()) != NULL) {
+    ScavengeSlot(slot);
+  }
+
+  if (threads() > 1) {
+    ParallelScavenge();
+  } else {
+    ProcessScavengeQueue();
+  }
+
+  RelocateWeakHandles();
+  RelocateStringTable();
+  HandleWeakReferences();
+
+  heap()->new_space()->Swap(tmp_space());
+  delete tmp_space();
+}
+
+
+// Objects allocated by allocation site report their first survival to it
+static inline void VisitMemento(HValue* value, char* copy) {
+  if (!value->HasMemento()) return;
+
+  value->GetMementoSite()->Survived();
+  *reinterpret_cast<uint8_t*>(copy + HValue::kGCMarkOffset) &=
+      ~HValue::kMementoBit;
+}
+
+
+inline void GC::ScavengeSlot(char** slot) {
+  char* value = *slot;
+  if (value == NULL || value == HNil::New() || HValue::IsUnboxed(value)) {
+    return;
+  }
+
+  HValue* hvalue = HValue::Cast(value);
+  if (hvalue->IsGCMarked()) {
+    *slot = hvalue->GetGCMark();
+    return;
+  }
+
+  // Tenured objects aren't moving
+  if (hvalue->Generation() >= Heap::kMinOldSpaceGeneration) return;
+
+  HValue* copy = hvalue->CopyTo(heap()->old_space(), tmp_space());
+  VisitMemento(hvalue, copy->addr());
+  hvalue->SetGCMark(copy->addr());
+  *slot = copy->addr();
+
+  // Promoted objects are scanned from the list, and could be unvisited by
+  // incremental marker yet
+  if (copy->Generation() >= Heap::kMinOldSpaceGeneration) {
+    promoted_items()->Push(copy);
+    if (heap()->is_marking()) GreyValue(copy->addr());
+  }
+}
+
+
+// Shared by serial and parallel scavengers
+template <class Scavenger>
+static inline void ScavengeObjectSlots(Scavenger* s, HValue* value) {
+  switch (value->tag()) {
+    case Heap::kTagContext:
+      {
+        HContext* context = value->As<HContext>();
+        if (context->has_parent()) s->ScavengeSlot(context->parent_slot());
+        for (uint32_t i = 0; i < context->slots(); i++) {
+          if (!context->HasSlot(i)) continue;
+          s->ScavengeSlot(context->GetSlotAddress(i));
+        }
+      }
+      break;
+    case Heap::kTagFunction:
+      {
+        HFunction* fn = value->As<HFunction>();
+        if (fn->parent_slot() != NULL &&
+            fn->parent() != reinterpret_cast<char*>(Heap::kBindingContextTag)) {
+          s->ScavengeSlot(fn->parent_slot());
+        }
+        if (fn->root_slot() != NULL) s->ScavengeSlot(fn->root_slot());
+      }
+      break;
+    case Heap::kTagObject:
+      s->ScavengeSlot(value->As<HObject>()->map_slot());
+      break;
+    case Heap::kTagArray:
+      s->ScavengeSlot(value->As<HArray>()->map_slot());
+      break;
+    case Heap::kTagMap:
+      {
+        HMap* map = value->As<HMap>();
+        uint32_t size = map->size() << 1;
+        for (uint32_t i = 0; i < size; i++) {
+          if (map->IsEmptySlot(i)) continue;
+          s->ScavengeSlot(map->GetSlotAddress(i));
+        }
+      }
+      break;
+    case Heap::kTagString:
+      switch (HValue::GetRepresentation<HString::Representation>(
+            value->addr())) {
+        case HString::kCons:
+          s->ScavengeSlot(HString::LeftConsSlot(value->addr()));
+          s->ScavengeSlot(HString::RightConsSlot(value->addr()));
+          break;
+        case HString::kSliced:
+          s->ScavengeSlot(HString::ParentSlot(value->addr()));
+          break;
+        default:
+          break;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+
+void GC::ScavengeObject(HValue* value) {
+  ScavengeObjectSlots(this, value);
+}
+
+
+// Slots of large map that start in its `card`
+static inline void GetCardSlots(HValue* host,
+                                uint32_t card,
+                                char*** start,
+                                char*** end) {
+  uint32_t from = card * Heap::kCardSize;
+  uint32_t to = from + Heap::kCardSize;
+  uint32_t limit = HMap::kSpaceOffset +
+                   (host->As<HMap>()->size() << 1) * HValue::kPointerSize;
+
+  if (from < HMap::kSpaceOffset) from = HMap::kSpaceOffset;
+  if (to > limit) to = limit;
+  if (from > to) from = to;
+
+  // Offsets of slots are relative to map's space
+  from = HMap::kSpaceOffset +
+         RoundUp(from - HMap::kSpaceOffset, HValue::kPointerSize);
+  to = HMap::kSpaceOffset +
+       RoundUp(to - HMap::kSpaceOffset, HValue::kPointerSize);
+
+  *start = reinterpret_cast<char**>(host->addr() + from);
+  *end = reinterpret_cast<char**>(host->addr() + to);
+}
+
+
+void GC::ScavengeCards() {
+  List<Space::Page*, EmptyClass>::Item* item =
+      heap()->large_space()->pages()->head();
+  for (; item != NULL; item = item->next()) {
+    Space::Page* page = item->value();
+    if (page->cards_ == NULL) continue;
+
+    HValue* host = HValue::Cast(page->first());
+    uint32_t count = Heap::CardCount(host);
+    for (uint32_t i = 0; i < count; i++) {
+      if (page->cards_[i] == 0) continue;
+
+      char** slot;
+      char** end;
+      GetCardSlots(host, i, &slot, &end);
+      for (; slot < end; slot++) ScavengeSlot(slot);
+    }
+  }
+}
+
+
+void GC::ProcessScavengeQueue() {
+  HValueList::Item* promoted = NULL;
+  bool progress = true;
+
+  while (progress) {
+    progress = false;
+
+    // Space may select page with a gap, so every page has own scan pointer
+    List<Space::Page*, EmptyClass>::Item* item = tmp_space()->pages()->head();
+    for (; item != NULL; item = item->next()) {
+      Space::Page* page = item->value();
+      while (page->scan_ < page->top_) {
+        HValue* value = HValue::Cast(page->scan_);
+        ScavengeObject(value);
+
+        uint32_t size = value->Size();
+        page->scan_ += size + (size & 0x01);
+        progress = true;
+      }
+    }
+
+    // Promoted objects are scanned in the same order
+    HValueList::Item* next = promoted == NULL ?
+        promoted_items()->head()
+        :
+        promoted->next();
+    for (; next != NULL; next = next->next()) {
+      promoted = next;
+      ScavengeObject(promoted->value());
+      progress = true;
+    }
+  }
+}
+
+
+void GC::ParallelScavenge() {
+  GCWorker* main = worker(0);
+
+  // Objects copied while visiting roots are the initial grey set
+  List<Space::Page*, EmptyClass>::Item* item = tmp_space()->pages()->head();
+  for (; item != NULL; item = item->next()) {
+    Space::Page* page = item->value();
+    while (page->scan_ < page->top_) {
+      HValue* value = HValue::Cast(page->scan_);
+      main->queue()->Push(value);
+
+      uint32_t size = value->Size();
+      page->scan_ += size + (size & 0x01);
+    }
+  }
+  HValueList::Item* promoted = promoted_items()->head();
+  for (; promoted != NULL; promoted = promoted->next()) {
+    main->queue()->Push(promoted->value());
+  }
+
+  idle_workers_ = 0;
+  for (int i = 1; i < threads(); i++) {
+    pthread_create(worker(i)->thread(), NULL, GCWorker::RunThread, worker(i));
+  }
+  main->Run();
+  for (int i = 1; i < threads(); i++) {
+    pthread_join(*worker(i)->thread(), NULL);
+  }
+
+  for (int i = 0; i < threads(); i++) {
+    GCWorker* w = worker(i);
+    w->CloseLABs();
+
+    while (w->promoted_items()->length() != 0) {
+      HValue* value = w->promoted_items()->Shift();
+      promoted_items()->Push(value);
+
+      // Promoted objects could be unvisited by incremental marker yet
+      if (heap()->is_marking()) GreyValue(value->addr());
+    }
+  }
+}
+
+
+GCWorkQueue::Buffer::Buffer(intptr_t size, Buffer* prev) : size_(size),
+                                                            prev_(prev) {
+  items_ = new HValue*[size];
+}
+
+
+GCWorkQueue::Buffer::~Buffer() {
+  delete[] items_;
+  delete prev_;
+}
+
+
+GCWorkQueue::GCWorkQueue() : top_(0), bottom_(0) {
+  buffer_ = new Buffer(1024, NULL);
+}
+
+
+GCWorkQueue::~GCWorkQueue() {
+  delete buffer_;
+}
+
+
+void GCWorkQueue::Push(HValue* value) {
+  intptr_t bottom = bottom_;
+  intptr_t top = top_;
+  Buffer* buffer = buffer_;
+
+  if (bottom - top >= buffer->size_ - 1) buffer = Grow(buffer, bottom, top);
+  buffer->Put(bottom, value);
+
+  // Item should be visible to thieves before the new bottom
+  __sync_synchronize();
+  bottom_ = bottom + 1;
+}
+
+
+HValue* GCWorkQueue::Pop() {
+  intptr_t bottom = bottom_ - 1;
+  Buffer* buffer = buffer_;
+
+  // Reserve item before looking at thieves' end
+  bottom_ = bottom;
+  __sync_synchronize();
+  intptr_t top = top_;
+
+  if (top > bottom) {
+    // Empty
+    bottom_ = bottom + 1;
+    return NULL;
+  }
+
+  HValue* result = buffer->Get(bottom);
+  if (top == bottom) {
+    // Last item - race with thieves for it
+    if (!__sync_bool_compare_and_swap(&top_, top, top + 1)) result = NULL;
+    bottom_ = top + 1;
+  }
+
+  return result;
+}
+
+
+HValue* GCWorkQueue::Steal() {
+  intptr_t top = top_;
+  __sync_synchronize();
+  intptr_t bottom = bottom_;
+
+  if (top >= bottom) return NULL;
+
+  HValue* result = buffer_->Get(top);
+  if (!__sync_bool_compare_and_swap(&top_, top, top + 1)) return NULL;
+
+  return result;
+}
+
+
+GCWorkQueue::Buffer* GCWorkQueue::Grow(Buffer* buffer,
+                                       intptr_t bottom,
+                                       intptr_t top) {
+  Buffer* result = new Buffer(buffer->size_ << 1, buffer);
+  for (intptr_t i = top; i < bottom; i++) result->Put(i, buffer->Get(i));
+
+  // Copied items should be visible before the new buffer
+  __sync_synchronize();
+  buffer_ = result;
+
+  return result;
+}
+
+
+GCWorker::GCWorker(GC* gc, int index) : gc_(gc), index_(index) {
+}
+
+
+void* GCWorker::RunThread(void* worker) {
+  reinterpret_cast<GCWorker*>(worker)->Run();
+  return NULL;
+}
+
+
+void GCWorker::Run() {
+  volatile int32_t* idle = gc()->idle_workers();
+
+  while (true) {
+    HValue* value;
+    while ((value = queue()->Pop()) != NULL) {
+      ScavengeObjectSlots(this, value);
+    }
+
+    value = Steal();
+    if (value != NULL) {
+      ScavengeObjectSlots(this, value);
+      continue;
+    }
+
+    // No work left - wait for others to finish or to share some work
+    __sync_fetch_and_add(idle, 1);
+    while (true) {
+      if (*idle == gc()->threads()) return;
+
+      bool has_work = false;
+      for (int i = 0; i < gc()->threads(); i++) {
+        if (!gc()->worker(i)->queue()->IsEmpty()) has_work = true;
+      }
+      if (has_work) {
+        __sync_fetch_and_sub(idle, 1);
+        break;
+      }
+      sched_yield();
+    }
+  }
+}
+
+
+HValue* GCWorker::Steal() {
+  for (int i = 1; i < gc()->threads(); i++) {
+    GCWorker* victim = gc()->worker((index_ + i) % gc()->threads());
+
+    HValue* value = victim->queue()->Steal();
+    if (value != NULL) return value;
+  }
+
+  return NULL;
+}
+
+
+// Tag word contains GC mark byte, it's used to claim objects for copying
+static inline volatile intptr_t* TagWord(HValue* value) {
+  return reinterpret_cast<volatile intptr_t*>(value->addr() +
+                                              HValue::kTagOffset);
+}
+
+
+static inline intptr_t GCMarkBits(uint8_t bits) {
+  int shift = (HValue::kGCMarkOffset - HValue::kTagOffset) << 3;
+  return static_cast<intptr_t>(static_cast<uintptr_t>(bits) << shift);
+}
+
+
+inline void GCWorker::ScavengeSlot(char** slot) {
+  char* value = *slot;
+  if (value == NULL || value == HNil::New() || HValue::IsUnboxed(value)) {
+    return;
+  }
+
+  HValue* hvalue = HValue::Cast(value);
+
+  // Claim object by setting busy bit, or wait until other thread will
+  // publish its forwarding address
+  volatile intptr_t* tag = TagWord(hvalue);
+  intptr_t claimed;
+  while (true) {
+    // Pairs with the release store below: forwarding address is visible
+    // once the busy bit is cleared
+    intptr_t current = __atomic_load_n(tag, __ATOMIC_ACQUIRE);
+    if ((current & GCMarkBits(HValue::kGCBusyBit)) != 0) {
+      sched_yield();
+      continue;
+    }
+
+    // Objects promoted while visiting roots are tenured in place, but still
+    // have to be forwarded
+    if ((current & GCMarkBits(0x80)) != 0) {
+      *slot = hvalue->GetGCMark();
+      return;
+    }
+
+    // Tenured objects aren't moving
+    if (hvalue->Generation() >= Heap::kMinOldSpaceGeneration) return;
+
+    claimed = current | GCMarkBits(HValue::kGCBusyBit);
+    if (__sync_bool_compare_and_swap(tag, current, claimed)) break;
+  }
+
+  bool unslice = hvalue->tag() == Heap::kTagString &&
+                 HString::IsSmallSlice(hvalue->addr());
+  uint32_t size = unslice ?
+      HString::SliceCopySize(hvalue->addr()) : hvalue->Size();
+  uint8_t generation = hvalue->Generation() + 1;
+  bool tenure = generation >= gc()->heap()->promotion_age();
+
+  char* result = tenure ?
+      Allocate(gc()->heap()->old_space(), &old_lab_, size)
+      :
+      Allocate(gc()->tmp_space(), &new_lab_, size);
+  if (unslice) {
+    HString::CopySlice(hvalue->addr(), result);
+  } else {
+    memcpy(result + HValue::kTagOffset,
+           hvalue->addr() + HValue::kTagOffset,
+           size);
+  }
+
+  // Fix copy's header
+  *reinterpret_cast<uint8_t*>(result + HValue::kGenerationOffset) =
+      tenure ? Heap::kMinOldSpaceGeneration : generation;
+  *reinterpret_cast<uint8_t*>(result + HValue::kGCMarkOffset) &=
+      ~HValue::kGCBusyBit;
+  VisitMemento(hvalue, result);
+
+  // Publish forwarding address and release object
+  *reinterpret_cast<char**>(hvalue->addr() + HValue::kGCForwardOffset) = result;
+  __atomic_store_n(tag,
+                   (claimed | GCMarkBits(0x80)) &
+                       ~GCMarkBits(HValue::kGCBusyBit),
+                   __ATOMIC_RELEASE);
+
+  *slot = result;
+
+  queue()->Push(HValue::Cast(result));
+  if (tenure) promoted_items()->Push(HValue::Cast(result));
+}
+
+
+char* GCWorker::Allocate(Space* space, LAB* lab, uint32_t bytes) {
+  bytes += bytes & 0x01;
+
+  // Remaining part of LAB should be able to hold a filler
+  uint32_t left = lab->limit_ - lab->top_;
+  if (left == bytes || left >= bytes + HFreeBlock::kMinSize) {
+    char* result = lab->top_;
+    lab->top_ += bytes;
+    return result;
+  }
+
+  char* result;
+  pthread_mutex_lock(gc()->allocation_mutex());
+  if (bytes > kLABSize / 4) {
+    result = space->Allocate(bytes);
+  } else {
+    CloseLAB(lab);
+
+    lab->top_ = space->Allocate(kLABSize);
+    lab->limit_ = lab->top_ + kLABSize;
+
+    result = lab->top_;
+    lab->top_ += bytes;
+  }
+  pthread_mutex_unlock(gc()->allocation_mutex());
+
+  return result;
+}
+
+
+void GCWorker::CloseLABs() {
+  CloseLAB(&new_lab_);
+  CloseLAB(&old_lab_);
+}
+
+
+void GCWorker::CloseLAB(LAB* lab) {
+  if (lab->top_ != lab->limit_) {
+    HFreeBlock::New(lab->top_, lab->limit_ - lab->top_);
+  }
+  lab->top_ = NULL;
+  lab->limit_ = NULL;
+}
+
+
+void GC::StartMarking(char* stack_top, char* frame) {
+  assert(!heap()->is_marking());
+  assert(marking_deque()->length() == 0);
+
+  heap()->is_marking(true);
+
+  // Snapshot roots: C++ handles and on-stack values
+  HValueRefMap::Item* item = heap()->references()->head();
+  for (; item != NULL; item = item->next_scalar()) {
+    HValueReference* ref = item->value();
+    if (ref->is_persistent()) {
+      MarkValue(reinterpret_cast<char*>(ref->value()));
+    }
+  }
+
+  StackIterator it(heap(), stack_top, frame);
+  char** slot;
+  while ((slot = it.Next()) != NULL) {
+    MarkValue(*slot);
+  }
+
+  // Finish marking early only if old space will grow too much
+  uint64_t size = heap()->old_space()->size() + heap()->large_space()->size();
+  ClampOldSpaceLimit(static_cast<uint64_t>(size * growth_factor_));
+
+  // Every tenured object could be live
+  marking_allocated_ = AllocatedBytes();
+  marking_work_ = size;
+  marked_bytes_ = 0;
+}
+
+
+void GC::MarkingStep() {
+  uint64_t allocated = AllocatedBytes();
+  uint64_t delta = allocated - marking_allocated_;
+  marking_allocated_ = allocated;
+
+  // Speed up if remaining work won't fit into old space's headroom
+  uint64_t size = heap()->old_space()->size() + heap()->large_space()->size();
+  uint64_t limit = static_cast<uint64_t>(old_space_limit_) +
+                   old_space_limit_ / kMarkingOvershootRatio;
+  uint64_t work = marking_work_ > marked_bytes_ ?
+      marking_work_ - marked_bytes_ : 0;
+  uint64_t speed = kMarkingSpeed;
+  if (size < limit) {
+    uint64_t needed = work / (limit - size) + 1;
+    if (needed > speed) speed = needed;
+  } else {
+    speed = work;
+  }
 
-  // __$gc() isn't setting needs_gc() attribute
-  if (heap()->needs_gc() == Heap::kGCNone) {
-    heap()->needs_gc(Heap::kGCNewSpace);
+  uint64_t budget = delta * speed;
+  if (budget < kMinMarkingStepSize) budget = kMinMarkingStepSize;
+
+  MarkingStep(budget);
+}
+
+
+void GC::MarkingStep(uint64_t budget) {
+  // Objects are moving during collection
+  if (gc_type() != kNone) return;
+
+  uint64_t start = GetTimeUs();
+  ProcessMarkingDeque(budget);
+  old_gc_time_ += GetTimeUs() - start;
+
+  // Finalize marking at the next safepoint
+  if (marking_deque()->length() == 0) heap()->needs_gc(Heap::kGCOldSpace);
+}
+
+
+void GC::FinishMarking(char* stack_top, char* frame) {
+  assert(heap()->is_marking());
+
+  // Dead keys in stub cache will be swept
+  heap()->stub_cache()->Clear();
+
+  // Steps have emptied the deque by now (unless old space has overgrown),
+  // only tenured objects referenced by roots and greyed by write barrier
+  // are left. Young objects aren't swept and don't need marking.
+  HValueRefMap::Item* root = heap()->references()->head();
+  for (; root != NULL; root = root->next_scalar()) {
+    HValueReference* ref = root->value();
+    char* value = reinterpret_cast<char*>(ref->value());
+    if (ref->is_persistent() && !HValue::IsYoung(value)) GreyValue(value);
   }
 
-  switch (heap()->needs_gc()) {
-    case Heap::kGCNewSpace: gc_type(kNewSpace); break;
-    case Heap::kGCOldSpace: gc_type(kOldSpace); break;
+  StackIterator it(heap(), stack_top, frame);
+  char** slot;
+  while ((slot = it.Next()) != NULL) {
+    if (!HValue::IsYoung(*slot)) GreyValue(*slot);
+  }
+
+  ProcessMarkingDeque(0);
+
+  // Drop weak references to dead tenured objects
+  HValueRefMap::Item* ref_item = heap()->references()->head();
+  HValueRefMap::Item* ref_next;
+  for (; ref_item != NULL; ref_item = ref_next) {
+    HValueReference* ref = ref_item->value();
+    ref_next = ref_item->next_scalar();
+
+    char* value = reinterpret_cast<char*>(ref->value());
+    if (!ref->is_weak() || HValue::IsUnboxed(value)) continue;
+    event_.weak_references++;
+    if (HValue::IsYoung(value) || ref->value()->IsMarked()) continue;
+
+    heap()->references()->RemoveOne(ref_item->key());
+  }
+
+  HValueWeakRefMap::Item* weak_item = heap()->weak_references()->head();
+  HValueWeakRefMap::Item* weak_next;
+  for (; weak_item != NULL; weak_item = weak_next) {
+    HValueWeakRef* ref = weak_item->value();
+    weak_next = weak_item->next_scalar();
+    event_.weak_references++;
+
+    char* value = reinterpret_cast<char*>(ref->value());
+    if (HValue::IsYoung(value) || ref->value()->IsMarked()) continue;
+
+    ref->callback()(ref->value());
+    heap()->weak_references()->RemoveOne(weak_item->key());
+  }
+
+  // Drop dead tenured strings from the string table
+  StringTable* strings = heap()->string_table();
+  char** table = strings->table();
+  for (uint32_t i = 0; i < strings->size(); i++) {
+    if (!StringTable::IsEntry(table[i])) continue;
+    if (HValue::IsYoung(table[i]) || HValue::Cast(table[i])->IsMarked()) {
+      continue;
+    }
+
+    strings->Remove(i);
+  }
+
+  // Forget dead hosts
+  HValueList::Item* item = heap()->remembered_set()->head();
+  HValueList::Item* next;
+  for (; item != NULL; item = next) {
+    next = item->next();
+    if (item->value()->IsMarked()) continue;
+
+    item->value()->ResetRemembered();
+    heap()->remembered_set()->Remove(item);
+  }
+
+  ResetMarks(heap()->new_space());
+  heap()->is_marking(false);
+
+  // Full shape table may request compaction again
+  shapes_recycled_ = false;
+
+  // Weak callbacks have released what they could
+  external_memory_limit_ = external_memory_ + kExternalMemoryLimit;
+
+  // Large objects are just released, there's nothing to coalesce
+  heap()->large_space()->Sweep();
+  StartSweeping();
+}
+
+
+void GC::MarkValue(char* value) {
+  GreyValue(value);
+
+  // Young objects may move at the next scavenge, visit them right now
+  while (young_deque()->length() != 0) {
+    MarkChildren(young_deque()->Shift());
+  }
+}
+
+
+void GC::GreyValue(char* value) {
+  if (value == NULL || value == HNil::New() || HValue::IsUnboxed(value)) {
+    return;
+  }
+
+  HValue* hvalue = HValue::Cast(value);
+  if (hvalue->IsMarked()) return;
+  hvalue->SetMarked();
+
+  if (hvalue->Generation() >= Heap::kMinOldSpaceGeneration) {
+    marking_deque()->Push(hvalue);
+  } else {
+    young_deque()->Push(hvalue);
+  }
+}
+
+
+void GC::MarkChildren(HValue* value) {
+  switch (value->tag()) {
+    case Heap::kTagContext:
+      {
+        HContext* context = value->As<HContext>();
+        if (context->has_parent()) GreyValue(context->parent());
+        for (uint32_t i = 0; i < context->slots(); i++) {
+          if (!context->HasSlot(i)) continue;
+          GreyValue(context->GetSlot(i)->addr());
+        }
+      }
+      break;
+    case Heap::kTagFunction:
+      {
+        HFunction* fn = value->As<HFunction>();
+        if (fn->parent_slot() != NULL &&
+            fn->parent() != reinterpret_cast<char*>(Heap::kBindingContextTag)) {
+          GreyValue(fn->parent());
+        }
+        if (fn->root_slot() != NULL) GreyValue(fn->root());
+      }
+      break;
+    case Heap::kTagObject:
+      GreyValue(value->As<HObject>()->map());
+      break;
+    case Heap::kTagArray:
+      GreyValue(value->As<HArray>()->map());
+      break;
+    case Heap::kTagMap:
+      {
+        HMap* map = value->As<HMap>();
+        uint32_t size = map->size() << 1;
+        for (uint32_t i = 0; i < size; i++) {
+          if (map->IsEmptySlot(i)) continue;
+          GreyValue(map->GetSlot(i)->addr());
+        }
+      }
+      break;
+    case Heap::kTagString:
+      switch (HValue::GetRepresentation<HString::Representation>(
+            value->addr())) {
+        case HString::kCons:
+          GreyValue(HString::LeftCons(value->addr()));
+          GreyValue(HString::RightCons(value->addr()));
+          break;
+        case HString::kSliced:
+          GreyValue(HString::Parent(value->addr()));
+          break;
+        default:
+          break;
+      }
+      break;
     default:
-      UNEXPECTED
       break;
   }
+}
 
-  // Select space to GC
-  Space* space = gc_type() == kNewSpace ?
-      heap()->new_space()
-      :
-      heap()->old_space();
 
-  // Temporary space which will contain copies of all visited objects
-  tmp_space(new Space(heap(), space->page_size()));
+void GC::ProcessMarkingDeque(uint64_t budget) {
+  uint64_t marked = 0;
 
-  // Add referenced in C++ land values to the grey list
-  ColourPersistentHandles();
+  // Zero budget means no limit
+  while (marking_deque()->length() != 0 && (budget == 0 || marked < budget)) {
+    HValue* value = marking_deque()->Shift();
+    MarkChildren(value);
+    marked += value->Size();
 
-  // Colour on-stack registers
-  ColourFrames(stack_top);
+    while (young_deque()->length() != 0) {
+      MarkChildren(young_deque()->Shift());
+    }
+  }
+  marked_bytes_ += marked;
+}
 
-  // Reset marks for items from external space
-  while (black_items()->length() != 0) {
-    GCValue* value = black_items()->Shift();
-    assert(value->value()->IsSoftGCMarked());
-    value->value()->ResetSoftGCMark();
+
+uint64_t GC::AllocatedBytes() {
+  return heap()->new_space()->allocated() +
+         heap()->old_space()->allocated() +
+         heap()->large_space()->allocated();
+}
+
+
+void GC::StartSweeping() {
+  heap()->old_space()->StartSweeping();
+
+  sweeper_done_ = false;
+  pthread_create(&sweeper_thread_, NULL, GC::RunSweeper, this);
+}
+
+
+bool GC::FinishSweeping() {
+  Space* space = heap()->old_space();
+
+  uint64_t start = GetTimeUs();
+  pthread_join(sweeper_thread_, NULL);
+  space->FinishSweeping();
+  old_gc_time_ += GetTimeUs() - start;
+
+  UpdateOldSpaceLimit();
+
+  return SelectEvacuationCandidates(space->free_bytes());
+}
+
+
+void GC::UpdateNewSpaceLimit(uint32_t before,
+                             uint32_t survived,
+                             uint64_t start) {
+  uint64_t now = GetTimeUs();
+  uint64_t elapsed = now - last_scavenge_;
+  uint64_t cost = elapsed == 0 ? 0 : (now - start) * 100 / elapsed;
+  uint64_t rate = before == 0 ? 0 : static_cast<uint64_t>(survived) * 100 /
+                                    before;
+  last_scavenge_ = now;
+
+  // Objects are living longer or collections are too frequent - give them
+  // more room, shrink space back if most of objects are dying young
+  uint64_t target = new_space_target_;
+  if (rate >= kHighSurvivalRate || cost >= kMaxGCCost) {
+    target = static_cast<uint64_t>(target * growth_factor_);
+  } else if (rate <= kLowSurvivalRate) {
+    target = static_cast<uint64_t>(target / growth_factor_);
   }
+  if (target > max_new_space_size_) target = max_new_space_size_;
+  if (target < new_space_size_) target = new_space_size_;
+  new_space_target_ = target;
+
+  // There should be at least one page for allocation after survivors
+  Space* space = heap()->new_space();
+  uint64_t min = space->size() + space->page_size();
+  space->size_limit(target > min ? target : min);
+}
 
-  RelocateWeakHandles();
 
-  // Visit all weak references and call callbacks if some of them are dead
-  HandleWeakReferences();
+void GC::UpdateOldSpaceLimit() {
+  uint64_t now = GetTimeUs();
+  uint64_t elapsed = now - last_old_gc_;
+  uint64_t cost = elapsed == 0 ? 0 : old_gc_time_ * 100 / elapsed;
+  last_old_gc_ = now;
+  old_gc_time_ = 0;
 
-  space->Swap(tmp_space());
-  delete tmp_space();
+  Space* space = heap()->old_space();
+  uint64_t live = space->size() - space->free_bytes() +
+                  heap()->large_space()->size();
 
-  if (gc_type() != kNewSpace || heap()->needs_gc() == Heap::kGCNewSpace) {
-    // Reset GC flag
-    heap()->needs_gc(Heap::kGCNone);
-  } else {
-    // Or call gc for old_space space
-    CollectGarbage(stack_top);
+  // Let heap grow faster if marking and sweeping are taking too much time
+  double factor = growth_factor_;
+  if (cost >= kMaxGCCost) factor *= growth_factor_;
+
+  ClampOldSpaceLimit(static_cast<uint64_t>(live * factor));
+}
+
+
+void GC::ClampOldSpaceLimit(uint64_t limit) {
+  if (max_old_space_size_ != 0 && limit > max_old_space_size_) {
+    limit = max_old_space_size_;
+  }
+  if (limit < old_space_size_) limit = old_space_size_;
+
+  // Space sizes are 32-bit
+  if (limit > 0xffffffff) limit = 0xffffffff;
+  old_space_limit_ = limit;
+}
+
+
+bool GC::IsOldSpaceFull() {
+  uint64_t limit = old_space_limit_;
+  if (heap()->is_marking()) limit += limit / kMarkingOvershootRatio;
+
+  return static_cast<uint64_t>(heap()->old_space()->size()) +
+         heap()->large_space()->size() > limit;
+}
+
+
+uint32_t GC::LiveSize() {
+  Space* space = heap()->old_space();
+  return heap()->new_space()->size() +
+         space->size() - space->free_bytes() +
+         heap()->large_space()->size();
+}
+
+
+void GC::CheckHeapLimit(char* stack_top, char* frame) {
+  if (heap_limit_ == 0 || LiveSize() <= heap_limit_) return;
+
+  // Objects allocated during incremental marking were considered live,
+  // collect everything at once before giving up
+  StartMarking(stack_top, frame);
+  FinishMarking(stack_top, frame);
+
+  // It'll be checked again after compaction
+  if (FinishSweeping()) {
+    heap()->needs_gc(Heap::kGCOldSpace);
+    return;
+  }
+
+  if (LiveSize() > heap_limit_) OutOfMemory();
+}
+
+
+void GC::OutOfMemory() {
+  // Collection itself is finished normally, the script is terminated once
+  // it is over (see RuntimeCollectGarbage)
+  out_of_memory_ = true;
+  if (oom_callback_ != NULL) oom_callback_();
+}
+
+
+void* GC::RunSweeper(void* gc) {
+  GC* self = reinterpret_cast<GC*>(gc);
+
+  while (self->heap()->old_space()->SweepNextPage()) {
+  }
+  self->sweeper_done_ = true;
+
+  return NULL;
+}
+
+
+bool GC::SelectEvacuationCandidates(uint32_t free_bytes) {
+  Space* space = heap()->old_space();
+  if (free_bytes * kMaxFragmentationRatio < space->size()) return false;
+
+  List<Space::Page*, EmptyClass>::Item* item = space->pages()->head();
+  List<Space::Page*, EmptyClass>::Item* next;
+  for (; item != NULL; item = next) {
+    Space::Page* page = item->value();
+    next = item->next();
+
+    if (page->live_ * kEvacuationRatio >= page->size_ ||
+        *space->top() == &page->top_) {
+      continue;
+    }
+
+    // Live objects will be moved by old space GC
+    char* obj = page->first();
+    while (obj < page->top_) {
+      HValue* value = HValue::Cast(obj);
+      if (value->tag() != Heap::kTagFree) value->SetEvacuationCandidate();
+
+      uint32_t size = value->Size();
+      obj += size + (size & 0x01);
+    }
+
+    space->EvacuatePage(item);
+  }
+
+  if (space->evacuated_pages()->length() == 0) return false;
+
+  // Free blocks on evacuated pages can't be used anymore
+  HValueList::Item* block = space->free_list()->head();
+  HValueList::Item* next_block;
+  for (; block != NULL; block = next_block) {
+    next_block = block->next();
+
+    char* addr = block->value()->addr();
+    List<Space::Page*, EmptyClass>::Item* page = space->evacuated_pages()->head();
+    for (; page != NULL; page = page->next()) {
+      if (addr > page->value()->data_ && addr < page->value()->limit_) {
+        space->free_list()->Remove(block);
+        break;
+      }
+    }
+  }
+
+  return true;
+}
+
+
+void GC::ResetMarks(Space* space) {
+  List<Space::Page*, EmptyClass>::Item* item = space->pages()->head();
+  for (; item != NULL; item = item->next()) {
+    Space::Page* page = item->value();
+
+    char* obj = page->first();
+    while (obj < page->top_) {
+      HValue* value = HValue::Cast(obj);
+      value->ResetMarked();
+
+      uint32_t size = value->Size();
+      obj += size + (size & 0x01);
+    }
+    assert(obj == page->top_);
   }
 }
 
@@ -112,6 +1462,124 @@ void GC::ColourPersistentHandles() {
 }
 
 
+void GC::ClearRememberedSet() {
+  HValueList* set = heap()->remembered_set();
+  while (set->length() != 0) {
+    set->Shift()->ResetRemembered();
+  }
+}
+
+
+void GC::RebuildRememberedSet() {
+  HValueList* set = heap()->remembered_set();
+  HValueList::Item* item = set->head();
+  HValueList::Item* next;
+
+  // Forget hosts whose young values were promoted or have died
+  for (; item != NULL; item = next) {
+    next = item->next();
+    if (HasYoungReferences(item->value())) continue;
+
+    item->value()->ResetRemembered();
+    set->Remove(item);
+  }
+
+  // Remember freshly tenured objects that still point into new space
+  while (promoted_items()->length() != 0) {
+    HValue* value = promoted_items()->Shift();
+    if (value->IsRemembered() || Heap::HasCards(value)) continue;
+    if (!HasYoungReferences(value)) continue;
+
+    heap()->Remember(value);
+  }
+
+  CleanCards();
+}
+
+
+void GC::CleanCards() {
+  List<Space::Page*, EmptyClass>::Item* item =
+      heap()->large_space()->pages()->head();
+  for (; item != NULL; item = item->next()) {
+    Space::Page* page = item->value();
+    if (page->cards_ == NULL) continue;
+
+    // Only dirty cards are rescanned, not the whole map
+    HValue* host = HValue::Cast(page->first());
+    uint32_t count = Heap::CardCount(host);
+    for (uint32_t i = 0; i < count; i++) {
+      if (page->cards_[i] == 0) continue;
+
+      char** slot;
+      char** end;
+      GetCardSlots(host, i, &slot, &end);
+      for (; slot < end; slot++) {
+        if (HValue::IsYoung(*slot)) break;
+      }
+      if (slot == end) page->cards_[i] = 0;
+    }
+  }
+}
+
+
+bool GC::HasYoungReferences(HValue* value) {
+  switch (value->tag()) {
+    case Heap::kTagContext:
+      {
+        HContext* context = value->As<HContext>();
+        if (context->has_parent() &&
+            HValue::IsYoung(context->parent())) {
+          return true;
+        }
+        for (uint32_t i = 0; i < context->slots(); i++) {
+          if (!context->HasSlot(i)) continue;
+          if (HValue::IsYoung(context->GetSlot(i)->addr())) return true;
+        }
+        return false;
+      }
+    case Heap::kTagFunction:
+      {
+        HFunction* fn = value->As<HFunction>();
+        if (fn->parent_slot() != NULL &&
+            fn->parent() != reinterpret_cast<char*>(Heap::kBindingContextTag) &&
+            HValue::IsYoung(fn->parent())) {
+          return true;
+        }
+        return fn->root_slot() != NULL && HValue::IsYoung(fn->root());
+      }
+    case Heap::kTagObject:
+    case Heap::kTagArray:
+      {
+        HObject* obj = reinterpret_cast<HObject*>(value);
+        return HValue::IsYoung(obj->map());
+      }
+    case Heap::kTagMap:
+      {
+        HMap* map = value->As<HMap>();
+        uint32_t size = map->size() << 1;
+        for (uint32_t i = 0; i < size; i++) {
+          if (map->IsEmptySlot(i)) continue;
+          if (HValue::IsYoung(map->GetSlot(i)->addr())) return true;
+        }
+        return false;
+      }
+    case Heap::kTagString:
+      if (HValue::GetRepresentation<HString::Representation>(value->addr()) ==
+          HString::kSliced) {
+        return HValue::IsYoung(HString::Parent(value->addr()));
+      }
+      if (HValue::GetRepresentation<HString::Representation>(value->addr()) !=
+          HString::kCons) {
+        return false;
+      }
+      return HValue::IsYoung(HString::LeftCons(value->addr())) ||
+             HValue::IsYoung(HString::RightCons(value->addr()));
+    default:
+      return false;
+  }
+}
+
+
 void GC::RelocateWeakHandles() {
   HValueRefMap::Item* item = heap()->references()->head();
   HValueRefMap::Item* next;
@@ -121,10 +1589,14 @@ void GC::RelocateWeakHandles() {
 
     if (ref->is_weak()) {
       GCValue* v;
+      event_.weak_references++;
 
       // Skip ICs zap values and everything unboxed
       if (HValue::IsUnboxed(reinterpret_cast<char*>(ref->value()))) continue;
 
+      // Values from other space weren't moved
+      if (!IsInCurrentSpace(ref->value())) continue;
+
       if (ref->value()->IsGCMarked()) {
         v = new GCValue(ref->value(),
                         reinterpret_cast<char**>(ref->reference()));
@@ -141,26 +1613,36 @@ void GC::RelocateWeakHandles() {
 }
 
 
-void GC::ColourFrames(char* stack_top) {
+void GC::RelocateStringTable() {
+  StringTable* strings = heap()->string_table();
+  char** table = strings->table();
+  for (uint32_t i = 0; i < strings->size(); i++) {
+    if (!StringTable::IsEntry(table[i])) continue;
+
+    // NOTE: Promoted string's header is already tenured, so check for
+    // forwarding address first
+    HValue* value = HValue::Cast(table[i]);
+    if (value->IsGCMarked()) {
+      table[i] = value->GetGCMark();
+    } else if (IsInCurrentSpace(value)) {
+      strings->Remove(i);
+    }
+  }
+}
+
+
+void GC::ColourFrames(char* stack_top, char* frame) {
   // Go through the frames
-  char** frame = reinterpret_cast<char**>(stack_top);
-  while (frame != NULL) {
-    // Skip C++ frames
-    while (frame != NULL &&
-           static_cast<uint32_t>(reinterpret_cast<intptr_t>(*frame)) ==
-               Heap::kEnterFrameTag) {
-      frame = reinterpret_cast<char**>(*(frame + 1));
-    }
-    if (frame == NULL) break;
-
-    char* value = *frame;
-    // Skip nil, non-pointer values and rbp pushes
+  StackIterator it(heap(), stack_top, frame);
+  char** slot;
+  while ((slot = it.Next()) != NULL) {
+    char* value = *slot;
+
+    // Skip nil and non-pointer values
     if (value != HNil::New() && !HValue::IsUnboxed(value)) {
-      push_grey(HValue::Cast(value), frame);
+      push_grey(HValue::Cast(value), slot);
       ProcessGrey();
     }
-
-    frame++;
   }
 }
 
@@ -171,6 +1653,7 @@ void GC::HandleWeakReferences() {
   for (; item != NULL; item = next) {
     HValueWeakRef* ref = item->value();
     next = item->next_scalar();
+    event_.weak_references++;
 
     if (!ref->value()->IsGCMarked()) {
       if (IsInCurrentSpace(ref->value())) {
@@ -204,6 +1687,54 @@ void GC::HandleWeakReferences() {
 }
 
 
+// Weakly referenced objects weren't visited, but may be used again
+static inline void MarkShape(HValue* value) {
+  char* addr = reinterpret_cast<char*>(value);
+  if (HValue::IsUnboxed(addr) ||
+      addr == HNil::New() ||
+      HValue::GetTag(addr) != Heap::kTagObject) {
+    return;
+  }
+
+  if (HObject::GetShape(addr) != NULL) HObject::GetShape(addr)->Mark();
+}
+
+
+void GC::RecycleShapes() {
+  HValueRefMap::Item* ref = heap()->references()->head();
+  for (; ref != NULL; ref = ref->next_scalar()) {
+    if (ref->value()->is_weak()) MarkShape(ref->value()->value());
+  }
+
+  HValueWeakRefMap::Item* weak = heap()->weak_references()->head();
+  for (; weak != NULL; weak = weak->next_scalar()) {
+    MarkShape(weak->value()->value());
+  }
+
+  // Shapes embedded into ICs' code
+  heap()->code_space()->MarkShapes();
+
+  // Children were created after parents, so walking from the tail frees
+  // every shape before its parent
+  ShapeList::Item* item = heap()->shapes()->tail();
+  ShapeList::Item* prev;
+  for (; item != NULL; item = prev) {
+    Shape* shape = item->value();
+    prev = item->prev();
+
+    if (shape->is_marked() || shape->parent() == NULL) {
+      shape->is_marked(false);
+      continue;
+    }
+
+    shape->parent()->RemoveTransition(shape);
+    heap()->shapes()->Remove(item);
+  }
+
+  shapes_recycled_ = true;
+}
+
+
 void GC::ProcessGrey() {
   while (grey_items()->length() != 0) {
     GCValue* value = grey_items()->Shift();
@@ -228,17 +1759,16 @@ void GC::ProcessGrey() {
       }
       assert(!value->value()->IsSoftGCMarked());
 
-      HValue* hvalue;
-
-      if (gc_type() == kNewSpace) {
-        // New space GC
-        hvalue = value->value()->CopyTo(heap()->old_space(), tmp_space());
-      } else {
-        // Old space GC
-        hvalue = value->value()->CopyTo(tmp_space(), heap()->new_space());
-      }
+      // Evacuate object from sparse page
+      HValue* hvalue = value->value()->CopyTo(heap()->old_space(),
+                                              heap()->new_space());
+      hvalue->ResetEvacuationCandidate();
+      event_.bytes_copied += hvalue->Size();
 
       value->Relocate(hvalue->addr());
+
+      // Moved object should be checked for young references again
+      promoted_items()->Push(hvalue);
       GC::VisitValue(hvalue);
     } else {
       value->Relocate(value->value()->GetGCMark());
@@ -248,8 +1778,7 @@ void GC::ProcessGrey() {
 
 
 bool GC::IsInCurrentSpace(HValue* value) {
-  return (gc_type() == kOldSpace &&
-         value->Generation() >= Heap::kMinOldSpaceGeneration) ||
+  return (gc_type() == kOldSpace && value->IsEvacuationCandidate()) ||
          (gc_type() == kNewSpace &&
          value->Generation() < Heap::kMinOldSpaceGeneration);
 }
@@ -268,7 +1797,7 @@ void GC::VisitValue(HValue* value) {
     case Heap::kTagMap:
       return VisitMap(value->As<HMap>());
 
-      // non-cons strings and numbers ain't referencing anyone
+      // flat strings and numbers ain't referencing anyone
     case Heap::kTagString:
       {
         HString::Representation r;
@@ -277,6 +1806,7 @@ void GC::VisitValue(HValue* value) {
           case HString::kNormal:
             break;
           case HString::kCons:
+          case HString::kSliced:
             return VisitString(value);
         }
       }
@@ -315,10 +1845,7 @@ void GC::VisitFunction(HFunction* fn) {
 
 
 void GC::VisitObject(HObject* obj) {
-  if (obj->proto() != NULL) {
-    push_weak(HValue::Cast(obj->proto()), obj->proto_slot());
-  }
-
+  if (obj->shape() != NULL) obj->shape()->Mark();
   push_grey(HValue::Cast(obj->map()), obj->map_slot());
 }
 
@@ -340,6 +1867,13 @@ void GC::VisitMap(HMap* map) {
 
 
 void GC::VisitString(HValue* value) {
+  if (HValue::GetRepresentation<HString::Representation>(value->addr()) ==
+      HString::kSliced) {
+    push_grey(HValue::Cast(HString::Parent(value->addr())),
+              HString::ParentSlot(value->addr()));
+    return;
+  }
+
   push_grey(HValue::Cast(HString::LeftCons(value->addr())),
             HString::LeftConsSlot(value->addr()));
   push_grey(HValue::Cast(HString::RightCons(value->addr())),
@@ -23,6 +23,9 @@
 #ifndef _SRC_GC_H_
 #define _SRC_GC_H_
 
+#include <pthread.h>  // pthread_t, pthread_mutex_t
+
+#include "candor.h"  // Isolate::GCEvent
 #include "zone.h"  // ZoneObject
 #include "utils.h"  // List
 
@@ -38,6 +41,118 @@ class HFunction;
 class HObject;
 class HArray;
 class HMap;
+class Safepoint;
+
+typedef GenericList<HValue*, EmptyClass, NopPolicy> HValueList;
+typedef void (*OutOfMemoryCallback)();
+
+class GC;
+
+// Visits stack slots of JIT frames that may hold heap values. C++ frames are
+// skipped, and only live spill slots of optimized frames are visited (as
+// described by safepoints recorded at their call sites)
+class StackIterator {
+ public:
+  StackIterator(Heap* heap, char* stack_top, char* frame);
+
+  // Returns NULL once all frames were visited
+  char** Next();
+
+ protected:
+  Heap* heap_;
+  char** slot_;
+  char** frame_;
+  Safepoint* safepoint_;
+};
+
+
+// Grey objects of one scavenger thread, other threads may steal from it.
+// Lock-free Chase-Lev deque: owner pushes and pops at the bottom, thieves
+// take items from the top, only the last item is contended with CAS.
+class GCWorkQueue {
+ public:
+  GCWorkQueue();
+  ~GCWorkQueue();
+
+  // Owner's end
+  void Push(HValue* value);
+  HValue* Pop();
+
+  // Thieves' end (NULL if empty or lost a race)
+  HValue* Steal();
+
+  inline bool IsEmpty() { return bottom_ <= top_; }
+
+ protected:
+  // Circular buffer, replaced ones are kept alive until queue's destruction
+  // since thieves may still read from them
+  class Buffer {
+   public:
+    Buffer(intptr_t size, Buffer* prev);
+    ~Buffer();
+
+    inline HValue* Get(intptr_t i) { return items_[i & (size_ - 1)]; }
+    inline void Put(intptr_t i, HValue* v) { items_[i & (size_ - 1)] = v; }
+
+    HValue** items_;
+    intptr_t size_;
+    Buffer* prev_;
+  };
+
+  Buffer* Grow(Buffer* buffer, intptr_t bottom, intptr_t top);
+
+  Buffer* volatile buffer_;
+  volatile intptr_t top_;
+  volatile intptr_t bottom_;
+};
+
+
+// Thread-local state of parallel scavenger
+class GCWorker {
+ public:
+  GCWorker(GC* gc, int index);
+
+  // Local allocation buffer in one of target spaces
+  class LAB {
+   public:
+    LAB() : top_(NULL), limit_(NULL) {
+    }
+
+    char* top_;
+    char* limit_;
+  };
+
+  void Run();
+  static void* RunThread(void* worker);
+
+  inline void ScavengeSlot(char** slot);
+  HValue* Steal();
+  char* Allocate(Space* space, LAB* lab, uint32_t bytes);
+
+  // Put filler into unused part of LABs
+  void CloseLABs();
+  void CloseLAB(LAB* lab);
+
+  inline GC* gc() { return gc_; }
+  inline GCWorkQueue* queue() { return &queue_; }
+  inline HValueList* promoted_items() { return &promoted_items_; }
+  inline pthread_t* thread() { return &thread_; }
+
+  // Objects larger than that are allocated directly in space
+  static const uint32_t kLABSize = 32 * 1024;
+
+ protected:
+  GC* gc_;
+  int index_;
+  pthread_t thread_;
+
+  GCWorkQueue queue_;
+  HValueList promoted_items_;
+
+  LAB new_lab_;
+  LAB old_lab_;
+};
+
 
 class GC {
  public:
@@ -63,17 +178,122 @@ class GC {
 
   typedef ZoneList<GCValue*> GCList;
 
-  explicit GC(Heap* heap) : heap_(heap), gc_type_(kNone) {
-  }
+  explicit GC(Heap* heap);
+  ~GC();
+
+  // Incremental marking is paced by allocation: every allocated byte buys
+  // at least N bytes of marking, more if the rest of marking work wouldn't
+  // fit into old space's headroom otherwise. Steps are never smaller than
+  // kMinMarkingStepSize.
+  static const uint32_t kMarkingSpeed = 2;
+  static const uint32_t kMinMarkingStepSize = 64 * 1024;
+
+  // Old space may grow over its limit by 1/N while marking, to let steps
+  // finish the work instead of the final pause
+  static const uint32_t kMarkingOvershootRatio = 4;
+
+  // New space grows if more than N% of it has survived or GC took more
+  // than M% of time since previous collection, and shrinks if less than
+  // L% has survived
+  static const uint32_t kHighSurvivalRate = 50;
+  static const uint32_t kLowSurvivalRate = 10;
+  static const uint32_t kMaxGCCost = 10;
+
+  // Idle-time GC: new space is scavenged if it is N% full, marking is
+  // started if old space has reached M% of its limit. Marking is done in
+  // smaller steps to better fit into deadline.
+  static const uint32_t kIdleScavengeRatio = 80;
+  static const uint32_t kIdleMarkingRatio = 80;
+  static const uint32_t kIdleMarkingStepSize = 128 * 1024;
+
+  // Collection is requested once native memory held by heap objects has
+  // grown by N bytes since the end of the last mark cycle
+  static const int64_t kExternalMemoryLimit = 64 * 1024 * 1024;
+
+  // Old space is compacted if more than 1/N of it is dead after sweeping
+  static const uint32_t kMaxFragmentationRatio = 2;
+
+  // Only pages with less than 1/N of live bytes are evacuated
+  static const uint32_t kEvacuationRatio = 2;
+
+  // `stack_top` and `frame` are stack and frame pointers of the code that
+  // has triggered collection
+  void CollectGarbage(char* stack_top, char* frame);
+
+  // Do GC work that is expected to fit into `budget` microseconds,
+  // returns true if there's more work left
+  bool IdleNotification(char* stack_top, char* frame, uint64_t budget);
+  uint64_t EstimateScavengeTime();
+
+  // Cheney-style new space collection
+  void Scavenge(char* stack_top, char* frame);
+  inline void ScavengeSlot(char** slot);
+  void ScavengeObject(HValue* value);
+  void ScavengeCards();
+  void ProcessScavengeQueue();
+
+  // Scan grey objects with `threads()` workers
+  void ParallelScavenge();
+
+  // Incremental (non-moving) marking of old space
+  void StartMarking(char* stack_top, char* frame);
+  void MarkingStep();
+  void MarkingStep(uint64_t budget);
+  void FinishMarking(char* stack_top, char* frame);
+  void MarkValue(char* value);
+  void GreyValue(char* value);
+  void MarkChildren(HValue* value);
+  void ProcessMarkingDeque(uint64_t budget);
+  void ResetMarks(Space* space);
+  uint64_t AllocatedBytes();
+
+  // Old space is swept by background thread, mutator helps it when
+  // it needs memory. Returns true if compaction is needed.
+  void StartSweeping();
+  bool FinishSweeping();
+  static void* RunSweeper(void* gc);
+
+  // Heap sizing: resize heap by survival rate and time spent in GC
+  void UpdateNewSpaceLimit(uint32_t before, uint32_t survived, uint64_t start);
+  void UpdateOldSpaceLimit();
+  void ClampOldSpaceLimit(uint64_t limit);
+  bool IsOldSpaceFull();
+  uint32_t LiveSize();
+
+  // External memory: embedder reports native memory retained by heap
+  // objects and released by their weak callbacks
+  int64_t AdjustExternalMemory(int64_t delta);
+  bool IsExternalMemoryFull();
+
+  // Statistics: record space sizes before collection, and report event
+  // to the embedder after it
+  void StartEvent();
+  void ReportEvent(Isolate::GCEvent::Type type, uint64_t start);
+
+  // Run full GC if heap is over the hard limit, and fail if it didn't help
+  void CheckHeapLimit(char* stack_top, char* frame);
+  void OutOfMemory();
 
-  void CollectGarbage(char* stack_top);
+  // Compaction: move live objects out of sparse pages
+  bool SelectEvacuationCandidates(uint32_t free_bytes);
 
+  // Old space compaction
+  void Compact(char* stack_top, char* frame);
   void ColourPersistentHandles();
   void RelocateWeakHandles();
+  void RelocateStringTable();
 
-  void ColourFrames(char* stack_top);
+  void ClearRememberedSet();
+  void RebuildRememberedSet();
+  bool HasYoungReferences(HValue* value);
+  void CleanCards();
+
+  void ColourFrames(char* stack_top, char* frame);
   void HandleWeakReferences();
 
+  // Free shapes that weren't marked by visiting live objects and ICs
+  void RecycleShapes();
+
   void ProcessGrey();
 
   void VisitValue(HValue* value);
@@ -97,6 +317,9 @@ class GC {
   inline GCList* grey_items() { return &grey_items_; }
   inline GCList* weak_items() { return &weak_items_; }
   inline GCList* black_items() { return &black_items_; }
+  inline HValueList* promoted_items() { return &promoted_items_; }
+  inline HValueList* marking_deque() { return &marking_deque_; }
+  inline HValueList* young_deque() { return &young_deque_; }
   inline Heap* heap() { return heap_; }
   inline void tmp_space(Space* space) { tmp_space_ = space; }
   inline Space* tmp_space() { return tmp_space_; }
@@ -104,14 +327,107 @@ class GC {
   inline GCType gc_type() { return gc_type_; }
   inline void gc_type(GCType value) { gc_type_ = value; }
 
+  // Number of threads used by scavenger (1 - serial)
+  inline int threads() { return threads_; }
+  void threads(int value);
+
+  void new_space_size(uint32_t initial, uint32_t max);
+  inline void old_space_size(uint32_t initial, uint32_t max) {
+    old_space_size_ = initial;
+    max_old_space_size_ = max;
+    old_space_limit_ = initial;
+  }
+  inline void growth_factor(double value) { growth_factor_ = value; }
+  inline void heap_limit(uint32_t value) { heap_limit_ = value; }
+  inline uint32_t heap_limit() { return heap_limit_; }
+  inline void oom_callback(OutOfMemoryCallback cb) { oom_callback_ = cb; }
+
+  // Set when heap is over the limit after full GC, running script should
+  // be terminated
+  inline bool out_of_memory() { return out_of_memory_; }
+  inline void out_of_memory(bool value) { out_of_memory_ = value; }
+
+  // Set after compaction that freed dead shapes, reset by marking. Full
+  // shape table requests such compaction only once per marking cycle.
+  inline bool shapes_recycled() { return shapes_recycled_; }
+
+  inline void gc_callback(Isolate::GCCallback cb) { gc_callback_ = cb; }
+  inline uint32_t scavenges() { return scavenges_; }
+  inline uint32_t mark_cycles() { return mark_cycles_; }
+  inline uint32_t compactions() { return compactions_; }
+  inline uint64_t total_pause() { return total_pause_; }
+  inline int64_t external_memory() { return external_memory_; }
+
+  inline GCWorker* worker(int index) { return workers_[index]; }
+  inline volatile int32_t* idle_workers() { return &idle_workers_; }
+  inline pthread_mutex_t* allocation_mutex() { return &allocation_mutex_; }
+
  protected:
   GCList grey_items_;
   GCList weak_items_;
   GCList black_items_;
+  HValueList promoted_items_;
+
+  // Grey tenured objects, survives between marking steps
+  HValueList marking_deque_;
+
+  // Grey young objects, always drained before returning to mutator
+  HValueList young_deque_;
   Heap* heap_;
   Space* tmp_space_;
 
   GCType gc_type_;
+
+  int threads_;
+  GCWorker** workers_;
+  volatile int32_t idle_workers_;
+
+  // Guards target spaces while workers are refilling LABs
+  pthread_mutex_t allocation_mutex_;
+
+  pthread_t sweeper_thread_;
+  volatile bool sweeper_done_;
+
+  // Heap sizing configuration
+  uint32_t new_space_size_;
+  uint32_t max_new_space_size_;
+  uint32_t old_space_size_;
+  uint32_t max_old_space_size_;
+  double growth_factor_;
+  uint32_t heap_limit_;
+  OutOfMemoryCallback oom_callback_;
+  bool out_of_memory_;
+
+  // Heap sizing state
+  uint32_t new_space_target_;
+  uint32_t old_space_limit_;
+  uint64_t last_scavenge_;
+  uint64_t last_old_gc_;
+  uint64_t old_gc_time_;
+  bool shapes_recycled_;
+
+  // Marking pacer state: allocated bytes at the last step, and bytes to
+  // mark (estimated by old space size at start) and marked so far
+  uint64_t marking_allocated_;
+  uint64_t marking_work_;
+  uint64_t marked_bytes_;
+
+  // Duration and new space usage of the last scavenge
+  uint64_t scavenge_time_;
+  uint32_t scavenge_bytes_;
+
+  // Native memory retained by heap objects, and its amount that triggers
+  // collection
+  int64_t external_memory_;
+  int64_t external_memory_limit_;
+
+  // Statistics
+  Isolate::GCEvent event_;
+  Isolate::GCCallback gc_callback_;
+  uint32_t scavenges_;
+  uint32_t mark_cycles_;
+  uint32_t compactions_;
+  uint64_t total_pause_;
 };
 
 }  // namespace internal
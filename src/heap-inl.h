@@ -24,6 +24,7 @@
 #define _SRC_HEAP_INL_H_
 
 #include <stdint.h>  // int64_t, intptr_t
+#include <string.h>  // memset
 
 namespace candor {
 namespace internal {
@@ -82,6 +83,144 @@ inline void HValue::ResetSoftGCMark() {
 }
 
 
+inline bool HValue::IsRemembered() {
+  if (IsUnboxed(addr())) return false;
+  return (*reinterpret_cast<uint8_t*>(addr() + kGCMarkOffset) &
+          kRememberedBit) != 0;
+}
+
+
+// NOTE: Remembered and mark bits are updated atomically, background sweeper
+// may reset mark bit while mutator is updating remembered one
+inline void HValue::SetRemembered() {
+  __sync_fetch_and_or(reinterpret_cast<uint8_t*>(addr() + kGCMarkOffset),
+                      kRememberedBit);
+}
+
+
+inline void HValue::ResetRemembered() {
+  if (IsRemembered()) {
+    __sync_fetch_and_and(reinterpret_cast<uint8_t*>(addr() + kGCMarkOffset),
+                         ~kRememberedBit);
+  }
+}
+
+
+inline bool HValue::IsMarked() {
+  if (IsUnboxed(addr())) return false;
+  return (*reinterpret_cast<uint8_t*>(addr() + kGCMarkOffset) &
+          kMarkBit) != 0;
+}
+
+
+inline void HValue::SetMarked() {
+  *reinterpret_cast<uint8_t*>(addr() + kGCMarkOffset) |= kMarkBit;
+}
+
+
+inline void HValue::ResetMarked() {
+  if (IsMarked()) {
+    __sync_fetch_and_and(reinterpret_cast<uint8_t*>(addr() + kGCMarkOffset),
+                         ~kMarkBit);
+  }
+}
+
+
+inline bool HValue::IsEvacuationCandidate() {
+  if (IsUnboxed(addr())) return false;
+  return (*reinterpret_cast<uint8_t*>(addr() + kGCMarkOffset) &
+          kEvacuateBit) != 0;
+}
+
+
+inline void HValue::SetEvacuationCandidate() {
+  *reinterpret_cast<uint8_t*>(addr() + kGCMarkOffset) |= kEvacuateBit;
+}
+
+
+inline void HValue::ResetEvacuationCandidate() {
+  if (IsEvacuationCandidate()) {
+    *reinterpret_cast<uint8_t*>(addr() + kGCMarkOffset) ^= kEvacuateBit;
+  }
+}
+
+
+inline bool HValue::HasMemento() {
+  return (*reinterpret_cast<uint8_t*>(addr() + kGCMarkOffset) &
+          kMementoBit) != 0;
+}
+
+
+inline AllocationSite* HValue::GetMementoSite() {
+  assert(HasMemento());
+  char* memento = addr() + Size();
+  assert(GetTag(memento) == Heap::kTagMemento);
+  return *reinterpret_cast<AllocationSite**>(memento + interior_offset(1));
+}
+
+
+inline bool HValue::IsYoung(char* addr) {
+  if (addr == NULL || addr == HNil::New() || IsUnboxed(addr)) return false;
+  return Cast(addr)->Generation() < Heap::kMinOldSpaceGeneration;
+}
+
+
+inline void Heap::RecordWrite(char* host, char* value) {
+  HValue* hhost = HValue::Cast(host);
+
+  // Only old->new pointers are interesting for new space GC
+  if (hhost->IsRemembered() ||
+      hhost->Generation() < kMinOldSpaceGeneration ||
+      !HValue::IsYoung(value)) {
+    return;
+  }
+
+  // Slot is unknown - whole map should be visited
+  if (HasCards(hhost)) {
+    memset(Cards(hhost), 1, CardCount(hhost));
+    return;
+  }
+
+  Remember(hhost);
+}
+
+
+inline void Heap::RecordSlot(char* host, char** slot) {
+  HValue* hhost = HValue::Cast(host);
+  if (!HasCards(hhost)) return RecordWrite(host, *slot);
+
+  // Large maps are always tenured
+  if (!HValue::IsYoung(*slot)) return;
+  Cards(hhost)[(reinterpret_cast<char*>(slot) - host) / kCardSize] = 1;
+}
+
+
+inline bool Heap::HasCards(HValue* host) {
+  if (host->tag() != kTagMap) return false;
+
+  // tag + size + keys + values
+  uint32_t size = (2 + (host->As<HMap>()->size() << 1)) * HValue::kPointerSize;
+  return size >= kCardedMapSize;
+}
+
+
+inline uint32_t Heap::CardCount(HValue* host) {
+  return (host->Size() + kCardSize - 1) / kCardSize;
+}
+
+
+inline uint8_t* Heap::Cards(HValue* host) {
+  // Large map is the first object on its page
+  return Space::Page::FromAddress(page_pool(), host->addr())->cards_;
+}
+
+
+inline void Heap::MarkingBarrier(char* value) {
+  if (!is_marking()) return;
+  gc()->MarkValue(value);
+}
+
+
 inline void HValue::IncrementGeneration() {
   // tag, generation, reserved, GC mark
   if (Generation() < Heap::kMinOldSpaceGeneration) {
@@ -91,6 +230,12 @@ inline void HValue::IncrementGeneration() {
 }
 
 
+inline void HValue::Tenure() {
+  *reinterpret_cast<uint8_t*>(addr() + kGenerationOffset) =
+      Heap::kMinOldSpaceGeneration;
+}
+
+
 inline uint8_t HValue::Generation() {
   return *reinterpret_cast<uint8_t*>(addr() + kGenerationOffset);
 }
@@ -161,8 +306,47 @@ inline void HArray::SetLength(char* obj, int64_t length) {
 
 
 inline bool HArray::IsDense(char* obj) {
-  int size = HValue::As<HMap>(Map(obj))->size();
-  return size <= kDenseLengthMax;
+  return GetRepresentation<Representation>(obj) <= kDense;
+}
+
+
+inline bool HArray::IsDouble(char* obj) {
+  return GetRepresentation<Representation>(obj) == kDenseDouble;
+}
+
+
+inline uint32_t HArray::Capacity(char* obj) {
+  if (IsDouble(obj)) return Mask(obj) / HNumber::kDoubleSize + 1;
+
+  assert(IsDense(obj));
+  return Mask(obj) / kPointerSize + 1;
+}
+
+
+inline uint32_t HArray::DenseMask(uint32_t map_size) {
+  return ((map_size << 1) - 1) * kPointerSize;
+}
+
+
+inline uint32_t HArray::DoubleMask(uint32_t capacity) {
+  return (capacity - 1) * HNumber::kDoubleSize;
+}
+
+
+inline double* HArray::DoubleElements(char* obj) {
+  assert(IsDouble(obj));
+  return reinterpret_cast<double*>(HCData::Data(Map(obj)));
+}
+
+
+inline bool HArray::IsDoubleHole(double* element) {
+  return reinterpret_cast<uint32_t*>(element)[1] == kDoubleHoleHalf;
+}
+
+
+inline void HArray::SetDoubleHole(double* element) {
+  reinterpret_cast<uint32_t*>(element)[0] = kDoubleHoleHalf;
+  reinterpret_cast<uint32_t*>(element)[1] = kDoubleHoleHalf;
 }
 
 
@@ -194,6 +378,7 @@ inline void HFunction::SetContext(char* addr, char* context) {
 
   char** root_slot = hroot->GetSlotAddress(Heap::kRootGlobalIndex);
   *root_slot = context;
+  Heap::Current()->RecordWrite(hroot->addr(), context);
 }
 
 }  // namespace internal
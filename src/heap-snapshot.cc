@@ -0,0 +1,416 @@
+/**
+ * Copyright (c) 2012, Fedor Indutny.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "heap-snapshot.h"
+
+#include <stdio.h>  // fopen, fprintf
+#include <stdlib.h>  // qsort, NULL
+#include <stdint.h>  // uint32_t
+#include <inttypes.h>  // PRIu64
+
+#include "heap.h"  // Heap, HValue
+#include "heap-inl.h"
+#include "gc.h"  // StackIterator
+
+namespace candor {
+namespace internal {
+
+// Node that is on DFS stack, but isn't numbered yet
+static const uint32_t kVisiting = HeapSnapshot::kNone - 1;
+
+static const char* node_types[] = {
+  "root", "nil", "context", "boolean", "number", "string", "object", "array",
+  "function", "cdata", "map"
+};
+
+static const char* edge_types[] = {
+  "handle", "stack", "parent", "slot", "root-context", "map",
+  "property", "cons", "slice"
+};
+
+
+HeapSnapshot::HeapSnapshot(Heap* heap) : heap_(heap),
+                                         nodes_(NULL),
+                                         node_count_(0),
+                                         edges_(NULL),
+                                         edge_count_(0),
+                                         post_order_(NULL) {
+}
+
+
+HeapSnapshot::~HeapSnapshot() {
+  delete[] nodes_;
+  delete[] edges_;
+  delete[] post_order_;
+}
+
+
+static int CompareNodes(const void* a, const void* b) {
+  char* left = reinterpret_cast<const HeapSnapshot::Node*>(a)->addr;
+  char* right = reinterpret_cast<const HeapSnapshot::Node*>(b)->addr;
+
+  return left == right ? 0 : left > right ? 1 : -1;
+}
+
+
+void HeapSnapshot::Take() {
+  // Old space could be walked only once it's swept
+  if (heap()->old_space()->is_sweeping() && heap()->gc()->FinishSweeping()) {
+    heap()->needs_gc(Heap::kGCOldSpace);
+  }
+
+  // Count objects, root takes the first slot
+  node_count_ = 1;
+  VisitSpace(heap()->new_space()->pages());
+  VisitSpace(heap()->old_space()->pages());
+  VisitSpace(heap()->large_space()->pages());
+
+  nodes_ = new Node[node_count_];
+  nodes_[kRoot].addr = NULL;
+  nodes_[kRoot].tag = static_cast<Heap::HeapTag>(0);
+  nodes_[kRoot].size = 0;
+
+  node_count_ = 1;
+  VisitSpace(heap()->new_space()->pages());
+  VisitSpace(heap()->old_space()->pages());
+  VisitSpace(heap()->large_space()->pages());
+
+  // Edges are resolved with binary search
+  qsort(nodes_ + 1, node_count_ - 1, sizeof(*nodes_), CompareNodes);
+
+  // Count edges
+  edge_count_ = 0;
+  VisitRoots();
+  for (uint32_t i = 1; i < node_count_; i++) VisitEdges(node(i));
+
+  // And record them
+  edges_ = new Edge[edge_count_];
+  edge_count_ = 0;
+  for (uint32_t i = 0; i < node_count_; i++) {
+    Node* n = node(i);
+    n->first_edge = edge_count_;
+    if (i == kRoot) {
+      VisitRoots();
+    } else {
+      VisitEdges(n);
+    }
+    n->edge_count = edge_count_ - n->first_edge;
+  }
+
+  ComputeDominators();
+}
+
+
+void HeapSnapshot::VisitSpace(List<Space::Page*, EmptyClass>* pages) {
+  List<Space::Page*, EmptyClass>::Item* item = pages->head();
+  for (; item != NULL; item = item->next()) {
+    Space::Page* page = item->value();
+
+    char* obj = page->first();
+    while (obj < page->top_) {
+      HValue* value = HValue::Cast(obj);
+      uint32_t size = value->Size();
+      obj += size + (size & 0x01);
+
+      // Fillers and allocation mementos aren't objects
+      if (value->tag() == Heap::kTagFree || value->tag() == Heap::kTagMemento) {
+        continue;
+      }
+
+      if (nodes_ != NULL) {
+        Node* n = node(node_count_);
+        n->addr = value->addr();
+        n->tag = value->tag();
+        n->size = size;
+      }
+      node_count_++;
+    }
+  }
+}
+
+
+void HeapSnapshot::VisitRoots() {
+  HValueRefMap::Item* item = heap()->references()->head();
+  for (; item != NULL; item = item->next_scalar()) {
+    HValueReference* ref = item->value();
+    if (!ref->is_persistent()) continue;
+
+    AddEdge(kEdgeHandle, reinterpret_cast<char*>(ref->value()));
+  }
+
+  // JIT frames are on stack only if snapshot is taken from C++ binding
+  StackIterator it(heap(), *heap()->last_stack(), *heap()->last_frame());
+  char** slot;
+  while ((slot = it.Next()) != NULL) {
+    AddEdge(kEdgeStack, *slot);
+  }
+}
+
+
+void HeapSnapshot::VisitEdges(Node* node) {
+  HValue* value = HValue::Cast(node->addr);
+
+  switch (node->tag) {
+    case Heap::kTagContext:
+      {
+        HContext* context = value->As<HContext>();
+        if (context->has_parent()) AddEdge(kEdgeParent, context->parent());
+        for (uint32_t i = 0; i < context->slots(); i++) {
+          if (!context->HasSlot(i)) continue;
+          AddEdge(kEdgeSlot, *context->GetSlotAddress(i));
+        }
+      }
+      break;
+    case Heap::kTagFunction:
+      {
+        HFunction* fn = value->As<HFunction>();
+        if (fn->parent_slot() != NULL &&
+            fn->parent() != reinterpret_cast<char*>(Heap::kBindingContextTag)) {
+          AddEdge(kEdgeParent, fn->parent());
+        }
+        if (fn->root_slot() != NULL) AddEdge(kEdgeRootContext, fn->root());
+      }
+      break;
+    case Heap::kTagObject:
+    case Heap::kTagArray:
+      AddEdge(kEdgeMap, HObject::Map(value->addr()));
+      break;
+    case Heap::kTagMap:
+      {
+        HMap* map = value->As<HMap>();
+        uint32_t size = map->size() << 1;
+        for (uint32_t i = 0; i < size; i++) {
+          if (map->IsEmptySlot(i)) continue;
+          AddEdge(kEdgeProperty, *map->GetSlotAddress(i));
+        }
+      }
+      break;
+    case Heap::kTagString:
+      switch (HValue::GetRepresentation<HString::Representation>(
+            value->addr())) {
+        case HString::kCons:
+          AddEdge(kEdgeCons, HString::LeftCons(value->addr()));
+          AddEdge(kEdgeCons, HString::RightCons(value->addr()));
+          break;
+        case HString::kSliced:
+          AddEdge(kEdgeSlice, HString::Parent(value->addr()));
+          break;
+        default:
+          break;
+      }
+      break;
+    default:
+      break;
+  }
+}
+
+
+void HeapSnapshot::AddEdge(EdgeType type, char* value) {
+  if (value == NULL || value == HNil::New() || HValue::IsUnboxed(value)) {
+    return;
+  }
+
+  // Stale and conservative pointers are ignored
+  Node* target = Find(value);
+  if (target == NULL) return;
+
+  if (edges_ != NULL) {
+    edges_[edge_count_].type = type;
+    edges_[edge_count_].to = target - nodes_;
+  }
+  edge_count_++;
+}
+
+
+HeapSnapshot::Node* HeapSnapshot::Find(char* addr) {
+  uint32_t start = 1;
+  uint32_t end = node_count_;
+
+  while (start < end) {
+    uint32_t middle = start + ((end - start) >> 1);
+    Node* n = node(middle);
+
+    if (n->addr == addr) return n;
+    if (n->addr < addr) {
+      start = middle + 1;
+    } else {
+      end = middle;
+    }
+  }
+
+  return NULL;
+}
+
+
+// See "A Simple, Fast Dominance Algorithm" by Cooper, Harvey and Kennedy
+void HeapSnapshot::ComputeDominators() {
+  uint32_t* order = new uint32_t[node_count_];
+  uint32_t* stack = new uint32_t[node_count_];
+  uint32_t* cursor = new uint32_t[node_count_];
+
+  post_order_ = new uint32_t[node_count_];
+  for (uint32_t i = 0; i < node_count_; i++) {
+    post_order_[i] = kNone;
+    node(i)->dominator = kNone;
+    node(i)->retained = node(i)->size;
+  }
+
+  // Number reachable nodes in post-order (root gets the last number)
+  uint32_t reachable = 0;
+  uint32_t depth = 1;
+  stack[0] = kRoot;
+  cursor[0] = root()->first_edge;
+  post_order_[kRoot] = kVisiting;
+  while (depth > 0) {
+    Node* n = node(stack[depth - 1]);
+
+    if (cursor[depth - 1] < n->first_edge + n->edge_count) {
+      uint32_t to = edge(cursor[depth - 1]++)->to;
+      if (post_order_[to] != kNone) continue;
+
+      post_order_[to] = kVisiting;
+      stack[depth] = to;
+      cursor[depth] = node(to)->first_edge;
+      depth++;
+      continue;
+    }
+
+    depth--;
+    post_order_[stack[depth]] = reachable;
+    order[reachable++] = stack[depth];
+  }
+  delete[] stack;
+  delete[] cursor;
+
+  // Reverse edges
+  uint32_t* pred_start = new uint32_t[node_count_ + 1];
+  uint32_t* preds = new uint32_t[edge_count_];
+  for (uint32_t i = 0; i <= node_count_; i++) pred_start[i] = 0;
+  for (uint32_t i = 0; i < edge_count_; i++) pred_start[edge(i)->to + 1]++;
+  for (uint32_t i = 0; i < node_count_; i++) {
+    pred_start[i + 1] += pred_start[i];
+  }
+  uint32_t* pred_fill = new uint32_t[node_count_];
+  for (uint32_t i = 0; i < node_count_; i++) pred_fill[i] = pred_start[i];
+  for (uint32_t i = 0; i < node_count_; i++) {
+    Node* n = node(i);
+    for (uint32_t j = 0; j < n->edge_count; j++) {
+      uint32_t to = edge(n->first_edge + j)->to;
+      preds[pred_fill[to]++] = i;
+    }
+  }
+  delete[] pred_fill;
+
+  // Refine dominators in reverse post-order until they settle
+  root()->dominator = kRoot;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (uint32_t i = reachable - 1; i > 0; i--) {
+      uint32_t n = order[i - 1];
+
+      uint32_t dominator = kNone;
+      for (uint32_t j = pred_start[n]; j < pred_start[n + 1]; j++) {
+        uint32_t pred = preds[j];
+
+        // Unreachable or not yet processed
+        if (node(pred)->dominator == kNone) continue;
+        dominator = dominator == kNone ? pred : Intersect(pred, dominator);
+      }
+
+      if (node(n)->dominator != dominator) {
+        node(n)->dominator = dominator;
+        changed = true;
+      }
+    }
+  }
+  delete[] pred_start;
+  delete[] preds;
+
+  // Dominator always has greater post-order number than the nodes it
+  // dominates, so retained sizes are accumulated in a single pass
+  for (uint32_t i = 0; i + 1 < reachable; i++) {
+    Node* n = node(order[i]);
+    node(n->dominator)->retained += n->retained;
+  }
+  delete[] order;
+}
+
+
+uint32_t HeapSnapshot::Intersect(uint32_t a, uint32_t b) {
+  while (a != b) {
+    while (post_order_[a] < post_order_[b]) a = node(a)->dominator;
+    while (post_order_[b] < post_order_[a]) b = node(b)->dominator;
+  }
+
+  return a;
+}
+
+
+bool HeapSnapshot::Write(const char* filename) {
+  FILE* fp = fopen(filename, "w");
+  if (fp == NULL) return false;
+
+  fprintf(fp, "{\"snapshot\":{"
+              "\"node_fields\":[\"id\",\"type\",\"size\",\"retained\","
+              "\"dominator\",\"edge_count\"],"
+              "\"edge_fields\":[\"type\",\"to\"],\n\"node_types\":[");
+  for (uint32_t i = 0; i < sizeof(node_types) / sizeof(*node_types); i++) {
+    fprintf(fp, "%s\"%s\"", i == 0 ? "" : ",", node_types[i]);
+  }
+  fprintf(fp, "],\n\"edge_types\":[");
+  for (uint32_t i = 0; i < sizeof(edge_types) / sizeof(*edge_types); i++) {
+    fprintf(fp, "%s\"%s\"", i == 0 ? "" : ",", edge_types[i]);
+  }
+  fprintf(fp, "],\n\"node_count\":%u,\"edge_count\":%u},\n\"nodes\":[",
+          node_count_,
+          edge_count_);
+
+  for (uint32_t i = 0; i < node_count_; i++) {
+    Node* n = node(i);
+    fprintf(fp,
+            "%s\n%" PRIu64 ",%d,%u,%" PRIu64 ",%" PRId64 ",%u",
+            i == 0 ? "" : ",",
+            static_cast<uint64_t>(reinterpret_cast<uintptr_t>(n->addr)),
+            n->tag,
+            n->size,
+            n->retained,
+            n->dominator == kNone ? -1 : static_cast<int64_t>(n->dominator),
+            n->edge_count);
+  }
+
+  fprintf(fp, "],\n\"edges\":[");
+  for (uint32_t i = 0; i < edge_count_; i++) {
+    fprintf(fp,
+            "%s%d,%u",
+            i == 0 ? "" : i % 16 == 0 ? ",\n" : ",",
+            edge(i)->type,
+            edge(i)->to);
+  }
+  fprintf(fp, "]}\n");
+
+  return fclose(fp) == 0;
+}
+
+}  // namespace internal
+}  // namespace candor
@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) 2012, Fedor Indutny.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef _SRC_HEAP_SNAPSHOT_H_
+#define _SRC_HEAP_SNAPSHOT_H_
+
+#include <stdint.h>  // uint32_t
+
+#include "heap.h"  // Heap, HValue
+
+namespace candor {
+namespace internal {
+
+// Graph of all objects in heap spaces with references between them.
+// Synthetic root node refers to persistent handles and on-stack values,
+// retained size of object is the total size of objects it dominates
+// (objects that would die together with it).
+class HeapSnapshot {
+ public:
+  enum EdgeType {
+    kEdgeHandle,
+    kEdgeStack,
+    kEdgeParent,
+    kEdgeSlot,
+    kEdgeRootContext,
+    kEdgeMap,
+    kEdgeProperty,
+    kEdgeCons,
+    kEdgeSlice
+  };
+
+  struct Node {
+    char* addr;
+    Heap::HeapTag tag;
+    uint32_t size;
+    uint32_t first_edge;
+    uint32_t edge_count;
+
+    // Immediate dominator's index, kNone for unreachable nodes
+    uint32_t dominator;
+    uint64_t retained;
+  };
+
+  struct Edge {
+    EdgeType type;
+    uint32_t to;
+  };
+
+  explicit HeapSnapshot(Heap* heap);
+  ~HeapSnapshot();
+
+  // Walk all spaces, should not be called while GC is in progress
+  void Take();
+
+  // Write snapshot as JSON, see tools/heap-snapshot.py for format
+  bool Write(const char* filename);
+
+  // Returns NULL if there's no object at `addr`
+  Node* Find(char* addr);
+
+  inline Node* root() { return &nodes_[kRoot]; }
+  inline Node* node(uint32_t index) { return &nodes_[index]; }
+  inline Edge* edge(uint32_t index) { return &edges_[index]; }
+  inline uint32_t node_count() { return node_count_; }
+  inline uint32_t edge_count() { return edge_count_; }
+
+  inline Heap* heap() { return heap_; }
+
+  static const uint32_t kRoot = 0;
+  static const uint32_t kNone = 0xFFFFFFFF;
+
+ protected:
+  void VisitSpace(List<Space::Page*, EmptyClass>* pages);
+  void VisitRoots();
+  void VisitEdges(Node* node);
+  void AddEdge(EdgeType type, char* value);
+
+  void ComputeDominators();
+  uint32_t Intersect(uint32_t a, uint32_t b);
+
+  Heap* heap_;
+
+  Node* nodes_;
+  uint32_t node_count_;
+
+  // Edges are counted on the first pass, and recorded on the second one
+  Edge* edges_;
+  uint32_t edge_count_;
+
+  // Post-order indexes of reachable nodes (kNone for others)
+  uint32_t* post_order_;
+};
+
+}  // namespace internal
+}  // namespace candor
+
+#endif  // _SRC_HEAP_SNAPSHOT_H_
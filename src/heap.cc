@@ -27,6 +27,7 @@
 #include <string.h>  // memcpy
 #include <zone.h>  // Zone::Allocate
 #include <assert.h>  // assert
+#include <sys/mman.h>  // mmap, madvise
 
 #include "heap-inl.h"
 #include "runtime.h"  // RuntimeLookupProperty
@@ -36,28 +37,165 @@ namespace internal {
 
 Heap* Heap::current_ = NULL;
 
+PagePool::PagePool(uint32_t page_size) : page_size_(page_size),
+                                         huge_pages_(false),
+                                         uncommit_delay_(kDefaultUncommitDelay) {
+  // Pages are found by masking addresses
+  assert((page_size & (page_size - 1)) == 0);
+  assert(page_size % GetPageSize() == 0);
+
+  pthread_mutex_init(&mutex_, NULL);
+}
+
+
+PagePool::~PagePool() {
+  while (free_.length() != 0) {
+    Entry* entry = free_.Shift();
+    Unmap(entry->data_, page_size_);
+    delete entry;
+  }
+  pthread_mutex_destroy(&mutex_);
+}
+
+
+char* PagePool::Get(uint32_t size) {
+  // Only regular pages are reused
+  if (size == page_size_) {
+    pthread_mutex_lock(&mutex_);
+    Entry* entry = free_.Pop();
+    pthread_mutex_unlock(&mutex_);
+
+    if (entry != NULL) {
+      char* data = entry->data_;
+      delete entry;
+      return data;
+    }
+  }
+
+  return Map(size);
+}
+
+
+void PagePool::Release(char* data, uint32_t size) {
+  if (size != page_size_) return Unmap(data, size);
+
+  pthread_mutex_lock(&mutex_);
+  free_.Push(new Entry(data, GetTimeUs() / 1000));
+  pthread_mutex_unlock(&mutex_);
+}
+
+
+void PagePool::Uncommit() {
+  uint64_t now = GetTimeUs() / 1000;
+
+  pthread_mutex_lock(&mutex_);
+  EntryList::Item* item = free_.head();
+  for (; item != NULL; item = item->next()) {
+    Entry* entry = item->value();
+    if (!entry->committed_ || now - entry->released_ < uncommit_delay_) {
+      continue;
+    }
+
+    // Memory will be zero-filled by OS on next access
+    madvise(entry->data_, page_size_, MADV_DONTNEED);
+    entry->committed_ = false;
+  }
+  pthread_mutex_unlock(&mutex_);
+}
+
+
+char* PagePool::Map(uint32_t size) {
+  // Reserve more to be able to align chunk
+  uint32_t reserved = size + page_size_;
+  char* raw = reinterpret_cast<char*>(mmap(NULL,
+                                           reserved,
+                                           PROT_READ | PROT_WRITE,
+                                           MAP_ANON | MAP_PRIVATE,
+                                           -1,
+                                           0));
+  if (raw == MAP_FAILED) abort();
+
+  intptr_t mask = static_cast<intptr_t>(page_size_ - 1);
+  char* data = reinterpret_cast<char*>(
+      (reinterpret_cast<intptr_t>(raw) + mask) & ~mask);
+
+  // Give back unaligned head and unused tail
+  if (data != raw) munmap(raw, data - raw);
+  uint32_t tail = reserved - (data - raw) - size;
+  if (tail != 0) munmap(data + size, tail);
+
+#ifdef MADV_HUGEPAGE
+  if (huge_pages_) madvise(data, size, MADV_HUGEPAGE);
+#endif  // MADV_HUGEPAGE
+
+  return data;
+}
+
+
+void PagePool::Unmap(char* data, uint32_t size) {
+  munmap(data, size);
+}
+
+
+Space::Page::Page(PagePool* pool, uint32_t size) : pool_(pool),
+                                                   size_(size),
+                                                   live_(0),
+                                                   swept_(true),
+                                                   cards_(NULL) {
+  data_ = pool->Get(size);
+  *reinterpret_cast<Page**>(data_) = this;
+
+  // Make all offsets odd (pointers are tagged with 1 at last bit)
+  top_ = first();
+  scan_ = top_;
+  limit_ = data_ + size;
+}
+
+
+Space::Page::~Page() {
+  pool_->Release(data_, size_);
+  delete[] cards_;
+}
+
+
 Space::Space(Heap* heap, uint32_t page_size) : heap_(heap),
+                                               top_(NULL),
+                                               limit_(NULL),
                                                root_(NULL),
                                                page_size_(page_size),
-                                               size_(0) {
+                                               size_(page_size),
+                                               size_limit_(page_size << 1),
+                                               allocated_(0),
+                                               allocation_start_(NULL),
+                                               sweeping_(false),
+                                               free_bytes_(0) {
+  pthread_mutex_init(&sweep_mutex_, NULL);
+
   // Create the first page
-  pages_.Push(new Page(page_size));
+  pages_.Push(new Page(heap->page_pool(), page_size));
 
   select(pages_.head()->value());
+}
+
 
-  compute_size_limit();
+Space::~Space() {
+  assert(!sweeping_);
+  pthread_mutex_destroy(&sweep_mutex_);
 }
 
 
 void Space::select(Page* page) {
+  if (top_ != NULL) allocated_ += *top_ - allocation_start_;
+
   top_ = &page->top_;
   limit_ = &page->limit_;
+  allocation_start_ = page->top_;
 }
 
 
 void Space::AddPage(uint32_t size) {
   uint32_t real_size = RoundUp(size, page_size());
-  Page* page = new Page(real_size);
+  Page* page = new Page(heap()->page_pool(), real_size);
   pages_.Push(page);
   size_ += real_size;
 
@@ -71,24 +209,48 @@ char* Space::Allocate(uint32_t bytes) {
   bool place_in_current = *top_ + even_bytes <= *limit_;
 
   if (!place_in_current) {
-    // Go through all pages to find gap
+    // Interleave old space marking with allocation
+    if (heap()->is_marking()) heap()->gc()->MarkingStep();
+
+    // Reuse space released by sweeper, sweep pages ourselves if the
+    // background sweeper hasn't reached them yet
+    char* result = AllocateFromFreeList(even_bytes);
+    while (result == NULL && SweepNextPage()) {
+      result = AllocateFromFreeList(even_bytes);
+    }
+    if (result != NULL) {
+      allocated_ += even_bytes;
+      return result;
+    }
+
+    Lock();
+
+    // Go through all swept pages to find gap
     List<Page*, EmptyClass>::Item* item = pages_.head();
     for (;*top_ + even_bytes > *limit_ && item != NULL; item = item->next()) {
-      select(item->value());
+      if (item->value()->swept_) select(item->value());
     }
 
     // No gap was found - allocate new page
-    if (item == NULL) {
-      if (size() > size_limit()) {
-        heap()->needs_gc(this == heap()->new_space() ?
-            Heap::kGCNewSpace
-            :
-            Heap::kGCOldSpace);
+    if (*top_ + even_bytes > *limit_) {
+      if (this == heap()->new_space()) {
+        if (size() > size_limit()) heap()->needs_gc(Heap::kGCNewSpace);
+      } else if (this == heap()->old_space()) {
+        if (heap()->gc()->IsOldSpaceFull()) {
+          heap()->needs_gc(Heap::kGCOldSpace);
+        }
       }
 
-      // Including tagging byte offset
-      AddPage(even_bytes + 1);
+      // Including page header and tagging byte offset
+      AddPage(even_bytes + Page::kHeaderSize + 1);
     }
+
+    result = *top_;
+    *top_ += even_bytes;
+
+    Unlock();
+
+    return result;
   }
 
   char* result = *top_;
@@ -108,27 +270,278 @@ void Space::Swap(Space* space) {
   }
 
   select(pages_.head()->value());
-  compute_size_limit();
+}
+
+
+uint32_t Space::used() {
+  uint32_t result = 0;
+
+  List<Page*, EmptyClass>::Item* item = pages_.head();
+  for (; item != NULL; item = item->next()) {
+    result += item->value()->top_ - item->value()->first();
+  }
+
+  return result;
+}
+
+
+void Space::RemovePage(List<Page*, EmptyClass>::Item* item) {
+  Page* page = item->value();
+  assert(top_ != &page->top_);
+
+  size_ -= page->size_;
+  pages_.Remove(item);
+}
+
+
+void Space::EvacuatePage(List<Page*, EmptyClass>::Item* item) {
+  Page* page = item->value();
+  assert(top_ != &page->top_);
+
+  // Don't let list deallocate page
+  item->value(NULL);
+  size_ -= page->size_;
+  pages_.Remove(item);
+
+  evacuated_pages_.Push(page);
+}
+
+
+void Space::ReleaseEvacuatedPages() {
+  while (evacuated_pages_.length() != 0) {
+    delete evacuated_pages_.Shift();
+  }
+}
+
+
+void Space::ClearFreeList() {
+  while (free_list_.length() != 0) free_list_.Shift();
+}
+
+
+char* Space::AllocateFromFreeList(uint32_t bytes) {
+  char* result = NULL;
+
+  Lock();
+  HValueList::Item* item = free_list_.head();
+  HValueList::Item* next;
+  for (; item != NULL; item = next) {
+    next = item->next();
+
+    char* addr = item->value()->addr();
+    uint32_t size = item->value()->As<HFreeBlock>()->size();
+
+    if (size == bytes) {
+      free_list_.Remove(item);
+      result = addr;
+      break;
+    }
+
+    // Remainder should be able to hold a filler
+    if (size >= bytes + HFreeBlock::kMinSize) {
+      char* rest = addr + bytes;
+      HFreeBlock::New(rest, size - bytes);
+
+      if (size - bytes < kMinFreeListBlock) {
+        free_list_.Remove(item);
+      } else {
+        item->value(HValue::Cast(rest));
+      }
+      result = addr;
+      break;
+    }
+
+    // Block is almost exhausted, leave it until the next sweep
+    if (size < kMinFreeListBlock) free_list_.Remove(item);
+  }
+  Unlock();
+
+  return result;
+}
+
+
+void Space::StartSweeping() {
+  assert(!sweeping_);
+
+  // Free list will be rebuilt from scratch
+  ClearFreeList();
+  free_bytes_ = 0;
+
+  List<Page*, EmptyClass>::Item* item = pages_.head();
+  for (; item != NULL; item = item->next()) {
+    Page* page = item->value();
+
+    // Mutator is allocating in current page, don't let sweeper touch it
+    if (top_ == &page->top_) {
+      SweepPage(page);
+      continue;
+    }
+
+    page->swept_ = false;
+    unswept_pages_.Push(page);
+  }
+
+  sweeping_ = true;
+}
+
+
+void Space::FinishSweeping() {
+  assert(sweeping_);
+
+  // Sweep whatever sweeper hasn't reached
+  while (SweepNextPage()) {
+  }
+
+  sweeping_ = false;
+}
+
+
+bool Space::SweepNextPage() {
+  if (!sweeping_) return false;
+
+  pthread_mutex_lock(&sweep_mutex_);
+  Page* page = unswept_pages_.Shift();
+  pthread_mutex_unlock(&sweep_mutex_);
+
+  if (page == NULL) return false;
+  SweepPage(page);
+
+  return true;
+}
+
+
+void Space::SweepPage(Page* page) {
+  HValueList blocks;
+
+  // Walk objects, reset marks and coalesce dead ones
+  char* free_start = NULL;
+  char* obj = page->first();
+  uint32_t live = 0;
+  while (obj < page->top_) {
+    HValue* value = HValue::Cast(obj);
+    uint32_t size = value->Size();
+    size += size & 0x01;
+
+    if (value->IsMarked()) {
+      value->ResetMarked();
+      live += size;
+
+      if (free_start != NULL) {
+        HFreeBlock::New(free_start, obj - free_start);
+        blocks.Push(HValue::Cast(free_start));
+        free_start = NULL;
+      }
+    } else if (free_start == NULL) {
+      free_start = obj;
+    }
+
+    obj += size;
+  }
+  assert(obj == page->top_);
+
+  Lock();
+  page->live_ = live;
+
+  // Current page can't be released
+  if (live == 0 && top_ != &page->top_) {
+    List<Page*, EmptyClass>::Item* item = pages_.head();
+    while (item->value() != page) item = item->next();
+    RemovePage(item);
+  } else {
+    // Dead tail is given back to page
+    if (free_start != NULL) page->top_ = free_start;
+
+    while (blocks.length() != 0) {
+      HValue* block = blocks.Shift();
+
+      // Tiny blocks aren't worth looking through
+      if (block->As<HFreeBlock>()->size() >= kMinFreeListBlock) {
+        free_list_.Push(block);
+      }
+    }
+
+    free_bytes_ += page->top_ - (page->first()) - page->live_;
+    page->swept_ = true;
+  }
+  Unlock();
 }
 
 
 void Space::Clear() {
+  ClearFreeList();
   size_ = 0;
+
+  // Account current page before it's gone
+  if (top_ != NULL) allocated_ += *top_ - allocation_start_;
+  top_ = NULL;
+  limit_ = NULL;
+
   while (pages_.length() != 0) {
     delete pages_.Shift();
   }
 }
 
 
-Heap::Heap(uint32_t page_size) : new_space_(this, page_size),
+LargeSpace::LargeSpace(Heap* heap) : heap_(heap), size_(0), allocated_(0) {
+}
+
+
+char* LargeSpace::Allocate(uint32_t bytes) {
+  // Interleave old space marking with allocation
+  if (heap()->is_marking()) heap()->gc()->MarkingStep();
+
+  // Chunk is still aligned by heap's page size, but is taking only as
+  // much OS pages as it needs
+  uint32_t even_bytes = bytes + (bytes & 0x01);
+  Space::Page* page = new Space::Page(
+      heap()->page_pool(),
+      RoundUp(even_bytes + Space::Page::kHeaderSize + 1, GetPageSize()));
+  pages_.Push(page);
+  size_ += page->size_;
+  allocated_ += even_bytes;
+
+  if (heap()->gc()->IsOldSpaceFull()) heap()->needs_gc(Heap::kGCOldSpace);
+
+  char* result = page->top_;
+  page->top_ += even_bytes;
+
+  return result;
+}
+
+
+void LargeSpace::Sweep() {
+  List<Space::Page*, EmptyClass>::Item* item = pages_.head();
+  List<Space::Page*, EmptyClass>::Item* next;
+  for (; item != NULL; item = next) {
+    Space::Page* page = item->value();
+    next = item->next();
+
+    HValue* value = HValue::Cast(page->first());
+    if (value->IsMarked()) {
+      value->ResetMarked();
+      continue;
+    }
+
+    size_ -= page->size_;
+    pages_.Remove(item);
+  }
+}
+
+
+Heap::Heap(uint32_t page_size) : page_pool_(page_size),
+                                 new_space_(this, page_size),
                                  old_space_(this, page_size),
+                                 large_space_(this),
                                  last_stack_(NULL),
                                  last_frame_(NULL),
                                  pending_exception_(NULL),
                                  needs_gc_(kGCNone),
+                                 marking_(0),
+                                 promotion_age_(kDefaultPromotionAge),
                                  gc_(this),
                                  code_space_(NULL) {
   current_ = this;
+  memset(root_shapes_, 0, sizeof(root_shapes_));
   factory_ = HValue::Cast(HObject::NewEmpty(this, kMinFactorySize));
   Reference(Heap::kRefPersistent, &factory_, factory_);
 }
@@ -141,6 +554,7 @@ char* Heap::ToFactory(char* key) {
                                         1);
   if (*slot == HNil::New()) {
     *slot = key;
+    RecordSlot(HObject::Map(reinterpret_cast<char*>(factory_)), slot);
   } else {
     key = *slot;
   }
@@ -150,7 +564,8 @@ char* Heap::ToFactory(char* key) {
 
 
 char* Heap::CreateString(const char* key, uint32_t size) {
-  return ToFactory(HString::New(this, Heap::kTenureOld, key, size));
+  return string_table()->Intern(this,
+                                HString::New(this, Heap::kTenureOld, key, size));
 }
 
 
@@ -181,7 +596,18 @@ const char* Heap::ErrorToString(Error err) {
 
 
 char* Heap::AllocateTagged(HeapTag tag, TenureType tenure, uint32_t bytes) {
-  char* result = space(tenure)->Allocate(bytes + 8);
+  bytes += HValue::kPointerSize;
+
+  char* result;
+  bool carded = tag == kTagMap && bytes >= kCardedMapSize;
+  bool large = carded || bytes >= kLargeObjectSize;
+  if (large) {
+    result = large_space()->Allocate(bytes);
+    tenure = kTenureOld;
+  } else {
+    result = space(tenure)->Allocate(bytes);
+  }
+
   intptr_t qtag = tag;
   if (tenure == kTenureOld) {
     int bit_offset = (HValue::kGenerationOffset -
@@ -190,10 +616,261 @@ char* Heap::AllocateTagged(HeapTag tag, TenureType tenure, uint32_t bytes) {
   }
   *reinterpret_cast<intptr_t*>(result + HValue::kTagOffset) = qtag;
 
+  // Tenured objects allocated during marking are live
+  if (tenure == kTenureOld && is_marking()) HValue::Cast(result)->SetMarked();
+
+  // Large objects are filled with young values without write barrier
+  if (carded) {
+    uint32_t count = (bytes + kCardSize - 1) / kCardSize;
+    Space::Page* page = Space::Page::FromAddress(page_pool(), result);
+    page->cards_ = new uint8_t[count];
+    memset(page->cards_, 1, count);
+  } else if (large) {
+    Remember(HValue::Cast(result));
+  }
+
   return result;
 }
 
 
+AllocationSite* Heap::CreateAllocationSite(HeapTag tag, uint32_t size) {
+  AllocationSite* site = new AllocationSite(tag, size);
+  allocation_sites()->Push(site);
+
+  return site;
+}
+
+
+Shape* Heap::RootShape(uint32_t size) {
+  // Map sizes are powers of two
+  uint32_t index = 0;
+  while ((1U << index) < size) index++;
+  assert((1U << index) == size);
+
+  if (root_shapes_[index] == NULL) {
+    root_shapes_[index] = new Shape(NULL, size, NULL, 0);
+    shapes()->Push(root_shapes_[index]);
+  }
+
+  return root_shapes_[index];
+}
+
+
+Shape* Heap::CreateShape(Shape* parent, char* key) {
+  if (shapes()->length() >= kMaxShapes) {
+    // Compact heap at the next GC check, once per marking cycle
+    if (!gc()->shapes_recycled()) needs_gc(kGCOldSpace);
+    return NULL;
+  }
+
+  Shape* shape = new Shape(parent,
+                           parent->size(),
+                           HString::Value(this, key),
+                           HString::Length(key));
+  shapes()->Push(shape);
+
+  return shape;
+}
+
+
+void StubCache::Clear() {
+  memset(table_, 0, sizeof(table_));
+}
+
+
+void StubCache::Put(Shape* shape, char* key, intptr_t offset) {
+  Entry* entry = reinterpret_cast<Entry*>(table() + Index(shape, key));
+  entry->shape = shape;
+  entry->key = key;
+  entry->offset = offset;
+}
+
+
+char* const StringTable::kDeleted = reinterpret_cast<char*>(Heap::kTagNil);
+
+
+StringTable::StringTable() : table_(NULL), size_(0), count_(0), deleted_(0) {
+  Rehash(kMinSize);
+}
+
+
+StringTable::~StringTable() {
+  delete[] table_;
+}
+
+
+char* StringTable::Intern(Heap* heap, char* str) {
+  if (HString::IsInterned(str)) return str;
+
+  uint32_t hash = HString::Hash(heap, str);
+  uint32_t length = HString::Length(str);
+  char* value = HString::Value(heap, str);
+
+  uint32_t mask = size_ - 1;
+  uint32_t index = hash & mask;
+  uint32_t insert_index = size_;
+  while (table_[index] != NULL) {
+    char* entry = table_[index];
+    if (entry == kDeleted) {
+      if (insert_index == size_) insert_index = index;
+    } else if (HString::Hash(heap, entry) == hash &&
+               HString::Length(entry) == length &&
+               memcmp(HString::Value(heap, entry), value, length) == 0) {
+      // String could be unreachable for marker, but it's alive again
+      heap->MarkingBarrier(entry);
+      return entry;
+    }
+    index = (index + 1) & mask;
+  }
+  // Weak callbacks are invoked in the middle of GC, new strings could be
+  // allocated in the space that is going to be released
+  if (heap->gc()->gc_type() != GC::kNone) return str;
+
+  if (insert_index == size_) {
+    insert_index = index;
+  } else {
+    deleted_--;
+  }
+
+  // Flattened cons string keeps its value in the left slot (unless it's a
+  // builder with a bigger buffer)
+  while (HValue::GetRepresentation<HString::Representation>(str) ==
+             HString::kCons &&
+         HString::Length(HString::LeftCons(str)) == length) {
+    str = HString::LeftCons(str);
+  }
+
+  HString::SetInterned(str);
+  table_[insert_index] = str;
+  count_++;
+
+  // Keep at least a quarter of slots free
+  if ((count_ + deleted_) << 2 > size_ * 3) {
+    Rehash(count_ << 2 > size_ ? size_ << 1 : size_);
+  }
+
+  return str;
+}
+
+
+void StringTable::Remove(uint32_t index) {
+  assert(IsEntry(table_[index]));
+
+  // Maps of dead objects passed to weak callbacks may still reference the
+  // string, let them compare it by contents
+  HString::ResetInterned(table_[index]);
+  table_[index] = kDeleted;
+  count_--;
+  deleted_++;
+}
+
+
+void StringTable::Rehash(uint32_t size) {
+  char** old_table = table_;
+  uint32_t old_size = size_;
+
+  table_ = new char*[size];
+  memset(table_, 0, size * sizeof(*table_));
+  size_ = size;
+  deleted_ = 0;
+
+  uint32_t mask = size_ - 1;
+  for (uint32_t i = 0; i < old_size; i++) {
+    char* entry = old_table[i];
+    if (!IsEntry(entry)) continue;
+
+    // Hashes of interned strings are always computed
+    uint32_t index = HString::Hash(NULL, entry) & mask;
+    while (table_[index] != NULL) index = (index + 1) & mask;
+    table_[index] = entry;
+  }
+
+  delete[] old_table;
+}
+
+
+Shape::Shape(Shape* parent, uint32_t size, const char* key, uint32_t length)
+    : parent_(parent),
+      size_(size),
+      depth_(parent == NULL ? 0 : parent->depth() + 1),
+      key_(NULL),
+      length_(length),
+      marked_(false) {
+  if (key != NULL) {
+    key_ = new char[length];
+    memcpy(key_, key, length);
+  }
+}
+
+
+Shape::~Shape() {
+  delete[] key_;
+}
+
+
+void Shape::RemoveTransition(Shape* child) {
+  ShapeTransitionList::Item* item = transitions_.head();
+  for (; item != NULL; item = item->next()) {
+    if (item->value() != child) continue;
+
+    transitions_.Remove(item);
+    return;
+  }
+}
+
+
+Shape* Shape::Transition(Heap* heap, char* key) {
+  if (HValue::IsUnboxed(key) ||
+      key == HNil::New() ||
+      HValue::GetTag(key) != Heap::kTagString) {
+    return NULL;
+  }
+
+  uint32_t length = HString::Length(key);
+  const char* value = HString::Value(heap, key);
+
+  ShapeTransitionList::Item* item = transitions_.head();
+  for (; item != NULL; item = item->next()) {
+    Shape* child = item->value();
+    if (child->length() == length &&
+        memcmp(child->key(), value, length) == 0) {
+      return child;
+    }
+  }
+
+  if (depth_ >= kMaxDepth || transitions_.length() >= kMaxTransitions) {
+    return NULL;
+  }
+
+  Shape* child = heap->CreateShape(this, key);
+  if (child != NULL) transitions_.Push(child);
+
+  return child;
+}
+
+
+void AllocationSite::Digest() {
+  if (tenure() == Heap::kTenureOld) {
+    // Pretenured objects aren't followed by mementos, so survival can't be
+    // watched - sample new space again once in a while
+    if (allocated_ >= kRetryAllocations) {
+      tenure_ = Heap::kTenureNew;
+      allocated_ = 0;
+      survived_ = 0;
+    }
+    return;
+  }
+
+  if (allocated_ < kMinAllocations) return;
+
+  if (survived_ * 100 >= allocated_ * kTenurePercent) {
+    tenure_ = Heap::kTenureOld;
+  }
+  allocated_ = 0;
+  survived_ = 0;
+}
+
+
 HValueReference* Heap::Reference(ReferenceType type,
                                  HValue** reference,
                                  HValue* value) {
@@ -220,7 +897,15 @@ void Heap::RemoveWeak(HValue* value) {
 }
 
 
-HValue* HValue::CopyTo(Space* old_space, Space* new_space) {
+void Heap::Remember(HValue* host) {
+  assert(!host->IsRemembered());
+
+  host->SetRemembered();
+  remembered_set()->Push(host);
+}
+
+
+uint32_t HValue::Size() {
   assert(!IsUnboxed(addr()));
 
   uint32_t size = kPointerSize;
@@ -248,7 +933,11 @@ HValue* HValue::CopyTo(Space* old_space, Space* new_space) {
           size += As<HString>()->length();
           break;
         case HString::kCons:
-          // + lhs + rhs + scratch_slot (for traversing)
+          // + lhs + rhs + depth
+          size += 3 * kPointerSize;
+          break;
+        case HString::kSliced:
+          // + parent + offset
           size += 2 * kPointerSize;
           break;
         default:
@@ -257,11 +946,11 @@ HValue* HValue::CopyTo(Space* old_space, Space* new_space) {
       }
       break;
     case Heap::kTagObject:
-      // mask + map + proto
+      // mask + map + shape
       size += 3 * kPointerSize;
       break;
     case Heap::kTagArray:
-      // mask + map + proto + length
+      // mask + map + shape + length
       size += 4 * kPointerSize;
       break;
     case Heap::kTagMap:
@@ -272,19 +961,40 @@ HValue* HValue::CopyTo(Space* old_space, Space* new_space) {
       // size + data
       size += kPointerSize + As<HCData>()->size();
       break;
+    case Heap::kTagFree:
+      // size + dead bytes
+      size = As<HFreeBlock>()->size();
+      break;
+    case Heap::kTagMemento:
+      // site
+      size += kPointerSize;
+      break;
     default:
       UNEXPECTED
   }
 
+  return size;
+}
+
+
+HValue* HValue::CopyTo(Space* old_space, Space* new_space) {
+  bool unslice = tag() == Heap::kTagString && HString::IsSmallSlice(addr());
+  uint32_t size = unslice ? HString::SliceCopySize(addr()) : Size();
+
   IncrementGeneration();
   char* result;
-  if (Generation() >= Heap::kMinOldSpaceGeneration) {
+  if (Generation() >= old_space->heap()->promotion_age()) {
+    Tenure();
     result = old_space->Allocate(size);
   } else {
     result = new_space->Allocate(size);
   }
 
-  memcpy(result + interior_offset(0), addr() + interior_offset(0), size);
+  if (unslice) {
+    HString::CopySlice(addr(), result);
+  } else {
+    memcpy(result + interior_offset(0), addr() + interior_offset(0), size);
+  }
 
   return HValue::Cast(result);
 }
@@ -306,6 +1016,7 @@ char* HContext::New(Heap* heap,
   char** slot = reinterpret_cast<char**>(result + GetIndexDisp(0));
   while (values->length() != 0) {
     *slot = values->Shift();
+    heap->RecordWrite(result, *slot);
     slot++;
   }
 
@@ -336,9 +1047,10 @@ char* HBoolean::New(Heap* heap, Heap::TenureType tenure, bool value) {
 char* HString::New(Heap* heap,
                    Heap::TenureType tenure,
                    uint32_t length) {
+  // hash + length + bytes
   char* result = heap->AllocateTagged(Heap::kTagString,
                                       tenure,
-                                      length + 3 * kPointerSize);
+                                      length + 2 * kPointerSize);
 
   // Zero hash
   *reinterpret_cast<intptr_t*>(result + kHashOffset) = 0;
@@ -367,57 +1079,188 @@ char* HString::NewCons(Heap* heap,
                        uint32_t length,
                        char* left,
                        char* right) {
-  char* result = New(heap, tenure, 2 * kPointerSize);
+  char* result = New(heap, tenure, 3 * kPointerSize);
 
   // Set representation
   SetRepresentation<Representation>(result, kCons);
 
   // Set length
-  *reinterpret_cast<uint32_t*>(result + kLengthOffset) = length;
+  *reinterpret_cast<intptr_t*>(result + kLengthOffset) = length;
 
   // Set lhs and rhs
   *LeftConsSlot(result) = left;
   *RightConsSlot(result) = right;
 
+  // Set depth (flattened cons has none)
+  intptr_t depth = 0;
+  if (right != HNil::New()) {
+    depth = 1 + (Depth(left) > Depth(right) ? Depth(left) : Depth(right));
+  }
+  *reinterpret_cast<intptr_t*>(result + kDepthOffset) = depth;
+  if (IsForked(left)) SetForked(result);
+
+  return result;
+}
+
+
+char* HString::NewSlice(Heap* heap,
+                        char* parent,
+                        uint32_t offset,
+                        uint32_t length) {
+  assert(offset + length <= Length(parent));
+
+  // Short strings are cheaper to copy
+  if (length < kMinSliceLength) {
+    return New(heap, Heap::kTenureNew, Value(heap, parent) + offset, length);
+  }
+
+  // Slices always point to the flat string
+  switch (GetRepresentation<Representation>(parent)) {
+    case kNormal:
+      break;
+    case kCons:
+      Value(heap, parent);
+      parent = LeftCons(parent);
+      break;
+    case kSliced:
+      offset += Offset(parent);
+      parent = Parent(parent);
+      break;
+    default:
+      UNEXPECTED
+  }
+
+  char* result = New(heap, Heap::kTenureNew, 2 * kPointerSize);
+
+  // Set representation
+  SetRepresentation<Representation>(result, kSliced);
+
+  // Set length
+  *reinterpret_cast<intptr_t*>(result + kLengthOffset) = length;
+
+  // Set parent and offset
+  *ParentSlot(result) = parent;
+  *reinterpret_cast<intptr_t*>(result + kOffsetOffset) = offset;
+
   return result;
 }
 
 
+void HString::CopySlice(char* addr, char* result) {
+  uint32_t length = Length(addr);
+
+  // Copy header (with hash and length), parent's bytes are still in place
+  // even if it was moved already
+  memcpy(result + interior_offset(0),
+         addr + interior_offset(0),
+         kValueOffset - interior_offset(0));
+  memcpy(result + kValueOffset,
+         Parent(addr) + kValueOffset + Offset(addr),
+         length);
+  SetRepresentation<Representation>(result, kNormal);
+}
+
+
+char* HString::Append(Heap* heap, char* lhs, char* rhs) {
+  uint32_t lhs_length = Length(lhs);
+  uint32_t rhs_length = Length(rhs);
+  uint32_t length = lhs_length + rhs_length;
+
+  // Append in-place if `lhs` was the last one appended to the buffer.
+  // NOTE: Buffer is never filled up, so it's never unwrapped from a cons
+  // and exposed as a value (see StringTable::Intern)
+  if (IsFlatCons(lhs)) {
+    char* buffer = LeftCons(lhs);
+    if (length < Length(buffer)) {
+      // Buffer is used by other string, don't copy it
+      if (BuilderLength(buffer) != lhs_length) {
+        char* result = NewCons(heap, Heap::kTenureNew, length, lhs, rhs);
+        SetForked(result);
+        return result;
+      }
+
+      FlattenCons(rhs, buffer + kValueOffset + lhs_length);
+      SetBuilderLength(buffer, length);
+
+      return NewCons(heap, Heap::kTenureNew, length, buffer, HNil::New());
+    }
+  }
+
+  // Allocate buffer with a room for the next appends
+  uint32_t size = length < 0x40000000 ? length << 1 : length;
+  char* buffer = New(heap, Heap::kTenureNew, size);
+  FlattenCons(rhs, FlattenCons(lhs, buffer + kValueOffset));
+  SetBuilderLength(buffer, length);
+
+  return NewCons(heap, Heap::kTenureNew, length, buffer, HNil::New());
+}
+
+
 char* HString::FlattenCons(char* addr, char* buffer) {
-  while (addr != NULL) {
+  char* end = buffer + Length(addr);
+
+  // Bigger subtrees are put on stack with their position in buffer
+  char* stack[kFlattenStackSize];
+  char* stack_buffer[kFlattenStackSize];
+  int top = 0;
+
+  while (true) {
     switch (GetRepresentation<Representation>(addr)) {
       case kNormal:
-        {
-          uint32_t len = HString::Length(addr);
-          memcpy(buffer, addr + kValueOffset, len);
-          return buffer + len;
-        }
+        memcpy(buffer, addr + kValueOffset, Length(addr));
+        break;
+      case kSliced:
+        memcpy(buffer,
+               Parent(addr) + kValueOffset + Offset(addr),
+               Length(addr));
+        break;
       case kCons:
         {
           char* left = LeftCons(addr);
           char* right = RightCons(addr);
 
+          // Flattened cons (or builder) keeps its value in left string
           if (right == HNil::New()) {
+            memcpy(buffer, left + kValueOffset, Length(addr));
+            break;
+          }
+
+          // Empty child has nothing to copy, don't put it on stack
+          uint32_t left_length = Length(left);
+          uint32_t right_length = Length(right);
+          if (left_length == 0) {
+            addr = right;
+            continue;
+          } else if (right_length == 0) {
             addr = left;
+            continue;
+          }
+
+          // Stack can't overflow, see kFlattenStackSize
+          assert(top < kFlattenStackSize);
+          if (left_length > right_length) {
+            stack[top] = left;
+            stack_buffer[top++] = buffer;
+            addr = right;
+            buffer += left_length;
           } else {
-            // Iterate through bigger string, recurse through smaller
-            if (HString::Length(left) > HString::Length(right)) {
-              FlattenCons(right, buffer + HString::Length(left));
-              addr = left;
-            } else {
-              buffer = FlattenCons(left, buffer);
-              addr = right;
-            }
+            stack[top] = right;
+            stack_buffer[top++] = buffer + left_length;
+            addr = left;
           }
         }
-        break;
+        continue;
       default:
         UNEXPECTED
-        return buffer;
+        return end;
     }
+
+    if (top == 0) break;
+    addr = stack[--top];
+    buffer = stack_buffer[top];
   }
 
-  return buffer;
+  return end;
 }
 
 
@@ -425,6 +1268,8 @@ char* HString::Value(Heap* heap, char* addr) {
   switch (GetRepresentation<Representation>(addr)) {
     case kNormal:
       return addr + kValueOffset;
+    case kSliced:
+      return Parent(addr) + kValueOffset + Offset(addr);
     case kCons:
       if (RightCons(addr) == HNil::New()) {
         // Return cached left if right is null
@@ -439,8 +1284,12 @@ char* HString::Value(Heap* heap, char* addr) {
         // Traverse cons tree and put strings in
         HString::FlattenCons(addr, value);
 
+        heap->MarkingBarrier(*LeftConsSlot(addr));
+        heap->MarkingBarrier(*RightConsSlot(addr));
         *RightConsSlot(addr) = HNil::New();
         *LeftConsSlot(addr) = result;
+        *reinterpret_cast<intptr_t*>(addr + kDepthOffset) = 0;
+        heap->RecordWrite(addr, result);
 
         return value;
       }
@@ -472,14 +1321,26 @@ char* HObject::NewEmpty(Heap* heap, uint32_t size) {
 }
 
 
-void HObject::Init(Heap* heap, char* obj, uint32_t size) {
-  // Set mask
-  *reinterpret_cast<intptr_t*>(obj + kMaskOffset) = (size - 1) * kPointerSize;
+void HObject::Init(Heap* heap,
+                   char* obj,
+                   uint32_t size,
+                   Heap::TenureType tenure) {
+  // Set mask, arrays are dense from the start
+  if (HValue::GetTag(obj) == Heap::kTagArray) {
+    *reinterpret_cast<intptr_t*>(obj + kMaskOffset) = HArray::DenseMask(size);
+  } else {
+    *reinterpret_cast<intptr_t*>(obj + kMaskOffset) =
+        (size - 1) * kPointerSize;
+  }
   // Set map
-  char* map = HMap::NewEmpty(heap, size);
+  char* map = HMap::NewEmpty(heap, size, tenure);
   *reinterpret_cast<char**>(obj + kMapOffset) = map;
-  // Set proto
-  *reinterpret_cast<char**>(obj + kProtoOffset) = map;
+  // Set shape, arrays are always in dictionary mode
+  if (HValue::GetTag(obj) == Heap::kTagObject) {
+    SetShape(obj, heap->RootShape(size));
+  } else {
+    SetShape(obj, NULL);
+  }
 }
 
 
@@ -506,7 +1367,17 @@ char* HArray::NewEmpty(Heap* heap) {
 int64_t HArray::Length(char* obj, bool shrink) {
   int64_t result = *reinterpret_cast<intptr_t*>(obj + kLengthOffset);
 
-  if (shrink) {
+  if (shrink && IsDouble(obj)) {
+    // Double elements can't be looked up without boxing, check holes directly
+    double* elements = DoubleElements(obj);
+    int64_t shrinked = result;
+    while (shrinked > 0 && IsDoubleHole(&elements[shrinked - 1])) shrinked--;
+
+    if (result != shrinked) {
+      result = shrinked;
+      SetLength(obj, result);
+    }
+  } else if (shrink) {
     // Lookup property at [length - 1]
     // Shrink if it's nil
     //
@@ -533,9 +1404,9 @@ int64_t HArray::Length(char* obj, bool shrink) {
 }
 
 
-char* HMap::NewEmpty(Heap* heap, uint32_t size) {
+char* HMap::NewEmpty(Heap* heap, uint32_t size, Heap::TenureType tenure) {
   char* map = heap->AllocateTagged(Heap::kTagMap,
-                                   Heap::kTenureNew,
+                                   tenure,
                                    ((size << 1) + 1) * kPointerSize);
 
   // Set map's size
@@ -591,5 +1462,22 @@ char* HCData::New(Heap* heap, size_t size) {
   return d;
 }
 
+
+char* HFreeBlock::New(char* addr, uint32_t size) {
+  assert(size >= kMinSize);
+
+  // Fillers are left by old space sweeper and free list, and by scavenger's
+  // LABs in new space. Old generation keeps scavenger from copying them,
+  // space walkers step over them using their size and skip them by tag
+  intptr_t qtag = Heap::kTagFree;
+  int bit_offset = (kGenerationOffset - interior_offset(0)) << 3;
+  qtag = qtag | (Heap::kMinOldSpaceGeneration << bit_offset);
+  *reinterpret_cast<intptr_t*>(addr + kTagOffset) = qtag;
+
+  *reinterpret_cast<uint32_t*>(addr + kSizeOffset) = size;
+
+  return addr;
+}
+
 }  // namespace internal
 }  // namespace candor
@@ -35,6 +35,7 @@
 #include <stdint.h>  // uint32_t
 #include <unistd.h>  // intptr_t
 #include <sys/types.h>  // size_t
+#include <pthread.h>  // pthread_mutex_t
 
 #include "zone.h"  // ZoneObject
 #include "gc.h"  // GC
@@ -49,28 +50,104 @@ class Heap;
 class HValueReference;
 class HValueWeakRef;
 class CodeSpace;
+class AllocationSite;
+class Shape;
+
+// Source of memory for heap pages: page-size aligned mmap chunks, released
+// pages are kept for reuse and given back to OS after being idle for a while
+class PagePool {
+ public:
+  explicit PagePool(uint32_t page_size);
+  ~PagePool();
+
+  // Returns `page_size()`-aligned chunk of at least `size` bytes
+  char* Get(uint32_t size);
+  void Release(char* data, uint32_t size);
+
+  // madvise(MADV_DONTNEED) pages that were idle for `uncommit_delay()` ms
+  void Uncommit();
+
+  inline uint32_t page_size() { return page_size_; }
+
+  // Use transparent huge pages for heap (if supported by OS)
+  inline bool huge_pages() { return huge_pages_; }
+  inline void huge_pages(bool value) { huge_pages_ = value; }
+
+  inline uint32_t uncommit_delay() { return uncommit_delay_; }
+  inline void uncommit_delay(uint32_t value) { uncommit_delay_ = value; }
+
+  static const uint32_t kDefaultUncommitDelay = 5000;
+
+ protected:
+  class Entry {
+   public:
+    Entry(char* data, uint64_t released) : data_(data),
+                                           released_(released),
+                                           committed_(true) {
+    }
+
+    char* data_;
+    uint64_t released_;
+    bool committed_;
+  };
+
+  typedef GenericList<Entry*, EmptyClass, DeletePolicy<Entry*> > EntryList;
+
+  char* Map(uint32_t size);
+  void Unmap(char* data, uint32_t size);
+
+  uint32_t page_size_;
+  bool huge_pages_;
+  uint32_t uncommit_delay_;
+
+  // Released pages of `page_size()` bytes, most recent are at the tail
+  EntryList free_;
+  pthread_mutex_t mutex_;
+};
 
 class Space {
  public:
   class Page {
    public:
-    explicit Page(uint32_t size) : size_(size) {
-      data_ = new char[size];
-      // Make all offsets odd (pointers are tagged with 1 at last bit)
-      top_ = data_ + 1;
-      limit_ = data_ + size;
-    }
-    ~Page() {
-      delete[] data_;
+    Page(PagePool* pool, uint32_t size);
+    ~Page();
+
+    // Page is stored at the start of its data, so it can be found by any
+    // address in it (only first `page_size()` bytes of larger pages)
+    static inline Page* FromAddress(PagePool* pool, char* addr) {
+      intptr_t mask = ~static_cast<intptr_t>(pool->page_size() - 1);
+      return *reinterpret_cast<Page**>(reinterpret_cast<intptr_t>(addr) &
+                                       mask);
     }
 
+    // Address of the first object
+    inline char* first() { return data_ + kHeaderSize + 1; }
+
+    static const uint32_t kHeaderSize = sizeof(void*);
+
+    PagePool* pool_;
+
     char* data_;
     char* top_;
     char* limit_;
     uint32_t size_;
+
+    // Bytes of marked objects (computed by sweeper)
+    uint32_t live_;
+
+    // Next object to be visited by scavenger
+    char* scan_;
+
+    // Page can't be allocated in until sweeper is done with it
+    volatile bool swept_;
+
+    // Dirty flags of `Heap::kCardSize` chunks of a large map, NULL for
+    // other pages
+    uint8_t* cards_;
   };
 
   Space(Heap* heap, uint32_t page_size);
+  ~Space();
 
   // Adds empty page of specific size
   void AddPage(uint32_t size);
@@ -85,6 +162,39 @@ class Space {
   // Remove all pages
   void Clear();
 
+  // Remove one page (it should not contain live objects)
+  void RemovePage(List<Page*, EmptyClass>::Item* item);
+
+  // Stop allocating in page, it'll be released after compaction
+  void EvacuatePage(List<Page*, EmptyClass>::Item* item);
+  void ReleaseEvacuatedPages();
+
+  // Free list of old space is filled by sweeper
+  void ClearFreeList();
+
+  // Take `bytes` from the first fitting free block (or return NULL)
+  char* AllocateFromFreeList(uint32_t bytes);
+
+  // Sweeping (old space only): current page is swept right away,
+  // others are left to the background sweeper and to allocator
+  void StartSweeping();
+  void FinishSweeping();
+
+  // Sweep one of remaining pages, returns false if there're none
+  bool SweepNextPage();
+  void SweepPage(Page* page);
+
+  inline bool is_sweeping() { return sweeping_; }
+
+  // Bytes of dead objects found by sweeper
+  inline uint32_t free_bytes() { return free_bytes_; }
+
+  inline List<Page*, EmptyClass>* pages() { return &pages_; }
+  inline List<Page*, EmptyClass>* evacuated_pages() {
+    return &evacuated_pages_;
+  }
+  inline HValueList* free_list() { return &free_list_; }
+
   inline Heap* heap() { return heap_; }
 
   // Both top and limit are always pointing to current page's
@@ -97,12 +207,25 @@ class Space {
 
   inline uint32_t page_size() { return page_size_; }
 
+  // Smaller blocks are left as fillers until the next sweep
+  static const uint32_t kMinFreeListBlock = 128;
+
   inline uint32_t size() { return size_; }
-  inline uint32_t size_limit() { return size_limit_; }
-  inline void compute_size_limit() {
-    size_limit_ = size_ << 1;
+
+  // Bytes between start of pages and their tops
+  uint32_t used();
+
+  // Bytes allocated since space's creation, including inline allocations
+  // done by generated code (they're accounted once page is switched)
+  inline uint64_t allocated() {
+    return allocated_ + (*top_ - allocation_start_);
   }
 
+  // Space asks for GC when it grows over this limit
+  // (new space only, see GC::IsOldSpaceFull())
+  inline uint32_t size_limit() { return size_limit_; }
+  inline void size_limit(uint32_t value) { size_limit_ = value; }
+
  protected:
   Heap* heap_;
 
@@ -116,14 +239,130 @@ class Space {
   List<Page*, EmptyClass> pages_;
   uint32_t page_size_;
 
+  List<Page*, EmptyClass> evacuated_pages_;
+  HValueList free_list_;
+
   uint32_t size_;
   uint32_t size_limit_;
+
+  // Allocation on previously selected pages, and current page's top at
+  // the moment it was selected
+  uint64_t allocated_;
+  char* allocation_start_;
+
+  // Guards page list and free list while sweeper is running
+  inline void Lock() { if (sweeping_) pthread_mutex_lock(&sweep_mutex_); }
+  inline void Unlock() { if (sweeping_) pthread_mutex_unlock(&sweep_mutex_); }
+
+  bool sweeping_;
+  GenericList<Page*, EmptyClass, NopPolicy> unswept_pages_;
+  uint32_t free_bytes_;
+  pthread_mutex_t sweep_mutex_;
+};
+
+// Objects above `Heap::kLargeObjectSize` are placed on pages of their own,
+// they're tenured from the start, never moved and freed by old space GC
+class LargeSpace {
+ public:
+  explicit LargeSpace(Heap* heap);
+
+  char* Allocate(uint32_t bytes);
+
+  // Release pages of unmarked objects, reset marks of live ones
+  void Sweep();
+
+  inline List<Space::Page*, EmptyClass>* pages() { return &pages_; }
+  inline Heap* heap() { return heap_; }
+
+  inline uint32_t size() { return size_; }
+  inline uint64_t allocated() { return allocated_; }
+
+ protected:
+  Heap* heap_;
+  List<Space::Page*, EmptyClass> pages_;
+
+  uint32_t size_;
+  uint64_t allocated_;
 };
 
 typedef HashMap<NumberKey, HValueReference, EmptyClass> HValueRefMap;
 typedef List<HValueReference, EmptyClass> HValueRefList;
+typedef List<AllocationSite*, EmptyClass> AllocationSiteList;
+typedef List<Shape*, EmptyClass> ShapeList;
+typedef GenericList<Shape*, EmptyClass, NopPolicy> ShapeTransitionList;
 typedef HashMap<NumberKey, HValueWeakRef, EmptyClass> HValueWeakRefMap;
 
+// Cache of property lookups shared by all megamorphic call sites:
+// (shape, key) -> offset of value in map. Keys are heap pointers, so it is
+// cleared by every GC that could move or free them.
+class StubCache {
+ public:
+  struct Entry {
+    Shape* shape;
+    char* key;
+    intptr_t offset;
+    intptr_t padding;
+  };
+
+  StubCache() { Clear(); }
+
+  void Clear();
+  void Put(Shape* shape, char* key, intptr_t offset);
+
+  // Byte offset of the entry in the table. Shapes and keys are aligned, so
+  // low bits are dropped by mask
+  static inline intptr_t Index(Shape* shape, char* key) {
+    return (reinterpret_cast<intptr_t>(shape) ^
+            reinterpret_cast<intptr_t>(key)) & kIndexMask;
+  }
+
+  inline char* table() { return reinterpret_cast<char*>(table_); }
+
+  static const int kSize = 1024;
+  static const intptr_t kIndexMask = (kSize - 1) * sizeof(Entry);
+  static const int kShapeOffset = 0;
+  static const int kKeyOffset = sizeof(Shape*);
+  static const int kOffsetOffset = sizeof(Shape*) + sizeof(char*);
+
+ private:
+  Entry table_[kSize];
+};
+
+// Weak table of internalised strings. String keys are put into objects'
+// maps only after passing through it, so property lookup compares them by
+// address. Strings are not kept alive by the table - GC removes dead ones.
+class StringTable {
+ public:
+  StringTable();
+  ~StringTable();
+
+  // Returns string with the same contents from the table, putting `str`
+  // (or its flat version) there if there's none
+  char* Intern(Heap* heap, char* str);
+
+  // Used by GC to relocate entries or remove dead ones
+  void Remove(uint32_t index);
+
+  inline char** table() { return table_; }
+  inline uint32_t size() { return size_; }
+  inline uint32_t count() { return count_; }
+
+  static inline bool IsEntry(char* entry) {
+    return entry != NULL && entry != kDeleted;
+  }
+
+  static const uint32_t kMinSize = 1024;
+  static char* const kDeleted;
+
+ private:
+  void Rehash(uint32_t size);
+
+  char** table_;
+  uint32_t size_;
+  uint32_t count_;
+  uint32_t deleted_;
+};
+
 class Heap {
  public:
   enum HeapTag {
@@ -139,7 +378,13 @@ class Heap {
     kTagFunction,
     kTagCData,
 
-    kTagMap
+    kTagMap,
+
+    // Dead space in swept pages
+    kTagFree,
+
+    // Allocation site's record, follows young objects allocated by site
+    kTagMemento
   };
 
   enum TenureType {
@@ -183,10 +428,18 @@ class Heap {
 
   // Tenure configuration (GC)
   static const int8_t kMinOldSpaceGeneration = 5;
+  static const int8_t kDefaultPromotionAge = 2;
+
+  // Objects of this size (including tag) go to large object space
+  static const uint32_t kLargeObjectSize = 128 * 1024;
+
+  // Maps of this size (including tag) go to large object space too, stores
+  // into them are remembered per card instead of per host
+  static const uint32_t kCardedMapSize = 16 * 1024;
+  static const uint32_t kCardSize = 512;
   static const uint32_t kMinFactorySize = 128;
   static const uint32_t kBindingContextTag = 0x0DEC0DEC;
   static const uint32_t kEnterFrameTag = 0xFEEDBEEE;
-  static const uint32_t kICDisabledValue = 0xABBAABBA;
   static const uint32_t kICZapValue = 0xABBADEEC;
 
   explicit Heap(uint32_t page_size);
@@ -210,8 +463,32 @@ class Heap {
   void AddWeak(HValue* value, WeakCallback callback);
   void RemoveWeak(HValue* value);
 
+  // Write barrier: remember tenured `host` if `value` is in new space
+  inline void RecordWrite(char* host, char* value);
+  void Remember(HValue* host);
+
+  // Same as above, but only dirties the card of `slot` in large maps
+  inline void RecordSlot(char* host, char** slot);
+
+  static inline bool HasCards(HValue* host);
+  static inline uint32_t CardCount(HValue* host);
+  inline uint8_t* Cards(HValue* host);
+
+  // Marking barrier: grey overwritten `value` while marking old space
+  inline void MarkingBarrier(char* value);
+
+  // Number of scavenges young object should survive to be tenured
+  // (1 ... kMinOldSpaceGeneration)
+  inline uint8_t promotion_age() { return promotion_age_; }
+  inline void promotion_age(uint8_t value) {
+    assert(value >= 1 && value <= kMinOldSpaceGeneration);
+    promotion_age_ = value;
+  }
+
+  inline PagePool* page_pool() { return &page_pool_; }
   inline Space* new_space() { return &new_space_; }
   inline Space* old_space() { return &old_space_; }
+  inline LargeSpace* large_space() { return &large_space_; }
 
   inline Space* space(TenureType type) {
     if (type == kTenureOld) {
@@ -230,13 +507,37 @@ class Heap {
   }
   inline GCType needs_gc() { return static_cast<GCType>(needs_gc_); }
   inline void needs_gc(GCType value) { needs_gc_ = value; }
+
+  // Non-zero while old space is being marked incrementally
+  inline intptr_t* marking_addr() { return &marking_; }
+  inline bool is_marking() { return marking_ != 0; }
+  inline void is_marking(bool value) { marking_ = value; }
   inline HValueRefMap* references() { return &references_; }
   inline HValueWeakRefMap* weak_references() { return &weak_references_; }
+  inline HValueList* remembered_set() { return &remembered_set_; }
 
   inline GC* gc() { return &gc_; }
   inline CodeSpace* code_space() { return code_space_; }
   inline void code_space(CodeSpace* code_space) { code_space_ = code_space; }
   inline SourceMap* source_map() { return &source_map_; }
+  inline SafepointMap* safepoint_map() { return &safepoint_map_; }
+
+  // Allocation sites of object and array literals in optimized code
+  AllocationSite* CreateAllocationSite(HeapTag tag, uint32_t size);
+  inline AllocationSiteList* allocation_sites() { return &allocation_sites_; }
+
+  // Shape of empty objects with map of `size` slots
+  Shape* RootShape(uint32_t size);
+
+  // Returns NULL if there are too many shapes already
+  Shape* CreateShape(Shape* parent, char* key);
+  inline ShapeList* shapes() { return &shapes_; }
+  inline StubCache* stub_cache() { return &stub_cache_; }
+  inline StringTable* string_table() { return &string_table_; }
+
+  // Objects that would need more shapes are left in dictionary mode. Full
+  // table requests compaction, which frees shapes of dead objects.
+  static const int32_t kMaxShapes = 64 * 1024;
 
   // Factory methods
   char* CreateString(const char* key, uint32_t size);
@@ -246,8 +547,11 @@ class Heap {
  private:
   char* ToFactory(char* key);
 
+  // NOTE: Should be initialized before spaces
+  PagePool page_pool_;
   Space new_space_;
   Space old_space_;
+  LargeSpace large_space_;
 
   // Support reentering candor after invoking C++ side
   char* last_stack_;
@@ -256,19 +560,132 @@ class Heap {
   char* pending_exception_;
 
   intptr_t needs_gc_;
+  intptr_t marking_;
+  uint8_t promotion_age_;
 
   HValueRefMap references_;
   HValueWeakRefMap weak_references_;
+
+  // Tenured objects that may contain pointers into new space
+  HValueList remembered_set_;
   HValue* factory_;
 
+  AllocationSiteList allocation_sites_;
+
+  ShapeList shapes_;
+  Shape* root_shapes_[32];
+  StubCache stub_cache_;
+  StringTable string_table_;
+
   GC gc_;
   CodeSpace* code_space_;
   SourceMap source_map_;
+  SafepointMap safepoint_map_;
 
   static Heap* current_;
 };
 
 
+// Survival feedback of a single object or array literal.
+// Young objects allocated by site are followed by a memento (tag + site) and
+// have kMementoBit set, scavenger counts survivors through it. Once most of
+// site's objects survive, it allocates them in old space straight away.
+class AllocationSite {
+ public:
+  AllocationSite(Heap::HeapTag tag, uint32_t size) : tenure_(Heap::kTenureNew),
+                                                     allocated_(0),
+                                                     survived_(0),
+                                                     tag_(tag),
+                                                     size_(size) {
+  }
+
+  // Called after every scavenge
+  void Digest();
+
+  inline Heap::TenureType tenure() {
+    return static_cast<Heap::TenureType>(tenure_);
+  }
+
+  inline intptr_t allocated() { return allocated_; }
+  inline intptr_t survived() { return survived_; }
+  inline Heap::HeapTag tag() { return tag_; }
+  inline uint32_t size() { return size_; }
+  inline void Survived() { __sync_fetch_and_add(&survived_, 1); }
+
+  // Allocations needed before deciding
+  static const intptr_t kMinAllocations = 100;
+
+  // Percent of survivors needed to allocate in old space
+  static const intptr_t kTenurePercent = 85;
+
+  // Pretenured allocations before giving new space another try
+  static const intptr_t kRetryAllocations = 20000;
+
+  // Offsets for generated code
+  static const int kTenureOffset = 0;
+  static const int kAllocatedOffset = sizeof(intptr_t);
+
+ private:
+  intptr_t tenure_;
+  intptr_t allocated_;
+  intptr_t survived_;
+
+  // Literal's type and map size
+  Heap::HeapTag tag_;
+  uint32_t size_;
+};
+
+
+// Hidden class of object. Objects with the same shape have maps of the
+// same size with the same keys in the same slots, so property offset looked
+// up once is valid for all of them (that's what PIC caches). Adding a string
+// key moves object to the child shape, growing map replays keys from the root
+// shape of the new size. Objects with deleted properties, non-string keys or
+// too many properties are in dictionary mode and have NULL shape.
+class Shape {
+ public:
+  Shape(Shape* parent, uint32_t size, const char* key, uint32_t length);
+  ~Shape();
+
+  // Child shape with `key` added, NULL - dictionary mode
+  Shape* Transition(Heap* heap, char* key);
+
+  inline Shape* parent() { return parent_; }
+  inline uint32_t size() { return size_; }
+  inline uint32_t depth() { return depth_; }
+  inline const char* key() { return key_; }
+  inline uint32_t length() { return length_; }
+
+  // Marks shape and its ancestors as used by live objects or ICs
+  inline void Mark() {
+    for (Shape* s = this; s != NULL && !s->marked_; s = s->parent_) {
+      s->marked_ = true;
+    }
+  }
+  inline bool is_marked() { return marked_; }
+  inline void is_marked(bool value) { marked_ = value; }
+
+  // Forget freed child
+  void RemoveTransition(Shape* child);
+
+  // Maximum number of properties and children of one shape
+  static const uint32_t kMaxDepth = 64;
+  static const int32_t kMaxTransitions = 32;
+
+ private:
+  Shape* parent_;
+  uint32_t size_;
+  uint32_t depth_;
+
+  // Key added by transition from parent (copy of string's contents)
+  char* key_;
+  uint32_t length_;
+  bool marked_;
+
+  ShapeTransitionList transitions_;
+};
+
+
 #define HINTERIOR_OFFSET(X) X * HValue::kPointerSize - 1
 
 
@@ -293,6 +710,9 @@ class HValue {
 
   HValue* CopyTo(Space* old_space, Space* new_space);
 
+  // Size of object including header
+  uint32_t Size();
+
   inline bool IsGCMarked();
   inline char* GetGCMark();
   inline void SetGCMark(char* new_addr);
@@ -301,7 +721,26 @@ class HValue {
   inline void SetSoftGCMark();
   inline void ResetSoftGCMark();
 
+  inline bool IsRemembered();
+  inline void SetRemembered();
+  inline void ResetRemembered();
+
+  inline bool IsMarked();
+  inline void SetMarked();
+  inline void ResetMarked();
+
+  inline bool IsEvacuationCandidate();
+  inline void SetEvacuationCandidate();
+  inline void ResetEvacuationCandidate();
+
+  // Young object is followed by allocation site's memento
+  inline bool HasMemento();
+  inline AllocationSite* GetMementoSite();
+
+  static inline bool IsYoung(char* addr);
+
   inline void IncrementGeneration();
+  inline void Tenure();
   inline uint8_t Generation();
 
   template <typename Representation>
@@ -327,6 +766,24 @@ class HValue {
   static const int kRepresentationOffset = HINTERIOR_OFFSET(0) + 1;
   static const int kGenerationOffset = HINTERIOR_OFFSET(0) + 2;
 
+  // Bit in GC mark byte, set for tenured objects in remembered set
+  static const int kRememberedBit = 0x20;
+
+  // Bit in GC mark byte, set for objects visited by incremental marking
+  static const int kMarkBit = 0x10;
+
+  // Bit in GC mark byte, set for live objects on pages being compacted
+  static const int kEvacuateBit = 0x08;
+
+  // Bit in GC mark byte, set while parallel scavenger is copying object
+  static const int kGCBusyBit = 0x04;
+
+  // Bit in GC mark byte, set for young objects followed by memento
+  static const int kMementoBit = 0x02;
+
+  // Bit in GC mark byte, set for strings in the string table
+  static const int kInternedBit = 0x01;
+
   static inline int interior_offset(int offset) {
     return HINTERIOR_OFFSET(offset);
   }
@@ -464,7 +921,8 @@ class HString : public HValue {
  public:
   enum Representation {
     kNormal = 0x00,
-    kCons   = 0x01
+    kCons   = 0x01,
+    kSliced = 0x02
   };
 
   static char* New(Heap* heap,
@@ -480,6 +938,16 @@ class HString : public HValue {
                        char* left,
                        char* right);
 
+  // Substring sharing parent's bytes (short ones are copied)
+  static char* NewSlice(Heap* heap,
+                        char* parent,
+                        uint32_t offset,
+                        uint32_t length);
+
+  // Concatenate strings reusing spare room of the flattened `lhs`, the
+  // result shares its buffer (repeated `a = a + x`)
+  static char* Append(Heap* heap, char* lhs, char* rhs);
+
   inline uint32_t length() { return Length(addr()); }
 
   static uint32_t Hash(Heap* heap, char* addr);
@@ -490,6 +958,23 @@ class HString : public HValue {
     return *reinterpret_cast<uint32_t*>(addr + kLengthOffset);
   }
 
+  static inline bool IsInterned(char* addr) {
+    return (*reinterpret_cast<uint8_t*>(addr + kGCMarkOffset) &
+            kInternedBit) != 0;
+  }
+
+  // NOTE: Updated atomically, background sweeper may reset mark bit of the
+  // same byte
+  static inline void SetInterned(char* addr) {
+    __sync_fetch_and_or(reinterpret_cast<uint8_t*>(addr + kGCMarkOffset),
+                        kInternedBit);
+  }
+
+  static inline void ResetInterned(char* addr) {
+    __sync_fetch_and_and(reinterpret_cast<uint8_t*>(addr + kGCMarkOffset),
+                         ~kInternedBit);
+  }
+
   static inline char* LeftCons(char* addr) { return *LeftConsSlot(addr); }
   static inline char* RightCons(char* addr) { return *RightConsSlot(addr); }
 
@@ -501,14 +986,84 @@ class HString : public HValue {
     return reinterpret_cast<char**>(addr + kRightConsOffset);
   }
 
+  static inline char* Parent(char* addr) { return *ParentSlot(addr); }
+  static inline char** ParentSlot(char* addr) {
+    return reinterpret_cast<char**>(addr + kParentOffset);
+  }
+  static inline uint32_t Offset(char* addr) {
+    return *reinterpret_cast<uint32_t*>(addr + kOffsetOffset);
+  }
+
+  // Small slice of a much bigger string is copied out by GC, otherwise it
+  // would keep the whole parent alive
+  static inline bool IsSmallSlice(char* addr) {
+    return GetRepresentation<Representation>(addr) == kSliced &&
+           Length(addr) < Length(Parent(addr)) / kSliceParentRatio;
+  }
+
+  // Write flat copy of the slice at `result`
+  static void CopySlice(char* addr, char* result);
+  static inline uint32_t SliceCopySize(char* addr) {
+    return kValueOffset - interior_offset(0) + Length(addr);
+  }
+
+  // Height of the cons tree, zero for flat strings
+  static inline uint32_t Depth(char* addr) {
+    if (GetRepresentation<Representation>(addr) != kCons) return 0;
+    return *reinterpret_cast<uint32_t*>(addr + kDepthOffset) & ~kForkedBit;
+  }
+
+  // Cons chain that was appended to a string builder used by other string,
+  // collapsing it would copy the buffer again and again
+  static inline bool IsForked(char* addr) {
+    if (GetRepresentation<Representation>(addr) != kCons) return false;
+    return (*reinterpret_cast<uint32_t*>(addr + kDepthOffset) &
+            kForkedBit) != 0;
+  }
+
+  static inline void SetForked(char* addr) {
+    *reinterpret_cast<uint32_t*>(addr + kDepthOffset) |= kForkedBit;
+  }
+
+  static inline bool IsFlatCons(char* addr) {
+    return GetRepresentation<Representation>(addr) == kCons &&
+           RightCons(addr) == HNil::New();
+  }
+
+  // Builder's buffer is never exposed as a value, its hash slot holds the
+  // length of the part used by appends
+  static inline uint32_t BuilderLength(char* buffer) {
+    return *reinterpret_cast<uint32_t*>(buffer + kHashOffset);
+  }
+
+  static inline void SetBuilderLength(char* buffer, uint32_t length) {
+    *reinterpret_cast<uint32_t*>(buffer + kHashOffset) = length;
+  }
+
   static const int kHashOffset = HINTERIOR_OFFSET(1);
   static const int kLengthOffset = HINTERIOR_OFFSET(2);
   static const int kValueOffset = HINTERIOR_OFFSET(3);
 
   static const int kLeftConsOffset = HINTERIOR_OFFSET(3);
   static const int kRightConsOffset = HINTERIOR_OFFSET(4);
+  static const int kDepthOffset = HINTERIOR_OFFSET(5);
+
+  static const int kParentOffset = HINTERIOR_OFFSET(3);
+  static const int kOffsetOffset = HINTERIOR_OFFSET(4);
 
   static const int kMinConsLength = 24;
+  static const uint32_t kMinSliceLength = 16;
+  static const uint32_t kSliceParentRatio = 4;
+
+  // Deeper `a = a + x` chains are collapsed into string builder
+  static const uint32_t kMaxConsDepth = 32;
+  static const uint32_t kForkedBit = 0x80000000;
+
+  // Longer child is pushed and the shorter (non-empty) one is flattened
+  // first, so every pending subtree's parent is at least twice as long as
+  // the next one's and at least 2 chars long: 32 entries are enough for
+  // any uint32_t length
+  static const int kFlattenStackSize = 32;
 
   static const Heap::HeapTag class_tag = Heap::kTagString;
 };
@@ -517,14 +1072,17 @@ class HString : public HValue {
 class HObject : public HValue {
  public:
   static char* NewEmpty(Heap* heap, uint32_t size = 16);
-  static void Init(Heap* heap, char* obj, uint32_t size);
+  static void Init(Heap* heap,
+                   char* obj,
+                   uint32_t size,
+                   Heap::TenureType tenure = Heap::kTenureNew);
 
   inline char* map() { return *map_slot(); }
   inline char** map_slot() { return MapSlot(addr()); }
   inline uint32_t mask() { return *mask_slot(); }
   inline uint32_t* mask_slot() { return MaskSlot(addr()); }
-  inline char* proto() { return *proto_slot(); }
-  inline char** proto_slot() { return ProtoSlot(addr()); }
+  inline Shape* shape() { return *shape_slot(); }
+  inline Shape** shape_slot() { return ShapeSlot(addr()); }
 
   static inline char** MapSlot(char* addr) {
     return reinterpret_cast<char**>(addr + kMapOffset);
@@ -534,16 +1092,20 @@ class HObject : public HValue {
     return reinterpret_cast<uint32_t*>(addr + kMaskOffset);
   }
   static inline uint32_t Mask(char* addr) { return *MaskSlot(addr); }
-  static inline char** ProtoSlot(char* addr) {
-    return reinterpret_cast<char**>(addr + kProtoOffset);
+  static inline Shape** ShapeSlot(char* addr) {
+    return reinterpret_cast<Shape**>(addr + kShapeOffset);
+  }
+  static inline Shape* GetShape(char* addr) { return *ShapeSlot(addr); }
+  static inline void SetShape(char* addr, Shape* shape) {
+    *ShapeSlot(addr) = shape;
   }
-  static inline char* Proto(char* addr) { return *ProtoSlot(addr); }
 
   static char** LookupProperty(Heap* heap, char* addr, char* key, int insert);
 
   static const int kMaskOffset = HINTERIOR_OFFSET(1);
   static const int kMapOffset = HINTERIOR_OFFSET(2);
-  static const int kProtoOffset = HINTERIOR_OFFSET(3);
+  // NOTE: Shape is not a heap value, GC skips it as an even (unboxed) word
+  static const int kShapeOffset = HINTERIOR_OFFSET(3);
 
   static const Heap::HeapTag class_tag = Heap::kTagObject;
 };
@@ -551,15 +1113,46 @@ class HObject : public HValue {
 
 class HArray : public HObject {
  public:
+  // Dense array stores elements in both halves of the map, indexed by key
+  // (nil marks a hole). New arrays are holding only smis, storing any other
+  // value makes them generic. Arrays of numbers are keeping raw doubles in
+  // CData instead of map. Sparse array is a dictionary of keys and values.
+  enum Representation {
+    kDenseSmi    = 0x00,
+    kDense       = 0x01,
+    kDenseDouble = 0x02,
+    kSparse      = 0x03
+  };
+
   static char* NewEmpty(Heap* heap);
 
   static int64_t Length(char* obj, bool shrink);
   static inline void SetLength(char* obj, int64_t length);
 
+  // Dense array with tagged elements
   static inline bool IsDense(char* obj);
+  static inline bool IsDouble(char* obj);
+  static inline uint32_t Capacity(char* obj);
+  static inline uint32_t DenseMask(uint32_t map_size);
+  static inline uint32_t DoubleMask(uint32_t capacity);
+
+  static inline double* DoubleElements(char* obj);
+  static inline bool IsDoubleHole(double* element);
+  static inline void SetDoubleHole(double* element);
 
   static const int kVarArgLength = 16;
-  static const int kDenseLengthMax = 128;
+
+  // Dense array's mask is 32bit
+  static const int kDenseLengthMax = 1 << 26;
+
+  // Storing an element further than that beyond dense array's capacity
+  // switches it to sparse mode
+  static const int kDenseGapMax = 1024;
+
+  // Both halves of the signalling NaN marking a hole in double elements,
+  // arithmetic never produces it
+  static const uint32_t kDoubleHoleHalf = 0xFFF7FFFF;
+
   static const int kLengthOffset = HINTERIOR_OFFSET(4);
 
   static const Heap::HeapTag class_tag = Heap::kTagArray;
@@ -568,7 +1161,9 @@ class HArray : public HObject {
 
 class HMap : public HValue {
  public:
-  static char* NewEmpty(Heap* heap, uint32_t size);
+  static char* NewEmpty(Heap* heap,
+                        uint32_t size,
+                        Heap::TenureType tenure = Heap::kTenureNew);
 
   inline bool IsEmptySlot(uint32_t index);
   inline HValue* GetSlot(uint32_t index);
@@ -650,6 +1245,21 @@ class HCData : public HValue {
   static const Heap::HeapTag class_tag = Heap::kTagCData;
 };
 
+class HFreeBlock : public HValue {
+ public:
+  // Put filler of `size` bytes (including tag) at `addr`
+  static char* New(char* addr, uint32_t size);
+
+  inline uint32_t size() {
+    return *reinterpret_cast<uint32_t*>(addr() + kSizeOffset);
+  }
+
+  static const int kSizeOffset = HINTERIOR_OFFSET(1);
+  static const uint32_t kMinSize = 2 * kPointerSize;
+
+  static const Heap::HeapTag class_tag = Heap::kTagFree;
+};
+
 #undef HINTERIOR_OFFSET
 
 }  // namespace internal
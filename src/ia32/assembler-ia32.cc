@@ -202,6 +202,13 @@ void Assembler::testb(Register dst, const Immediate src) {
 }
 
 
+void Assembler::testb(const Operand& dst, const Immediate src) {
+  emitb(0xF6);
+  emit_modrm(dst, 0);
+  emitb(src.value());
+}
+
+
 void Assembler::testl(Register dst, const Immediate src) {
   assert(dst != esi && dst != edi);
   emitb(0xF7);
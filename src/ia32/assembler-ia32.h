@@ -303,6 +303,7 @@ class Assembler {
   void cmpb(const Operand& dst, const Immediate src);
 
   void testb(Register dst, const Immediate src);
+  void testb(const Operand& dst, const Immediate src);
   void testl(Register dst, const Immediate src);
 
   void mov(Register dst, Register src);
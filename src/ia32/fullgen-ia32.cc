@@ -130,17 +130,19 @@ void FStoreContext::Generate(Masm* masm) {
   // Global can't be replaced
   if (depth == -1) return;
 
-  __ mov(scratch, context_reg);
+  __ mov(ebx, context_reg);
 
   // Lookup context
   while (--depth >= 0) {
-    Operand parent(scratch, HContext::kParentOffset);
-    __ mov(scratch, parent);
+    Operand parent(ebx, HContext::kParentOffset);
+    __ mov(ebx, parent);
   }
 
-  Operand res(scratch, HContext::GetIndexDisp(inputs[0]->index()));
+  Operand res(ebx, HContext::GetIndexDisp(inputs[0]->index()));
+  __ MarkingBarrier(res);
   __ mov(eax, *inputs[1]->ToOperand());
   __ mov(res, eax);
+  __ RecordWrite(ebx, eax, reg_nil);
 }
 
 
@@ -200,7 +202,9 @@ void FStoreProperty::Generate(Masm* masm) {
   __ addl(eax, ebx);
 
   Operand slot(eax, 0);
+  __ MarkingBarrier(slot);
   __ mov(slot, ecx);
+  __ RecordWrite(ebx, ecx, eax);
 
   __ bind(&done);
 }
@@ -240,6 +244,8 @@ void FDeleteProperty::Generate(Masm* masm) {
 
 
 void FAllocateObject::Generate(Masm* masm) {
+  Shape* shape = masm->heap()->RootShape(size_);
+  __ mov(edx, Immediate(reinterpret_cast<intptr_t>(shape)));
   __ pushb(Immediate(HNumber::Tag(Heap::kTagNil)));
   __ pushb(Immediate(HNumber::Tag(Heap::kTagNil)));
   __ push(Immediate(HNumber::Tag(size_)));
@@ -251,6 +257,8 @@ void FAllocateObject::Generate(Masm* masm) {
 
 
 void FAllocateArray::Generate(Masm* masm) {
+  // Arrays are always in dictionary mode
+  __ xorl(edx, edx);
   __ pushb(Immediate(HNumber::Tag(Heap::kTagNil)));
   __ pushb(Immediate(HNumber::Tag(Heap::kTagNil)));
   __ push(Immediate(HNumber::Tag(size_)));
@@ -27,6 +27,7 @@
 #include "lir-instructions.h"
 #include "lir-instructions-inl.h"
 #include "macroassembler.h"
+#include "pic.h"
 #include "stubs.h"  // Stubs
 
 namespace candor {
@@ -59,7 +60,7 @@ void LEntry::Generate(Masm* masm) {
   __ mov(ebp, esp);
 
   // Allocate spills
-  __ AllocateSpills();
+  __ AllocateOptimizedSpills();
 
   // Save argc
   Operand argc(ebp, -HValue::kPointerSize * 2);
@@ -135,24 +136,16 @@ void LLiteral::Generate(Masm* masm) {
 
 
 void LAllocateObject::Generate(Masm* masm) {
-  // XXX Use correct size here
-  __ pushb(Immediate(Heap::kTagNil));
-  __ pushb(Immediate(Heap::kTagNil));
-  __ push(Immediate(HNumber::Tag(size_)));
-  __ pushb(Immediate(HNumber::Tag(Heap::kTagObject)));
-  __ Call(masm->stubs()->GetAllocateObjectStub());
-  __ addlb(esp, Immediate(4 * 4));
+  AllocationSite* site = masm->heap()->CreateAllocationSite(Heap::kTagObject,
+                                                            size_);
+  __ AllocateObjectLiteral(site, eax);
 }
 
 
 void LAllocateArray::Generate(Masm* masm) {
-  // XXX Use correct size here
-  __ pushb(Immediate(Heap::kTagNil));
-  __ pushb(Immediate(Heap::kTagNil));
-  __ push(Immediate(HNumber::Tag(size_)));
-  __ pushb(Immediate(HNumber::Tag(Heap::kTagArray)));
-  __ Call(masm->stubs()->GetAllocateObjectStub());
-  __ addlb(esp, Immediate(4 * 4));
+  AllocationSite* site = masm->heap()->CreateAllocationSite(Heap::kTagArray,
+                                                            size_);
+  __ AllocateObjectLiteral(site, eax);
 }
 
 
@@ -196,14 +189,40 @@ void LBranchNumber::Generate(Masm* masm) {
 
 
 void LLoadProperty::Generate(Masm* masm) {
-  Label done;
+  Label done, slow;
   Masm::Spill eax_s(masm, eax);
 
   // eax <- object
   // ebx <- propery
+  if (HasSmiKey()) {
+    Label doubles, hole;
+
+    // Fast case: dense array's element
+    __ DenseArrayElement(eax, ebx, edx, &doubles);
+    Operand element(edx, 0);
+    __ mov(eax, element);
+    __ jmp(&done);
+
+    // Fast case: double array's element, boxed on load
+    __ bind(&doubles);
+    __ DoubleArrayElement(eax, ebx, edx, &slow);
+    Operand element_hi(edx, 4);
+    __ cmpl(element_hi, Immediate(HArray::kDoubleHoleHalf));
+    __ jmp(kEq, &hole);
+    __ movd(xmm1, element);
+    __ AllocateNumber(xmm1, eax);
+    __ jmp(&done);
+
+    __ bind(&hole);
+    __ mov(eax, Immediate(Heap::kTagNil));
+    __ jmp(&done);
+
+    __ bind(&slow);
+  }
+
   __ mov(ecx, Immediate(0));
   if (HasMonomorphicProperty()) {
-    __ Call(masm->space()->CreatePIC());
+    masm->space()->CreatePIC()->GenerateInline(masm);
   } else {
     __ Call(masm->stubs()->GetLookupPropertyStub());
   }
@@ -222,16 +241,101 @@ void LLoadProperty::Generate(Masm* masm) {
 
 
 void LStoreProperty::Generate(Masm* masm) {
-  Label done;
+  Label done, slow;
   Masm::Spill eax_s(masm, eax);
   Masm::Spill ecx_s(masm, ecx);
 
   // eax <- object
   // ebx <- propery
   // ecx <- value
+  if (HasSmiKey()) {
+    Label retry, store, doubles, unboxed, hole, grow, length, length_set;
+    Operand repr(eax, HValue::kRepresentationOffset);
+    Operand element(edx, 0);
+
+    __ bind(&retry);
+
+    // Fast case: dense array's element
+    __ DenseArrayElement(eax, ebx, edx, &doubles);
+
+    // Smi-only array switches to double elements on number store,
+    // and becomes generic on any other value
+    __ cmpb(repr, Immediate(HArray::kDenseSmi));
+    __ jmp(kNe, &store);
+    __ IsUnboxed(ecx, NULL, &store);
+    __ IsNil(ecx, NULL, &store);
+    __ IsHeapObject(Heap::kTagNumber, ecx, NULL, &grow);
+    __ movb(repr, Immediate(HArray::kDense));
+
+    __ bind(&store);
+    Operand qmap(eax, HObject::kMapOffset);
+    __ MarkingBarrier(element);
+    __ mov(element, ecx);
+    __ mov(scratch, qmap);
+    __ RecordWrite(scratch, ecx, edx);
+    __ jmp(&length);
+
+    // Fast case: double array's element
+    __ bind(&doubles);
+    __ DoubleArrayElement(eax, ebx, edx, &grow);
+    __ IsUnboxed(ecx, NULL, &unboxed);
+    __ IsNil(ecx, NULL, &hole);
+    __ IsHeapObject(Heap::kTagNumber, ecx, &slow, NULL);
+    Operand qvalue(ecx, HNumber::kValueOffset);
+    __ movd(fscratch, qvalue);
+    __ movd(element, fscratch);
+    __ jmp(&length);
+
+    __ bind(&unboxed);
+    __ mov(scratch, ecx);
+    __ Untag(scratch);
+    __ xorld(fscratch, fscratch);
+    __ cvtsi2sd(fscratch, scratch);
+    __ xorl(scratch, scratch);
+    __ movd(element, fscratch);
+    __ jmp(&length);
+
+    __ bind(&hole);
+    Operand element_hi(edx, 4);
+    __ mov(element, Immediate(HArray::kDoubleHoleHalf));
+    __ mov(element_hi, Immediate(HArray::kDoubleHoleHalf));
+    __ jmp(&length);
+
+    // Elements should be converted or grown to fit the value,
+    // only arrays and non-negative smi keys are interesting
+    __ bind(&grow);
+    __ IsUnboxed(eax, NULL, &slow);
+    __ IsNil(eax, NULL, &slow);
+    __ IsHeapObject(Heap::kTagArray, eax, &slow, NULL);
+    __ IsUnboxed(ebx, &slow, NULL);
+    __ cmpl(ebx, Immediate(0));
+    __ jmp(kLt, &slow);
+    __ Call(masm->stubs()->GetGrowElementsStub());
+    __ cmpl(eax, Immediate(0));
+    eax_s.Unspill();
+    __ jmp(kNe, &retry);
+    __ jmp(&slow);
+
+    // Update length if it was increased
+    __ bind(&length);
+    Operand qlength(eax, HArray::kLengthOffset);
+    __ Untag(ebx);
+    __ inc(ebx);
+    __ cmpl(ebx, qlength);
+    __ jmp(kLe, &length_set);
+    __ mov(qlength, ebx);
+    __ bind(&length_set);
+
+    // Raw length shouldn't be seen by GC
+    __ xorl(ebx, ebx);
+    __ jmp(&done);
+
+    __ bind(&slow);
+  }
+
   __ mov(ecx, Immediate(1));
   if (HasMonomorphicProperty()) {
-    __ Call(masm->space()->CreatePIC());
+    masm->space()->CreatePIC()->GenerateInline(masm);
   } else {
     __ Call(masm->stubs()->GetLookupPropertyStub());
   }
@@ -249,7 +353,9 @@ void LStoreProperty::Generate(Masm* masm) {
   __ addl(eax, ebx);
 
   Operand slot(eax, 0);
+  __ MarkingBarrier(slot);
   __ mov(slot, ecx);
+  __ RecordWrite(ebx, ecx, eax);
 
   // ebx <- object
   __ bind(&done);
@@ -358,21 +464,53 @@ void LBinOpNumber::Generate(Masm* masm) {
 #undef BINARY_SUB_ENUM
 #undef BINARY_SUB_TYPES
 
-void LFunction::Generate(Masm* masm) {
+static void LoadFunctionBody(Masm* masm, Label* label, Register reg) {
   // Get function's body address from relocation info
-  __ mov(scratches[0]->ToRegister(), Immediate(0));
+  __ mov(reg, Immediate(0));
   RelocationInfo* addr = new RelocationInfo(RelocationInfo::kAbsolute,
                                             RelocationInfo::kLong,
                                             masm->offset() - 4);
-  label_->AddUse(masm, addr);
+  label->AddUse(masm, addr);
+}
+
 
-  // Call stub
+void LFunction::Generate(Masm* masm) {
+  Label runtime, done;
+
+  // Fast case: bump-allocate function in new space
+  __ AllocateInline(5 * HValue::kPointerSize, eax, &runtime);
+
+  Operand qtag(eax, HValue::kTagOffset);
+  Operand qparent(eax, HFunction::kParentOffset);
+  Operand qaddr(eax, HFunction::kCodeOffset);
+  Operand qroot(eax, HFunction::kRootOffset);
+  Operand qargc(eax, HFunction::kArgcOffset);
+  Heap* heap = masm->heap();
+  Immediate root(reinterpret_cast<intptr_t>(heap->old_space()->root()));
+  Operand scratch_op(scratch, 0);
+
+  __ mov(qtag, Immediate(Heap::kTagFunction));
+  __ mov(qparent, context_reg);
+  __ mov(scratch, root);
+  __ mov(scratch, scratch_op);
+  __ mov(qroot, scratch);
+  LoadFunctionBody(masm, label_, scratch);
+  __ mov(qaddr, scratch);
+  __ mov(qargc, Immediate(HNumber::Tag(arg_count_)));
+  __ xorl(scratch, scratch);
+  __ jmp(&done);
+
+  // Slow case: call stub
+  __ bind(&runtime);
+  LoadFunctionBody(masm, label_, scratch);
   __ pushb(Immediate(Heap::kTagNil));
   __ pushb(Immediate(Heap::kTagNil));
   __ push(Immediate(HNumber::Tag(arg_count_)));
-  __ push(scratches[0]->ToRegister());
+  __ push(scratch);
   __ Call(masm->stubs()->GetAllocateFunctionStub());
   __ addlb(esp, Immediate(4 * 4));
+
+  __ bind(&done);
 }
 
 
@@ -555,7 +693,11 @@ void LStoreContext::Generate(Masm* masm) {
 
   Operand res(scratches[0]->ToRegister(),
               HContext::GetIndexDisp(slot()->index()));
+  __ MarkingBarrier(res);
   __ mov(res, inputs[0]->ToRegister());
+  __ RecordWrite(scratches[0]->ToRegister(),
+                 inputs[0]->ToRegister(),
+                 reg_nil);
 }
 
 
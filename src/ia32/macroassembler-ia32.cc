@@ -27,6 +27,7 @@
 #include "heap.h"  // HeapValue
 #include "heap-inl.h"
 #include "stubs.h"
+#include "source-map.h"  // SafepointMap
 #include "utils.h"  // ComputeHash
 
 namespace candor {
@@ -38,7 +39,8 @@ Masm::Masm(CodeSpace* space) : space_(space),
                                spill_offset_(4),
                                spill_index_(0),
                                spills_(0),
-                               spill_operand_(ebp, 0) {
+                               spill_operand_(ebp, 0),
+                               safepoints_(NULL) {
 }
 
 
@@ -161,14 +163,27 @@ Operand* Masm::Spill::GetOperand() {
 
 
 void Masm::AllocateSpills() {
+  ReserveSpills();
+  FillStackSlots(HValue::kPointerSize);
+}
+
+
+void Masm::AllocateOptimizedSpills() {
+  ReserveSpills();
+
+  // Skip argc and optimized code's spills, Masm::Spill slots are still
+  // visited by GC conservatively
+  FillStackSlots(spill_offset_ + HValue::kPointerSize);
+}
+
+
+void Masm::ReserveSpills() {
   subl(esp, Immediate(0));
   spill_reloc_ = new RelocationInfo(RelocationInfo::kValue,
                                     RelocationInfo::kLong,
                                     offset() - 4);
 
   relocation_info_.Push(spill_reloc_);
-
-  FillStackSlots();
 }
 
 
@@ -183,6 +198,19 @@ void Masm::Allocate(Heap::HeapTag tag,
                     Register size_reg,
                     uint32_t size,
                     Register result) {
+  Label runtime, done;
+
+  if (size_reg.is(reg_nil)) {
+    AllocateInline(size + HValue::kPointerSize, result, &runtime);
+
+    // Set tag
+    Operand qtag(result, HValue::kTagOffset);
+    mov(qtag, Immediate(tag));
+    jmp(&done);
+
+    bind(&runtime);
+  }
+
   push(eax);
   push(eax);
 
@@ -209,6 +237,36 @@ void Masm::Allocate(Heap::HeapTag tag,
   } else {
     addlb(esp, Immediate(4 * 2));
   }
+
+  bind(&done);
+}
+
+
+void Masm::AllocateInline(uint32_t size, Register result, Label* runtime) {
+  assert(!result.is(scratch));
+
+  Immediate top(reinterpret_cast<intptr_t>(heap()->new_space()->top()));
+  Immediate limit(reinterpret_cast<intptr_t>(heap()->new_space()->limit()));
+  Operand scratch_op(scratch, 0);
+
+  // Same as in AllocateStub: top and limit are dereferenced twice
+  mov(scratch, top);
+  mov(scratch, scratch_op);
+  mov(result, scratch_op);
+  addl(result, Immediate(size));
+  jmp(kCarry, runtime);
+
+  // Check if we exhausted buffer
+  mov(scratch, limit);
+  mov(scratch, scratch_op);
+  cmpl(result, scratch_op);
+  jmp(kGt, runtime);
+
+  // Update top (`size` is even, so it stays tagged)
+  mov(scratch, top);
+  mov(scratch, scratch_op);
+  mov(scratch_op, result);
+  subl(result, Immediate(size));
 }
 
 
@@ -255,7 +313,7 @@ void Masm::AllocateObjectLiteral(Heap::HeapTag tag,
                                  Register result) {
   Operand qmask(result, HObject::kMaskOffset);
   Operand qmap(result, HObject::kMapOffset);
-  Operand qproto(result, HObject::kProtoOffset);
+  Operand qshape(result, HObject::kShapeOffset);
 
   // Array only field
   Operand qlength(result, HArray::kLengthOffset);
@@ -294,6 +352,19 @@ void Masm::AllocateObjectLiteral(Heap::HeapTag tag,
 
   // mask (= (size - 1) << 2)
   Untag(scratch);
+
+  // Dense arrays are using both halves of the map
+  if (tag_reg.is(reg_nil)) {
+    if (tag == Heap::kTagArray) shl(scratch, Immediate(1));
+  } else {
+    Label not_array;
+    Operand qtag(result, HValue::kTagOffset);
+    cmpb(qtag, Immediate(Heap::kTagArray));
+    jmp(kNe, &not_array);
+    shl(scratch, Immediate(1));
+    bind(&not_array);
+  }
+
   dec(scratch);
   shl(scratch, Immediate(2));
   mov(qmask, scratch);
@@ -311,7 +382,9 @@ void Masm::AllocateObjectLiteral(Heap::HeapTag tag,
 
   Allocate(Heap::kTagMap, size, 0, scratch);
   mov(qmap, scratch);
-  mov(qproto, scratch);
+
+  // Dictionary mode, caller should set proper shape if needed
+  mov(qshape, Immediate(0));
 
   size_s.Unspill();
   mov(result, scratch);
@@ -335,6 +408,96 @@ void Masm::AllocateObjectLiteral(Heap::HeapTag tag,
 }
 
 
+void Masm::AllocateObjectLiteral(AllocationSite* site, Register result) {
+  Label runtime, fill, done;
+
+  Heap::HeapTag tag = site->tag();
+  uint32_t size = site->size();
+
+  // tag + mask + map + shape (+ length)
+  uint32_t object_size = (tag == Heap::kTagArray ? 5 : 4) *
+                         HValue::kPointerSize;
+  // tag + site
+  uint32_t memento_size = 2 * HValue::kPointerSize;
+  // tag + size + keys + values
+  uint32_t map_size = (2 + 2 * size) * HValue::kPointerSize;
+
+  Immediate siteref(reinterpret_cast<intptr_t>(site));
+  Operand qallocated(scratch, AllocationSite::kAllocatedOffset);
+  Operand qtenure(scratch, AllocationSite::kTenureOffset);
+
+  // Count allocation, tenured site allocates in old space through runtime
+  mov(scratch, siteref);
+  mov(result, qallocated);
+  inc(result);
+  mov(qallocated, result);
+  cmpl(qtenure, Immediate(Heap::kTenureNew));
+  jmp(kNe, &runtime);
+
+  AllocateInline(object_size + memento_size + map_size, result, &runtime);
+
+  Operand qtag(result, HValue::kTagOffset);
+  Operand qgcmark(result, HValue::kGCMarkOffset);
+  Operand qmask(result, HObject::kMaskOffset);
+  Operand qmap(result, HObject::kMapOffset);
+  Operand qshape(result, HObject::kShapeOffset);
+  Operand qlength(result, HArray::kLengthOffset);
+  Shape* shape = tag == Heap::kTagObject ? heap()->RootShape(size) : NULL;
+
+  mov(qtag, Immediate(tag));
+  movb(qgcmark, Immediate(HValue::kMementoBit));
+  if (tag == Heap::kTagArray) {
+    mov(qmask, Immediate(HArray::DenseMask(size)));
+    mov(qlength, Immediate(0));
+  } else {
+    mov(qmask, Immediate((size - 1) * HValue::kPointerSize));
+  }
+
+  // Memento goes right after the object
+  Operand qmementotag(result, object_size + HValue::kTagOffset);
+  Operand qmementosite(result, object_size + HValue::interior_offset(1));
+
+  mov(qmementotag, Immediate(Heap::kTagMemento));
+  mov(qmementosite, siteref);
+
+  // And map after it
+  uint32_t map_offset = object_size + memento_size;
+  Operand qmaptag(scratch, HValue::kTagOffset);
+  Operand qmapsize(scratch, HMap::kSizeOffset);
+
+  mov(scratch, result);
+  addl(scratch, Immediate(map_offset));
+  mov(qmap, scratch);
+  mov(qshape, Immediate(reinterpret_cast<intptr_t>(shape)));
+  mov(qmaptag, Immediate(Heap::kTagMap));
+  mov(qmapsize, Immediate(size));
+
+  // Fill map with nil, from the last slot down to the first one
+  Operand qslot(scratch, map_offset + HMap::kSpaceOffset);
+
+  mov(scratch, result);
+  addl(scratch, Immediate((2 * size - 1) * HValue::kPointerSize));
+  bind(&fill);
+  mov(qslot, Immediate(Heap::kTagNil));
+  sublb(scratch, Immediate(HValue::kPointerSize));
+  cmpl(scratch, result);
+  jmp(kGe, &fill);
+
+  xorl(scratch, scratch);
+  jmp(&done);
+
+  // Page is exhausted or site is tenured
+  bind(&runtime);
+  push(siteref);
+  push(siteref);
+  Call(stubs()->GetAllocateSiteObjectStub());
+  addlb(esp, Immediate(4 * 2));
+  if (!result.is(eax)) mov(result, eax);
+
+  bind(&done);
+}
+
+
 void Masm::Fill(Register start, Register end, Immediate value) {
   Push(start);
   mov(scratch, value);
@@ -361,7 +524,7 @@ void Masm::Fill(Register start, Register end, Immediate value) {
 }
 
 
-void Masm::FillStackSlots() {
+void Masm::FillStackSlots(uint32_t offset) {
   push(scratch);
   push(eax);
   push(ebx);
@@ -370,7 +533,7 @@ void Masm::FillStackSlots() {
   // Skip eax/ebx/scratch
   addlb(eax, Immediate(4 * 3));
   // Skip frame info
-  sublb(ebx, Immediate(4 * 1));
+  subl(ebx, Immediate(offset));
   Fill(eax, ebx, Immediate(Heap::kTagNil));
   pop(ebx);
   pop(eax);
@@ -574,6 +737,63 @@ void Masm::CheckGC() {
 }
 
 
+void Masm::RecordWrite(Register host, Register value, Register slot) {
+  Operand host_gen(host, HValue::kGenerationOffset);
+  Operand host_mark(host, HValue::kGCMarkOffset);
+  Operand value_gen(value, HValue::kGenerationOffset);
+
+  Label done;
+
+  // Only pointers to heap objects are interesting
+  IsUnboxed(value, NULL, &done);
+  IsNil(value, NULL, &done);
+
+  // Host should be in old space and value in new space
+  cmpb(host_gen, Immediate(Heap::kMinOldSpaceGeneration));
+  jmp(kLt, &done);
+  cmpb(value_gen, Immediate(Heap::kMinOldSpaceGeneration));
+  jmp(kGe, &done);
+
+  // Skip hosts that are already in remembered set
+  // (large maps are never there, their cards are dirtied by runtime)
+  testb(host_mark, Immediate(HValue::kRememberedBit));
+  jmp(kNe, &done);
+
+  push(host);
+  if (slot.is(reg_nil)) {
+    push(Immediate(0));
+  } else {
+    push(slot);
+  }
+  Call(stubs()->GetRecordWriteStub());
+  addlb(esp, Immediate(4 * 2));
+
+  bind(&done);
+}
+
+
+void Masm::MarkingBarrier(const Operand& slot) {
+  Immediate marking(reinterpret_cast<uint32_t>(heap()->marking_addr()));
+  Operand scratch_op(scratch, 0);
+
+  Label done;
+
+  // Check marking flag
+  mov(scratch, marking);
+  cmpb(scratch_op, Immediate(0));
+  jmp(kEq, &done);
+
+  // NOTE: slot's base register shouldn't be scratch
+  mov(scratch, slot);
+  push(scratch);
+  push(scratch);
+  Call(stubs()->GetMarkingBarrierStub());
+  addlb(esp, Immediate(4 * 2));
+
+  bind(&done);
+}
+
+
 void Masm::IsNil(Register reference, Label* not_nil, Label* is_nil) {
   cmplb(reference, Immediate(Heap::kTagNil));
   if (is_nil != NULL) jmp(kEq, is_nil);
@@ -610,20 +830,77 @@ void Masm::IsTrue(Register reference, Label* is_false, Label* is_true) {
 
 
 void Masm::IsDenseArray(Register reference, Label* non_dense, Label* dense) {
-  Operand qmap(reference, HObject::kMapOffset);
-  Operand qmapsize(scratch, HMap::kSizeOffset);
-  mov(scratch, qmap);
-  cmpl(qmapsize, Immediate(HArray::kDenseLengthMax));
+  Operand repr_field(reference, HValue::kRepresentationOffset);
+  cmpb(repr_field, Immediate(HArray::kDense));
   if (non_dense != NULL) jmp(kGt, non_dense);
   if (dense != NULL) jmp(kLe, dense);
 }
 
 
+void Masm::DenseArrayElement(Register array,
+                             Register key,
+                             Register result,
+                             Label* slow) {
+  Operand qmask(array, HObject::kMaskOffset);
+  Operand qmap(array, HObject::kMapOffset);
+
+  // Key should be a non-negative smi
+  IsUnboxed(key, slow, NULL);
+  cmpl(key, Immediate(0));
+  jmp(kLt, slow);
+
+  IsUnboxed(array, NULL, slow);
+  IsNil(array, NULL, slow);
+  IsHeapObject(Heap::kTagArray, array, slow, NULL);
+  IsDenseArray(array, slow, NULL);
+
+  // NOTE: key is tagged so we need to shift it only once
+  mov(result, key);
+  shl(result, Immediate(1));
+  cmpl(result, qmask);
+  jmp(kGt, slow);
+
+  addl(result, qmap);
+  addlb(result, Immediate(HMap::kSpaceOffset));
+}
+
+
+void Masm::DoubleArrayElement(Register array,
+                              Register key,
+                              Register result,
+                              Label* slow) {
+  Operand qmask(array, HObject::kMaskOffset);
+  Operand qmap(array, HObject::kMapOffset);
+  Operand repr_field(array, HValue::kRepresentationOffset);
+
+  // Key should be a non-negative smi
+  IsUnboxed(key, slow, NULL);
+  cmpl(key, Immediate(0));
+  jmp(kLt, slow);
+
+  IsUnboxed(array, NULL, slow);
+  IsNil(array, NULL, slow);
+  IsHeapObject(Heap::kTagArray, array, slow, NULL);
+  cmpb(repr_field, Immediate(HArray::kDenseDouble));
+  jmp(kNe, slow);
+
+  // NOTE: elements are 8 bytes wide, tagged key needs only 2 shifts
+  mov(result, key);
+  shl(result, Immediate(2));
+  cmpl(result, qmask);
+  jmp(kGt, slow);
+
+  addl(result, qmap);
+  addlb(result, Immediate(HCData::kDataOffset));
+}
+
+
 void Masm::Call(Register addr) {
   while ((offset() & 0x1) != 0x0) {
     nop();
   }
   call(addr);
+  if (safepoints() != NULL) safepoints()->Push(offset());
   nop();
 }
 
@@ -633,6 +910,7 @@ void Masm::Call(const Operand& addr) {
     nop();
   }
   call(addr);
+  if (safepoints() != NULL) safepoints()->Push(offset());
   nop();
 }
 
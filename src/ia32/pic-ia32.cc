@@ -31,48 +31,47 @@ namespace internal {
 #define __ masm->
 
 void PIC::Generate(Masm* masm) {
-  __ push(ebp);
-  __ mov(ebp, esp);
+  Label miss;
+  Operand shape_op(eax, HObject::kShapeOffset);
+  Operand qmap(eax, HObject::kMapOffset);
 
-  // Place for spills
-  __ pushb(Immediate(Heap::kTagNil));
-  __ pushb(Immediate(Heap::kTagNil));
-
-  Label miss, end;
-  Operand edx_op(edx, 0);
-  Operand proto_op(eax, HObject::kProtoOffset);
-  Operand eax_s(ebp, -8), ebx_s(ebp, -12);
-
-  __ mov(eax_s, eax);
-  __ mov(ebx_s, ebx);
-
-  if (size_ != 0) {
-    // Proto in case of array
-    __ mov(edx, Immediate(Heap::kICDisabledValue));
-
-    // Fast-case non-object
-    __ IsNil(eax, NULL, &miss);
-    __ IsUnboxed(eax, NULL, &miss);
-    __ IsHeapObject(Heap::kTagObject, eax, &miss, NULL);
-
-    // Load proto
-    __ mov(edx, proto_op);
-    __ cmpl(edx, Immediate(Heap::kICDisabledValue));
-    __ jmp(kEq, &miss);
-  }
+  // edx <- shape (NULL for non-objects)
+  __ xorl(edx, edx);
 
+  // Fast-case non-object
+  __ IsNil(eax, NULL, &miss);
+  __ IsUnboxed(eax, NULL, &miss);
+  __ IsHeapObject(Heap::kTagObject, eax, &miss, NULL);
+
+  // Load shape (NULL in dictionary mode never matches)
+  __ mov(edx, shape_op);
+
+  // NOTE: Hits don't need a frame, only scratch and edx are clobbered
   for (int i = size_ - 1; i >= 0; i--) {
     Label local_miss;
 
-    __ mov(ebx, Immediate(reinterpret_cast<intptr_t>(protos_[i])));
-    proto_offsets_[i] = reinterpret_cast<char**>(static_cast<intptr_t>(
-          masm->offset() - 4));
-    __ cmpl(edx, ebx);
+    __ cmpl(edx, Immediate(reinterpret_cast<intptr_t>(shapes_[i])));
     __ jmp(kNe, &local_miss);
+
+    if (transitions_[i] != NULL) {
+      // Shape guarantees that key's slot is empty: insert key and move
+      // object to the next shape
+      // key_offset = value_offset - mask - 4
+      intptr_t key_offset = results_[i] - HValue::kPointerSize -
+          (shapes_[i]->size() - 1) * HValue::kPointerSize;
+      Operand qkey(edx, key_offset);
+
+      __ mov(edx, qmap);
+      __ mov(qkey, ebx);
+      __ mov(scratch, edx);
+      __ addl(scratch, Immediate(key_offset));
+      __ RecordWrite(edx, ebx, scratch);
+
+      __ mov(shape_op,
+             Immediate(reinterpret_cast<intptr_t>(transitions_[i])));
+    }
+
     __ mov(eax, Immediate(results_[i]));
-    __ xorl(ebx, ebx);
-    __ mov(esp, ebp);
-    __ pop(ebp);
     __ ret(0);
     __ bind(&local_miss);
   }
@@ -80,14 +79,19 @@ void PIC::Generate(Masm* masm) {
   // Cache failed - call runtime
   __ bind(&miss);
 
-  if (size_ != 0) {
-    __ mov(ebx, ebx_s);
-    __ mov(eax, eax_s);
-  }
+  __ push(ebp);
+  __ mov(ebp, esp);
+
+  // Place for spills
+  Operand eax_s(ebp, -4), shape_s(ebp, -8);
+  __ push(eax);
+  __ push(edx);
+
   __ Call(space_->stubs()->GetLookupPropertyStub());
 
-  // Miss(this, object, result, ip)
+  // Miss(this, object, result, ip, shape)
   Operand caller_ip(ebp, 4);
+  __ push(shape_s);
   __ push(caller_ip);
   __ push(eax);
   __ push(eax_s);
@@ -95,12 +99,43 @@ void PIC::Generate(Masm* masm) {
   __ Call(space_->stubs()->GetPICMissStub());
 
   // Return value
-  __ bind(&end);
   __ xorl(ebx, ebx);
   __ mov(esp, ebp);
   __ pop(ebp);
   __ ret(0);
 }
 
+
+void PIC::GenerateInline(Masm* masm) {
+  Label miss, done;
+  Operand shape_op(eax, HObject::kShapeOffset);
+
+  // eax <- object
+  // ebx <- property
+  // ecx <- change flag
+  __ IsNil(eax, NULL, &miss);
+  __ IsUnboxed(eax, NULL, &miss);
+  __ IsHeapObject(Heap::kTagObject, eax, &miss, NULL);
+
+  // Shape and result are patched by Miss()
+  __ mov(edx, Immediate(Heap::kICZapValue));
+  intptr_t shape_imm = masm->offset() - HValue::kPointerSize;
+  __ cmpl(edx, shape_op);
+  __ jmp(kNe, &miss);
+  __ mov(eax, Immediate(Heap::kICZapValue));
+  intptr_t result_imm = masm->offset() - HValue::kPointerSize;
+  __ jmp(&done);
+
+  __ bind(&miss);
+  __ mov(scratch, Immediate(reinterpret_cast<intptr_t>(addr())));
+  intptr_t call_imm = masm->offset() - HValue::kPointerSize;
+  __ Call(scratch);
+
+  __ bind(&done);
+
+  inline_shape_ = call_imm - shape_imm;
+  inline_result_ = call_imm - result_imm;
+}
+
 }  // namespace internal
 }  // namespace candor
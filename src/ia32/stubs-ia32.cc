@@ -209,9 +209,16 @@ void AllocateStub::Generate() {
   __ mov(scratch, scratch_op);
   __ mov(scratch_op, ebx);
 
+  // Set tag
+  Operand qtag(eax, HValue::kTagOffset);
+  __ mov(scratch, tag);
+  __ Untag(scratch);
+  __ mov(qtag, scratch);
+
   __ jmp(&done);
 
   // Invoke runtime allocation stub
+  // (large objects are allocated there too)
   __ bind(&runtime_allocate);
 
   // Remove junk from registers
@@ -224,29 +231,36 @@ void AllocateStub::Generate() {
     Masm::Align a(masm());
     __ Pushad();
 
-    __ mov(scratch, size);
-    __ push(scratch);
+    // AllocateNumber keeps the value in xmm1, which is caller-saved in C++
+    // (four slots to keep the stack aligned)
+    Operand xmm_slot(ebx, 0);
+    __ sublb(esp, Immediate(4 * 4));
+    __ mov(ebx, esp);
+    __ movd(xmm_slot, xmm1);
+
+    __ mov(scratch, tag);
+    __ Untag(scratch);
     __ push(scratch);
 
-    // Two arguments: heap, size
+    // Three arguments: heap, size, tag (runtime will set it)
+    __ push(scratch);
+    __ mov(scratch, size);
+    __ Untag(scratch);
     __ push(scratch);
     __ push(heapref);
     __ mov(scratch, Immediate(*reinterpret_cast<intptr_t*>(&allocate)));
 
     __ Call(scratch);
     __ addlb(esp, Immediate(4 * 4));
+    __ mov(ebx, esp);
+    __ movd(xmm1, xmm_slot);
+    __ addlb(esp, Immediate(4 * 4));
     __ Popad(eax);
   }
 
   // Voila result and result_end are pointers
   __ bind(&done);
 
-  // Set tag
-  Operand qtag(eax, HValue::kTagOffset);
-  __ mov(scratch, tag);
-  __ Untag(scratch);
-  __ mov(qtag, scratch);
-
   // eax will hold resulting pointer
   __ pop(ebx);
   GenerateEpilogue();
@@ -294,10 +308,17 @@ void AllocateObjectStub::Generate() {
   Operand size(ebp, 3 * 4);
   Operand tag(ebp, 2 * 4);
 
+  // edx <- shape
+  Masm::Spill edx_s(masm(), edx);
+
   __ mov(ecx, tag);
   __ mov(ebx, size);
   __ AllocateObjectLiteral(Heap::kTagNil, ecx, ebx, eax);
 
+  Operand qshape(eax, HObject::kShapeOffset);
+  edx_s.Unspill(ebx);
+  __ mov(qshape, ebx);
+
   GenerateEpilogue();
 }
 
@@ -349,6 +370,40 @@ void CallBindingStub::Generate() {
 }
 
 
+void AllocateSiteObjectStub::Generate() {
+  GeneratePrologue();
+
+  // Arguments
+  Operand site(ebp, 2 * 4);
+
+  RuntimeAllocateObjectCallback allocate = &RuntimeAllocateObject;
+  __ Pushad();
+
+  {
+    Masm::Align a(masm());
+
+    // RuntimeAllocateObject(heap, site)
+    __ mov(edi, Immediate(reinterpret_cast<intptr_t>(masm()->heap())));
+    __ mov(esi, site);
+    __ mov(eax, Immediate(*reinterpret_cast<intptr_t*>(&allocate)));
+
+    __ push(esi);
+    __ push(esi);
+    __ push(esi);
+    __ push(edi);
+    __ Call(eax);
+    __ addlb(esp, Immediate(4 * 4));
+  }
+
+  __ Popad(eax);
+
+  __ CheckGC();
+
+  // Caller will unwind stack
+  GenerateEpilogue();
+}
+
+
 void CollectGarbageStub::Generate() {
   GeneratePrologue();
 
@@ -358,12 +413,12 @@ void CollectGarbageStub::Generate() {
   {
     Masm::Align a(masm());
 
-    // RuntimeCollectGarbage(heap, stack_top)
+    // RuntimeCollectGarbage(heap, stack_top, frame)
     __ mov(edi, Immediate(reinterpret_cast<intptr_t>(masm()->heap())));
     __ mov(esi, esp);
 
     __ push(esi);
-    __ push(esi);
+    __ push(ebp);
 
     __ push(esi);
     __ push(edi);
@@ -380,6 +435,72 @@ void CollectGarbageStub::Generate() {
 }
 
 
+void RecordWriteStub::Generate() {
+  GeneratePrologue();
+
+  // Arguments
+  Operand host(ebp, 3 * 4);
+  Operand slot(ebp, 2 * 4);
+
+  RuntimeRecordWriteCallback record = &RuntimeRecordWrite;
+  __ Pushad();
+
+  {
+    Masm::Align a(masm());
+
+    // RuntimeRecordWrite(heap, host, slot)
+    __ mov(edi, Immediate(reinterpret_cast<intptr_t>(masm()->heap())));
+    __ mov(esi, host);
+    __ mov(eax, slot);
+
+    __ push(eax);
+    __ push(eax);
+    __ push(esi);
+    __ push(edi);
+    __ mov(eax, Immediate(*reinterpret_cast<intptr_t*>(&record)));
+    __ Call(eax);
+    __ addlb(esp, Immediate(4 * 4));
+  }
+
+  __ Popad(reg_nil);
+
+  // Caller will unwind stack
+  GenerateEpilogue();
+}
+
+
+void MarkingBarrierStub::Generate() {
+  GeneratePrologue();
+
+  // Arguments
+  Operand value(ebp, 2 * 4);
+
+  RuntimeMarkingBarrierCallback barrier = &RuntimeMarkingBarrier;
+  __ Pushad();
+
+  {
+    Masm::Align a(masm());
+
+    // RuntimeMarkingBarrier(heap, value)
+    __ mov(edi, Immediate(reinterpret_cast<intptr_t>(masm()->heap())));
+    __ mov(esi, value);
+    __ mov(eax, Immediate(*reinterpret_cast<intptr_t*>(&barrier)));
+
+    __ push(esi);
+    __ push(esi);
+    __ push(esi);
+    __ push(edi);
+    __ Call(eax);
+    __ addlb(esp, Immediate(4 * 4));
+  }
+
+  __ Popad(reg_nil);
+
+  // Caller will unwind stack
+  GenerateEpilogue();
+}
+
+
 void TypeofStub::Generate() {
   GeneratePrologue();
   Heap* heap = masm()->heap();
@@ -474,7 +595,7 @@ void KeysofStub::Generate() {
 void LookupPropertyStub::Generate() {
   GeneratePrologue();
 
-  Label is_object, is_array, cleanup, slow_case;
+  Label is_object, is_array, probe_cache, cleanup, slow_case;
   Label non_object_error, done;
 
   // eax <- object
@@ -502,6 +623,26 @@ void LookupPropertyStub::Generate() {
 
     __ StringHash(ebx, edx);
 
+    // Flattened cons string is interned by its left part
+    Label flat_key;
+    Operand krepr(ebx, HValue::kRepresentationOffset);
+    Operand kleft(ebx, HString::kLeftConsOffset);
+    Operand kright(ebx, HString::kRightConsOffset);
+    __ cmpb(krepr, Immediate(HString::kCons));
+    __ jmp(kNe, &flat_key);
+    __ cmpl(kright, Immediate(Heap::kTagNil));
+    __ jmp(kNe, &flat_key);
+
+    // String builder's buffer is bigger than the string itself
+    Operand klength(ebx, HString::kLengthOffset);
+    Operand kleft_length(esi, HString::kLengthOffset);
+    __ mov(esi, kleft);
+    __ mov(scratch, klength);
+    __ cmpl(scratch, kleft_length);
+    __ jmp(kNe, &flat_key);
+    __ mov(ebx, esi);
+    __ bind(&flat_key);
+
     Operand qmask(eax, HObject::kMaskOffset);
     __ mov(esi, qmask);
 
@@ -510,7 +651,7 @@ void LookupPropertyStub::Generate() {
     __ addlb(edx, Immediate(HMap::kSpaceOffset));
 
     Operand qmap(eax, HObject::kMapOffset);
-    Operand qproto(eax, HObject::kProtoOffset);
+    Operand qshape(eax, HObject::kShapeOffset);
     __ mov(scratch, qmap);
     __ addl(scratch, edx);
 
@@ -527,7 +668,7 @@ void LookupPropertyStub::Generate() {
 
     // or nil
     __ cmpl(scratch, Immediate(Heap::kTagNil));
-    __ jmp(kNe, &cleanup);
+    __ jmp(kNe, &probe_cache);
 
     __ bind(&match);
 
@@ -538,10 +679,16 @@ void LookupPropertyStub::Generate() {
     __ jmp(kEq, &fast_case_end);
 
     // Inserting key in map is required
-    // invalidate IC if key wasn't the same
+    // new key changes object's shape - let runtime do transition
     __ IsNil(scratch, &same_key, NULL);
 
-    __ mov(qproto, Immediate(Heap::kICDisabledValue));
+    __ cmpl(qshape, Immediate(0));
+    __ jmp(kNe, &cleanup);
+
+    // Only interned keys are put into maps - let runtime intern it
+    Operand qgcmark(ebx, HValue::kGCMarkOffset);
+    __ testb(qgcmark, Immediate(HValue::kInternedBit));
+    __ jmp(kEq, &cleanup);
     __ bind(&same_key);
 
     // Restore map's interior pointer
@@ -550,6 +697,9 @@ void LookupPropertyStub::Generate() {
 
     // Put the key into slot
     __ mov(slot, ebx);
+    __ mov(ecx, qmap);
+    __ RecordWrite(ecx, ebx, scratch);
+    change_s.Unspill();
 
     __ bind(&fast_case_end);
 
@@ -567,6 +717,42 @@ void LookupPropertyStub::Generate() {
     GenerateEpilogue(0);
   }
 
+  // Slot is occupied by another key - try megamorphic stub cache
+  __ bind(&probe_cache);
+  {
+    StubCache* cache = masm()->heap()->stub_cache();
+    Operand qshape(eax, HObject::kShapeOffset);
+
+    // Objects in dictionary mode aren't cached
+    __ mov(edx, qshape);
+    __ cmpl(edx, Immediate(0));
+    __ jmp(kEq, &cleanup);
+
+    // scratch <- entry
+    __ mov(scratch, edx);
+    __ xorl(scratch, ebx);
+    __ mov(esi, Immediate(StubCache::kIndexMask));
+    __ andl(scratch, esi);
+    __ mov(esi, Immediate(reinterpret_cast<intptr_t>(cache->table())));
+    __ addl(scratch, esi);
+
+    Operand eshape(scratch, StubCache::kShapeOffset);
+    Operand ekey(scratch, StubCache::kKeyOffset);
+    Operand eoffset(scratch, StubCache::kOffsetOffset);
+    __ cmpl(edx, eshape);
+    __ jmp(kNe, &cleanup);
+    __ cmpl(ebx, ekey);
+    __ jmp(kNe, &cleanup);
+    __ mov(eax, eoffset);
+
+    // Cleanup
+    __ xorl(edx, edx);
+    esi_s.Unspill();
+
+    // Return value
+    GenerateEpilogue(0);
+  }
+
   __ bind(&is_array);
   // Fast case: dense array and a unboxed key
   {
@@ -576,6 +762,14 @@ void LookupPropertyStub::Generate() {
     __ jmp(kLe, &slow_case);
     __ IsDenseArray(eax, &slow_case, NULL);
 
+    // Smi-only array could receive any value now
+    Label smi_kept;
+    Operand repr(eax, HValue::kRepresentationOffset);
+    __ cmpl(ecx, Immediate(0));
+    __ jmp(kEq, &smi_kept);
+    __ movb(repr, Immediate(HArray::kDense));
+    __ bind(&smi_kept);
+
     // Get mask
     Operand qmask(eax, HObject::kMaskOffset);
     __ mov(edx, qmask);
@@ -667,10 +861,12 @@ void PICMissStub::Generate() {
   Operand object(ebp, 12);
   Operand result(ebp, 16);
   Operand ip(ebp, 20);
+  Operand shape(ebp, 24);
 
   // Amend PIC
   __ Pushad();
 
+  __ push(shape);
   __ push(ip);
   __ push(result);
   __ push(object);
@@ -679,7 +875,7 @@ void PICMissStub::Generate() {
   PIC::MissCallback miss_cb = &PIC::Miss;
   __ mov(scratch, Immediate(*reinterpret_cast<intptr_t*>(&miss_cb)));
   __ Call(scratch);
-  __ addlb(esp, Immediate(4 * 4));
+  __ addlb(esp, Immediate(5 * 4));
 
   __ Popad(reg_nil);
 
@@ -758,6 +954,9 @@ void CloneObjectStub::Generate() {
   __ IsNil(eax, NULL, &non_object);
   __ IsHeapObject(Heap::kTagObject, eax, &non_object, NULL);
 
+  // Keep object alive while allocating, GC may free shapes of dead objects
+  Masm::Spill object_s(masm(), eax);
+
   // Get map
   Operand qmap(eax, HObject::kMapOffset);
   __ mov(eax, qmap);
@@ -777,9 +976,12 @@ void CloneObjectStub::Generate() {
   Operand qmap_ebx(ebx, HObject::kMapOffset);
   __ mov(ebx, qmap_ebx);
 
-  // Set proto
-  Operand qproto(edx, HObject::kProtoOffset);
-  __ mov(qproto, eax);
+  // Clone has the same layout
+  Operand qshape(scratch, HObject::kShapeOffset);
+  Operand qshape_edx(edx, HObject::kShapeOffset);
+  object_s.Unspill(scratch);
+  __ mov(scratch, qshape);
+  __ mov(qshape_edx, scratch);
 
   // Skip headers
   __ addlb(eax, Immediate(HMap::kSpaceOffset));
@@ -817,6 +1019,10 @@ void CloneObjectStub::Generate() {
   // Allocate new object
   __ AllocateObjectLiteral(Heap::kTagObject, reg_nil, ecx, eax);
 
+  Operand qshape_eax(eax, HObject::kShapeOffset);
+  Shape* shape = masm()->heap()->RootShape(16);
+  __ mov(qshape_eax, Immediate(reinterpret_cast<intptr_t>(shape)));
+
   __ bind(&done);
 
   GenerateEpilogue();
@@ -852,6 +1058,37 @@ void DeletePropertyStub::Generate() {
 }
 
 
+void GrowElementsStub::Generate() {
+  GeneratePrologue();
+
+  // eax <- array
+  // ebx <- key
+  // ecx <- value
+  //
+  RuntimeGrowElementsCallback grow = &RuntimeGrowElements;
+
+  __ Pushad();
+
+  // RuntimeGrowElements(heap, array, key, value)
+  __ mov(edi, Immediate(reinterpret_cast<intptr_t>(masm()->heap())));
+  __ mov(esi, eax);
+  __ mov(edx, ebx);
+  __ mov(eax, Immediate(*reinterpret_cast<intptr_t*>(&grow)));
+
+  __ push(ecx);
+  __ push(edx);
+  __ push(esi);
+  __ push(edi);
+  __ call(eax);
+  __ addlb(esp, Immediate(4 * 4));
+
+  // eax <- 1 if array's fast case could be retried
+  __ Popad(eax);
+
+  GenerateEpilogue();
+}
+
+
 void HashValueStub::Generate() {
   GeneratePrologue();
 
@@ -1291,6 +1528,7 @@ void LoadVarArgStub::Generate() {
 
   // Put argument in array
   __ mov(slot, offset);
+  __ RecordWrite(arr, offset, scratch);
 
   arr_s.Unspill();
 
@@ -1327,7 +1565,7 @@ void StoreVarArgStub::Generate() {
 
   // eax <- varg
   Label loop, not_array, odd_end, r1_nil, r2_nil;
-  Masm::Spill index_s(masm()), map_s(masm()), array_s(masm()), r1(masm());
+  Masm::Spill index_s(masm()), array_s(masm()), r1(masm());
   Masm::Spill stack_s(masm(), stack);
   Operand slot(eax, 0);
 
@@ -1335,9 +1573,8 @@ void StoreVarArgStub::Generate() {
   __ IsNil(varg, NULL, &not_array);
   __ IsHeapObject(Heap::kTagArray, varg, &not_array, NULL);
 
-  Operand qmap(varg, HObject::kMapOffset);
-  __ mov(map, qmap);
-  map_s.SpillReg(map);
+  // NOTE: Lookup may box array's double elements, map is loaded after it
+  Operand qmap(map, HObject::kMapOffset);
 
   // index = sizeof(array)
   Operand qlength(varg, HArray::kLengthOffset);
@@ -1364,7 +1601,8 @@ void StoreVarArgStub::Generate() {
   __ Call(masm()->stubs()->GetLookupPropertyStub());
 
   __ IsNil(eax, NULL, &r1_nil);
-  map_s.Unspill();
+  array_s.Unspill(map);
+  __ mov(map, qmap);
   __ addl(eax, map);
   __ mov(eax, slot);
 
@@ -1389,7 +1627,8 @@ void StoreVarArgStub::Generate() {
   __ Call(masm()->stubs()->GetLookupPropertyStub());
 
   __ IsNil(eax, NULL, &r2_nil);
-  map_s.Unspill();
+  array_s.Unspill(map);
+  __ mov(map, qmap);
   __ addl(eax, map);
   __ mov(eax, slot);
 
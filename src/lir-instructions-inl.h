@@ -155,6 +155,16 @@ inline bool LAccessProperty::HasMonomorphicProperty() {
   return monomorphic_prop_;
 }
 
+
+inline void LAccessProperty::SetSmiKey() {
+  smi_key_ = true;
+}
+
+
+inline bool LAccessProperty::HasSmiKey() {
+  return smi_key_;
+}
+
 }  // namespace internal
 }  // namespace candor
 
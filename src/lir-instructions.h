@@ -293,14 +293,20 @@ class LBranchNumber : public LControlInstruction {
 class LAccessProperty : public LInstruction {
  public:
   explicit LAccessProperty(Type type) : LInstruction(type),
-                                        monomorphic_prop_(false) {
+                                        monomorphic_prop_(false),
+                                        smi_key_(false) {
   }
 
   inline void SetMonomorphicProperty();
   inline bool HasMonomorphicProperty();
 
+  // Key is likely a smi - emit dense array fast path
+  inline void SetSmiKey();
+  inline bool HasSmiKey();
+
  protected:
   bool monomorphic_prop_;
+  bool smi_key_;
   AbsoluteAddress proto_ic, value_offset_ic, invalidate_ic;
 };
 
@@ -800,9 +800,10 @@ void LGen::AllocateSpills() {
 }
 
 
-void LGen::Generate(Masm* masm, SourceMap* map) {
+void LGen::Generate(Masm* masm, SourceMap* map, SafepointMap* safepoints) {
   // +1 for argc
   masm->stack_slots(spill_index_ + 1);
+  masm->safepoints(safepoints);
 
   // Generate all instructions
   HIRBlockList::Item* bhead = blocks_.head();
@@ -818,14 +819,43 @@ void LGen::Generate(Masm* masm, SourceMap* map) {
         map->Push(masm->offset(), instr->hir()->ast()->offset());
       }
       instr->Generate(masm);
+
+      if (safepoints->pending()->length() != 0) {
+        RecordSafepoints(instr, safepoints);
+      }
     }
   }
 
+  masm->safepoints(NULL);
   masm->FinalizeSpills();
   masm->AlignCode();
 }
 
 
+void LGen::RecordSafepoints(LInstruction* instr, SafepointMap* safepoints) {
+  Safepoint* safepoint;
+  while ((safepoint = safepoints->pending()->Shift()) != NULL) {
+    safepoint->spill_count(spill_index_);
+
+    // Spilled values that were defined before the instruction and are
+    // either used by it or live across it
+    for (int i = 0; i < intervals_.length(); i++) {
+      LInterval* interval = intervals_.At(i);
+      if (!interval->is_stackslot() || interval->index() < 0) continue;
+      if (interval->ranges()->length() == 0) continue;
+      if (interval->start() >= instr->id) continue;
+      if (!interval->Covers(instr->id) && interval->UseAt(instr->id) == NULL) {
+        continue;
+      }
+
+      safepoint->SetLive(interval->index());
+    }
+
+    safepoints->queue()->Push(safepoint);
+  }
+}
+
+
 void LGen::Print(PrintBuffer* p, bool extended) {
   // Only for debugging purposes
   if (extended) PrintIntervals(p);
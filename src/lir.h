@@ -48,6 +48,7 @@ class LGap;
 class LRange;
 class LUse;
 class SourceMap;
+class SafepointMap;
 typedef SortableList<LInterval, NopPolicy, ZonePolicy> LIntervalList;
 typedef SortableList<LRange, NopPolicy, ZonePolicy> LRangeList;
 typedef SortableList<LUse, NopPolicy, ZonePolicy> LUseList;
@@ -219,7 +220,8 @@ class LGen : public ZoneObject {
  public:
   LGen(HIRGen* hir, const char* filename, HIRBlock* root);
 
-  void Generate(Masm* masm, SourceMap* map);
+  void Generate(Masm* masm, SourceMap* map, SafepointMap* safepoints);
+  void RecordSafepoints(LInstruction* instr, SafepointMap* safepoints);
 
   void FlattenBlocks(HIRBlock* root);
   void GenerateInstructions();
@@ -36,6 +36,7 @@ namespace internal {
 // Forward declaration
 class BaseStub;
 class LUse;
+class SafepointMap;
 
 class Masm : public Assembler {
  public:
@@ -82,6 +83,10 @@ class Masm : public Assembler {
   void AllocateSpills();
   void FinalizeSpills();
 
+  // Same, but spill slots of optimized code aren't filled with nil,
+  // GC finds live ones using safepoints
+  void AllocateOptimizedSpills();
+
   // Skip some bytes to make code aligned
   void AlignCode();
 
@@ -89,12 +94,17 @@ class Masm : public Assembler {
   inline void ChangeAlign(int32_t slots) { align_ += slots; }
 
   // Allocate some space in heap's new space current page
-  // Jmp to runtime_allocate label on exhaust or fail
+  // (objects of constant size are bump-allocated inline,
+  // AllocateStub is called only when page is exhausted)
   void Allocate(Heap::HeapTag tag,
                 Register size_reg,
                 uint32_t size,
                 Register result);
 
+  // Bump new space's top by `size` bytes (tag included) and put old top
+  // into `result`, jmp to `runtime` on exhaust. Tag isn't written.
+  void AllocateInline(uint32_t size, Register result, Label* runtime);
+
   // Allocate context and function
   void AllocateContext(uint32_t slots);
 
@@ -107,11 +117,16 @@ class Masm : public Assembler {
                              Register size,
                              Register result);
 
+  // Same, but for literal with allocation site: object, site's memento and
+  // map are allocated with a single bump, or in runtime if site is tenured
+  // (may clobber any register but `result`)
+  void AllocateObjectLiteral(AllocationSite* site, Register result);
+
   // Fills memory segment with immediate value
   void Fill(Register start, Register end, Immediate value);
 
-  // Fill stack slots with nil
-  void FillStackSlots();
+  // Fill stack slots below `offset` bytes from frame pointer with nil
+  void FillStackSlots(uint32_t offset);
 
   // Generate enter/exit frame sequences
   void EnterFramePrologue();
@@ -125,6 +140,14 @@ class Masm : public Assembler {
   // Perform garbage collection if needed (heap flag is set)
   void CheckGC();
 
+  // Remember `host` if it's tenured and `value` is in new space,
+  // `slot` is the stored address (large maps remember only its card) or
+  // `reg_nil` for hosts that can't be large (contexts)
+  void RecordWrite(Register host, Register value, Register slot);
+
+  // Grey value that is about to be overwritten in `slot` (if marking)
+  void MarkingBarrier(const Operand& slot);
+
   void IsNil(Register reference, Label* not_nil, Label* is_nil);
   void IsUnboxed(Register reference, Label* not_unboxed, Label* unboxed);
 
@@ -136,6 +159,20 @@ class Masm : public Assembler {
   void IsTrue(Register reference, Label* is_false, Label* is_true);
   void IsDenseArray(Register reference, Label* non_dense, Label* dense);
 
+  // Address of dense array's element slot in `result`, jumps to `slow` if
+  // `array` isn't a dense array, `key` isn't a non-negative smi or is out
+  // of map's bounds (clobbers scratch)
+  void DenseArrayElement(Register array,
+                         Register key,
+                         Register result,
+                         Label* slow);
+
+  // Same as above, but for array with unboxed double elements
+  void DoubleArrayElement(Register array,
+                          Register key,
+                          Register result,
+                          Label* slow);
+
   // Generic move, LIR augmentation
   void Move(LUse* dst, LUse* src);
   void Move(LUse* dst, Register src);
@@ -171,6 +208,10 @@ class Masm : public Assembler {
     spill_offset_ = (1 + stack_slots) * HValue::kPointerSize;
   }
 
+  // Record safepoint for every call (only in optimized code)
+  inline SafepointMap* safepoints() { return safepoints_; }
+  inline void safepoints(SafepointMap* safepoints) { safepoints_ = safepoints; }
+
  protected:
   CodeSpace* space_;
 
@@ -181,9 +222,14 @@ class Masm : public Assembler {
   int32_t spill_index_;
   int32_t spills_;
 
+  // Reserve space for spills, size is known only after code generation
+  void ReserveSpills();
+
   // Temporary operand
   Operand spill_operand_;
 
+  SafepointMap* safepoints_;
+
   friend class Align;
 };
 
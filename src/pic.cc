@@ -35,14 +35,18 @@ namespace internal {
 
 PIC::PIC(CodeSpace* space) : space_(space),
                              chunk_(NULL),
-                             protos_(NULL),
+                             inline_shape_(0),
+                             inline_result_(0),
+                             shapes_(NULL),
+                             transitions_(NULL),
                              results_(NULL),
                              size_(0) {
 }
 
 
 PIC::~PIC() {
-  delete[] protos_;
+  delete[] shapes_;
+  delete[] transitions_;
   delete[] results_;
   chunk_ = NULL;
 }
@@ -54,31 +58,41 @@ char* PIC::Generate() {
 
   Generate(&masm);
 
-  if (chunk_ != NULL) chunk_->Unref();
+  // Miss() returns into the previous code, release it only after creating
+  // the new chunk, so CreateChunk() won't unmap its page under our feet
+  CodeChunk* previous = chunk_;
   chunk_ = space_->CreateChunk("__pic__", "", 0);
   space_->Put(chunk_, &masm);
+  if (previous != NULL) previous->Unref();
 
-  // At this stage protos_ and results_ should contain offsets,
-  // get real addresses for them and reference protos in heap
-  for (int i = 0; i < size_; i++) {
-    proto_offsets_[i] = reinterpret_cast<char**>(
-        chunk_->addr() + reinterpret_cast<intptr_t>(proto_offsets_[i]));
+  return chunk_->addr();
+}
 
-    space_->heap()->Reference(Heap::kRefWeak,
-                              reinterpret_cast<HValue**>(proto_offsets_[i]),
-                              reinterpret_cast<HValue*>(*proto_offsets_[i]));
-  }
 
+char* PIC::addr() {
   return chunk_->addr();
 }
 
 
-void PIC::Miss(PIC* pic, char* object, intptr_t result, char* ip) {
-  pic->Miss(object, result, ip);
+void PIC::MarkShapes() {
+  // NOTE: Inline cache's shape is always cached by PIC too
+  for (int i = 0; i < size_; i++) {
+    shapes_[i]->Mark();
+    if (transitions_[i] != NULL) transitions_[i]->Mark();
+  }
+}
+
+
+void PIC::Miss(PIC* pic,
+               char* object,
+               intptr_t result,
+               char* ip,
+               Shape* shape) {
+  pic->Miss(object, result, ip, shape);
 }
 
 
-void PIC::Miss(char* object, intptr_t result, char* ip) {
+void PIC::Miss(char* object, intptr_t result, char* ip, Shape* shape) {
   Heap::HeapTag tag = HValue::GetTag(object);
   if (tag != Heap::kTagObject) return;
 
@@ -94,13 +108,32 @@ void PIC::Miss(char* object, intptr_t result, char* ip) {
 
   if (call_ip == NULL) return;
 
-  // Sign extend const
-  intptr_t disabled = ~Heap::kICDisabledValue;
-  disabled = ~disabled;
+  // Objects in dictionary mode can't be cached
+  Shape* current = HValue::As<HObject>(object)->shape();
+  if (shape == NULL || current == NULL) return;
+
+  // Key was added to the object: cache transition if it was a simple one,
+  // otherwise (i.e. object was grown) just cache the lookup in a new shape
+  Shape* transition = NULL;
+  if (current != shape) {
+    if (current->parent() == shape) {
+      transition = current;
+    } else {
+      shape = current;
+    }
+  }
 
-  char* proto = HValue::As<HObject>(object)->proto();
-  if ((reinterpret_cast<intptr_t>(proto) == disabled)) {
-    return;
+  // Shape is already cached
+  for (int i = 0; i < size_; i++) {
+    if (shapes_[i] == shape) return;
+  }
+
+  // Monomorphic state: patch inline cache at call site, transitions are
+  // handled only by PIC
+  if (size_ == 0 && transition == NULL && inline_shape_ != 0) {
+    char* call = reinterpret_cast<char*>(call_ip);
+    *reinterpret_cast<intptr_t*>(call - inline_result_) = result;
+    *reinterpret_cast<Shape**>(call - inline_shape_) = shape;
   }
 
   // Patch call site and remove call to PIC
@@ -109,24 +142,17 @@ void PIC::Miss(char* object, intptr_t result, char* ip) {
     return;
   }
 
-  // Lazily allocate memory for protos and results
+  // Lazily allocate memory for shapes, transitions and results
   if (size_ == 0) {
-    protos_ = new char*[kMaxSize];
+    shapes_ = new Shape*[kMaxSize];
+    transitions_ = new Shape*[kMaxSize];
     results_ = new intptr_t[kMaxSize];
   }
 
-  protos_[size_] = proto;
+  // NOTE: Shapes aren't moved by GC and aren't freed while cached here
+  shapes_[size_] = shape;
+  transitions_[size_] = transition;
   results_[size_] = result;
-  space_->heap()->Reference(Heap::kRefWeak,
-                            reinterpret_cast<HValue**>(&protos_[size_]),
-                            reinterpret_cast<HValue*>(protos_[size_]));
-
-  // Dereference protos in previous version of PIC
-  for (int i = 0; i < size_; i++) {
-    space_->heap()->Dereference(reinterpret_cast<HValue**>(proto_offsets_[i]),
-                                reinterpret_cast<HValue*>(*proto_offsets_[i]));
-  }
-
   size_++;
 
   // Generate new PIC and replace previous one
@@ -33,31 +33,56 @@ namespace internal {
 class CodeSpace;
 class CodeChunk;
 class Masm;
+class Shape;
 
 class PIC {
  public:
   typedef void (*MissCallback)(PIC* pic,
                                char* object,
                                intptr_t result,
-                               char* ip);
+                               char* ip,
+                               Shape* shape);
 
   explicit PIC(CodeSpace* space);
   ~PIC();
 
   char* Generate();
-  static void Miss(PIC* pic, char* object, intptr_t result, char* ip);
+
+  // Emit monomorphic inline cache at call site: shape check and offset load
+  // patched on first miss, with a call to PIC itself as a slow path
+  void GenerateInline(Masm* masm);
+
+  char* addr();
+
+  // Mark cached shapes as used, so GC won't free them
+  void MarkShapes();
+
+  static void Miss(PIC* pic,
+                   char* object,
+                   intptr_t result,
+                   char* ip,
+                   Shape* shape);
 
  protected:
   void Generate(Masm* masm);
 
-  void Miss(char* object, intptr_t result, char* ip);
+  // `shape` is object's shape before lookup, it differs from the current one
+  // if the lookup has inserted a new key
+  void Miss(char* object, intptr_t result, char* ip, Shape* shape);
 
   static const int kMaxSize = 5;
 
   CodeSpace* space_;
   CodeChunk* chunk_;
-  char** protos_;
-  char** proto_offsets_[kMaxSize];
+
+  // Offsets of inline cache's shape and result immediates relative to PIC's
+  // address in the call instruction (0 - no inline cache)
+  intptr_t inline_shape_;
+  intptr_t inline_result_;
+
+  Shape** shapes_;
+  // Shape to transition to after inserting key (or NULL for plain lookup)
+  Shape** transitions_;
   intptr_t* results_;
   int size_;
 };
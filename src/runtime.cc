@@ -30,6 +30,7 @@
 #include <stdio.h>  // snprintf
 #include <sys/types.h>  // size_t
 
+#include "code-space.h"  // CodeSpace
 #include "heap.h"  // Heap
 #include "heap-inl.h"
 #include "utils.h"  // ComputeHash, etc
@@ -72,14 +73,62 @@ BINARY_SUB_TYPES(BINARY_OP_TEMPLATE)
 #undef BINARY_SUB_TYPES
 
 char* RuntimeAllocate(Heap* heap,
-                      uint32_t bytes) {
-  return heap->new_space()->Allocate(bytes);
+                      uint32_t bytes,
+                      uint32_t tag) {
+  // `bytes` are including tag
+  return heap->AllocateTagged(static_cast<Heap::HeapTag>(tag),
+                              Heap::kTenureNew,
+                              bytes - HValue::kPointerSize);
+}
+
+
+char* RuntimeAllocateObject(Heap* heap, AllocationSite* site) {
+  Heap::HeapTag tag = site->tag();
+  Heap::TenureType tenure = site->tenure();
+  char* obj = heap->AllocateTagged(
+      tag,
+      tenure,
+      (tag == Heap::kTagArray ? 4 : 3) * HValue::kPointerSize);
+
+  HObject::Init(heap, obj, site->size(), tenure);
+  if (tag == Heap::kTagArray) HArray::SetLength(obj, 0);
+
+  return obj;
+}
+
+
+void RuntimeCollectGarbage(Heap* heap, char* stack_top, char* frame) {
+  {
+    Zone gc_zone;
+    heap->gc()->CollectGarbage(stack_top, frame);
+  }
+
+  // Heap is over the limit even after full GC - terminate the script
+  if (heap->gc()->out_of_memory()) {
+    heap->gc()->out_of_memory(false);
+    heap->code_space()->Unwind();
+  }
 }
 
 
-void RuntimeCollectGarbage(Heap* heap, char* stack_top) {
-  Zone gc_zone;
-  heap->gc()->CollectGarbage(stack_top);
+void RuntimeRecordWrite(Heap* heap, char* host, char** slot) {
+  // Generated code has already filtered out everything except old->new stores
+  HValue* hhost = HValue::Cast(host);
+  if (Heap::HasCards(hhost)) {
+    // Slot of context stores isn't passed, but contexts have no cards
+    assert(slot != NULL);
+    heap->Cards(hhost)[(reinterpret_cast<char*>(slot) - host) /
+                       Heap::kCardSize] = 1;
+    return;
+  }
+
+  if (hhost->IsRemembered()) return;
+  heap->Remember(hhost);
+}
+
+
+void RuntimeMarkingBarrier(Heap* heap, char* value) {
+  heap->MarkingBarrier(value);
 }
 
 
@@ -130,6 +179,17 @@ intptr_t RuntimeLookupProperty(Heap* heap,
   assert(!HValue::Cast(obj)->IsGCMarked());
   assert(!HValue::Cast(obj)->IsSoftGCMarked());
 
+  if (HValue::GetTag(obj) == Heap::kTagArray) {
+    // Slot of double element can't hold a pointer
+    if (HArray::IsDouble(obj)) RuntimeGenericElements(heap, obj);
+
+    // Any value could be stored into the slot
+    if (insert && HValue::GetRepresentation<HArray::Representation>(obj) ==
+                      HArray::kDenseSmi) {
+      HValue::SetRepresentation<HArray::Representation>(obj, HArray::kDense);
+    }
+  }
+
   char* map = HObject::Map(obj);
   char* space = HValue::As<HMap>(map)->space();
   uint32_t mask = HObject::Mask(obj);
@@ -139,6 +199,7 @@ intptr_t RuntimeLookupProperty(Heap* heap,
   char* keyptr = NULL;
   int64_t numkey = 0;
   uint32_t hash = 0;
+  bool interned = false;
 
   if (is_array) {
     numkey = HNumber::IntegralValue(RuntimeToNumber(heap, key));
@@ -154,17 +215,25 @@ intptr_t RuntimeLookupProperty(Heap* heap,
     }
   } else {
     assert(HValue::GetTag(obj) == Heap::kTagObject);
+
+    // String keys are compared by address
+    if (!HValue::IsUnboxed(key) &&
+        key != HNil::New() &&
+        HValue::GetTag(key) == Heap::kTagString) {
+      key = heap->string_table()->Intern(heap, key);
+      interned = true;
+    }
     keyptr = key;
     hash = RuntimeGetHash(heap, key);
   }
 
   if (is_array && HArray::IsDense(obj)) {
     // Dense arrays use another lookup mechanism
-    uint32_t index = numkey * HValue::kPointerSize;
-
-    if (index > mask) {
+    if (numkey >= HArray::Capacity(obj)) {
       if (insert) {
-        RuntimeGrowObject(heap, obj, numkey);
+        uint32_t min_size = numkey < HArray::kDenseLengthMax ?
+            numkey + 1 : HArray::kDenseLengthMax + 1;
+        RuntimeGrowObject(heap, obj, min_size);
 
         return RuntimeLookupProperty(heap, obj, keyptr, insert);
       } else {
@@ -173,7 +242,7 @@ intptr_t RuntimeLookupProperty(Heap* heap,
       }
     }
 
-    return HMap::kSpaceOffset + (index & mask);
+    return HMap::kSpaceOffset + numkey * HValue::kPointerSize;
   } else {
     // Dive into space and walk it in circular manner
     uint32_t start = hash & mask;
@@ -184,8 +253,11 @@ intptr_t RuntimeLookupProperty(Heap* heap,
     do {
       key_slot = *reinterpret_cast<char**>(space + index);
       if (key_slot == HNil::New() ||
-          (is_array && key_slot == keyptr) ||
-          RuntimeStrictCompare(heap, key_slot, key) == 0) {
+          key_slot == keyptr ||
+          ((!interned ||
+            HValue::IsUnboxed(key_slot) ||
+            !HString::IsInterned(key_slot)) &&
+           RuntimeStrictCompare(heap, key_slot, key) == 0)) {
         needs_grow = false;
         break;
       }
@@ -202,16 +274,34 @@ intptr_t RuntimeLookupProperty(Heap* heap,
         return RuntimeLookupProperty(heap, obj, keyptr, insert);
       }
 
-      if (key_slot == HNil::New()) {
-        // Reset proto, IC could not work with this object anymore
-        char** proto_slot = HObject::ProtoSlot(obj);
-        *reinterpret_cast<intptr_t*>(proto_slot) = Heap::kICDisabledValue;
+      // New key changes object's shape (arrays have none)
+      if (key_slot == HNil::New() && !is_array) {
+        Shape* shape = HObject::GetShape(obj);
+        if (shape != NULL) {
+          HObject::SetShape(obj, shape->Transition(heap, key));
+        }
       }
 
       *reinterpret_cast<char**>(space + index) = keyptr;
+      heap->RecordSlot(map, reinterpret_cast<char**>(space + index));
+    }
+
+    intptr_t offset = HMap::kSpaceOffset + index +
+                      (mask + HValue::kPointerSize);
+
+    // Remember offset of existing string key for megamorphic call sites
+    Shape* shape = is_array ? NULL : HObject::GetShape(obj);
+    if (shape != NULL &&
+        heap != NULL &&
+        !needs_grow &&
+        (insert || key_slot != HNil::New()) &&
+        !HValue::IsUnboxed(key) &&
+        key != HNil::New() &&
+        HValue::GetTag(key) == Heap::kTagString) {
+      heap->stub_cache()->Put(shape, key, offset);
     }
 
-    return HMap::kSpaceOffset + index + (mask + HValue::kPointerSize);
+    return offset;
   }
 }
 
@@ -219,9 +309,38 @@ intptr_t RuntimeLookupProperty(Heap* heap,
 char* RuntimeGrowObject(Heap* heap, char* obj, uint32_t min_size) {
   char** map_addr = HObject::MapSlot(obj);
   HMap* map = HValue::As<HMap>(*map_addr);
-  uint32_t size = map->size() << 1;
+  uint32_t original_size = map->size();
+  uint32_t size = original_size << 1;
 
-  if (min_size > size) {
+  bool is_array = HValue::GetTag(obj) == Heap::kTagArray;
+  bool was_dense = is_array && HArray::IsDense(obj);
+  bool dense = was_dense;
+
+  if (was_dense) {
+    // Both halves of dense array's map are holding elements,
+    // `min_size` is a number of elements to fit
+    uint32_t capacity = original_size << 1;
+    if (min_size > capacity + HArray::kDenseGapMax ||
+        min_size > HArray::kDenseLengthMax) {
+      // Too many holes - switch to sparse mode
+      uint32_t count = 1;
+      for (uint32_t i = 0; i < capacity; i++) {
+        if (!map->IsEmptySlot(i)) count++;
+      }
+      dense = false;
+      size = PowerOfTwo(count << 1);
+    } else if (min_size > (size << 1)) {
+      size = PowerOfTwo(min_size) >> 1;
+    }
+  } else if (is_array) {
+    // Sparse array is full, switch back to dense mode if
+    // at least half of its elements would be present
+    int64_t length = HArray::Length(obj, false);
+    if (length <= (original_size << 1) && length <= HArray::kDenseLengthMax) {
+      dense = true;
+      size = PowerOfTwo(length) >> 1;
+    }
+  } else if (min_size > size) {
     size = PowerOfTwo(min_size);
   }
 
@@ -229,15 +348,37 @@ char* RuntimeGrowObject(Heap* heap, char* obj, uint32_t min_size) {
   char* new_map = HMap::NewEmpty(heap, size);
 
   // Replace old map with a new
+  heap->MarkingBarrier(*map_addr);
   *map_addr = new_map;
+  heap->RecordWrite(obj, new_map);
 
   // Update mask
-  uint32_t mask = (size - 1) * HValue::kPointerSize;
+  uint32_t mask = dense ? HArray::DenseMask(size) :
+                          (size - 1) * HValue::kPointerSize;
   *HObject::MaskSlot(obj) = mask;
 
+  // Smi-only array stays so while growing
+  if (is_array && (!was_dense || !dense ||
+      HValue::GetRepresentation<HArray::Representation>(obj) !=
+          HArray::kDenseSmi)) {
+    HValue::SetRepresentation<HArray::Representation>(
+        obj,
+        dense ? HArray::kDense : HArray::kSparse);
+  }
+
+  // Keys are added to the empty map again in the same order, so all objects
+  // of the old shape will arrive to the same new shape
+  if (HObject::GetShape(obj) != NULL) {
+    HObject::SetShape(obj, heap->RootShape(size));
+  }
+
   // And rehash properties to new map
-  uint32_t original_size = map->size();
-  if (HValue::GetTag(obj) == Heap::kTagArray && HArray::IsDense(obj)) {
+  if (was_dense && dense) {
+    // Elements are staying in the same slots
+    memcpy(HValue::As<HMap>(new_map)->space(),
+           map->space(),
+           (original_size << 1) * HValue::kPointerSize);
+  } else if (was_dense) {
     // Dense array's map doesn't contain key pointers, iterate values
     original_size = original_size << 1;
     for (uint32_t i = 0; i < original_size; i++) {
@@ -262,6 +403,129 @@ char* RuntimeGrowObject(Heap* heap, char* obj, uint32_t min_size) {
 }
 
 
+intptr_t RuntimeGrowElements(Heap* heap,
+                             char* obj,
+                             char* key,
+                             char* value) {
+  assert(HValue::GetTag(obj) == Heap::kTagArray);
+  assert(HValue::IsUnboxed(key));
+
+  HArray::Representation repr =
+      HValue::GetRepresentation<HArray::Representation>(obj);
+  if (repr == HArray::kSparse) return 0;
+
+  bool is_nil = value == HNil::New();
+  bool is_smi = HValue::IsUnboxed(value);
+  bool is_number = is_smi ||
+                   (!is_nil && HValue::GetTag(value) == Heap::kTagNumber);
+
+  if (repr == HArray::kDenseDouble) {
+    if (is_number || is_nil) return RuntimeDoubleElements(heap, obj, key);
+
+    RuntimeGenericElements(heap, obj);
+  } else if (repr == HArray::kDenseSmi && !is_smi && !is_nil) {
+    if (is_number) return RuntimeDoubleElements(heap, obj, key);
+
+    HValue::SetRepresentation<HArray::Representation>(obj, HArray::kDense);
+  }
+
+  int64_t index = HNumber::Untag(reinterpret_cast<int64_t>(key));
+  if (index >= HArray::Capacity(obj)) {
+    uint32_t min_size = index < HArray::kDenseLengthMax ?
+        index + 1 : HArray::kDenseLengthMax + 1;
+    RuntimeGrowObject(heap, obj, min_size);
+  }
+
+  return HArray::IsDense(obj) ? 1 : 0;
+}
+
+
+intptr_t RuntimeDoubleElements(Heap* heap, char* obj, char* key) {
+  HArray::Representation repr =
+      HValue::GetRepresentation<HArray::Representation>(obj);
+  assert(repr == HArray::kDenseSmi || repr == HArray::kDenseDouble);
+  assert(HValue::IsUnboxed(key));
+
+  int64_t index = HNumber::Untag(reinterpret_cast<int64_t>(key));
+  uint32_t capacity = HArray::Capacity(obj);
+  if (index >= capacity + HArray::kDenseGapMax ||
+      index >= HArray::kDenseLengthMax) {
+    return 0;
+  }
+
+  uint32_t new_capacity = capacity;
+  if (index >= capacity) {
+    new_capacity = PowerOfTwo(index + 1);
+    if (new_capacity < (capacity << 1)) new_capacity = capacity << 1;
+  }
+  if (repr == HArray::kDenseDouble && new_capacity == capacity) return 1;
+
+  char* store = HCData::New(heap, new_capacity * HNumber::kDoubleSize);
+  double* elements = reinterpret_cast<double*>(HCData::Data(store));
+
+  if (repr == HArray::kDenseDouble) {
+    memcpy(elements,
+           HArray::DoubleElements(obj),
+           capacity * HNumber::kDoubleSize);
+  } else {
+    HMap* map = HValue::As<HMap>(HObject::Map(obj));
+    for (uint32_t i = 0; i < capacity; i++) {
+      char* value = *map->GetSlotAddress(i);
+      if (value == HNil::New()) {
+        HArray::SetDoubleHole(&elements[i]);
+      } else if (HValue::IsUnboxed(value)) {
+        elements[i] = HNumber::DoubleValue(value);
+      } else {
+        // Generic value has got here through the runtime, which doesn't know
+        // what is stored into the slot
+        HValue::SetRepresentation<HArray::Representation>(obj, HArray::kDense);
+        return 0;
+      }
+    }
+  }
+  for (uint32_t i = capacity; i < new_capacity; i++) {
+    HArray::SetDoubleHole(&elements[i]);
+  }
+
+  char** map_addr = HObject::MapSlot(obj);
+  heap->MarkingBarrier(*map_addr);
+  *map_addr = store;
+  heap->RecordWrite(obj, store);
+
+  *HObject::MaskSlot(obj) = HArray::DoubleMask(new_capacity);
+  HValue::SetRepresentation<HArray::Representation>(obj,
+                                                    HArray::kDenseDouble);
+
+  return 1;
+}
+
+
+void RuntimeGenericElements(Heap* heap, char* obj) {
+  uint32_t capacity = HArray::Capacity(obj);
+  double* elements = HArray::DoubleElements(obj);
+
+  // Both halves of dense map are holding elements
+  char* map = HMap::NewEmpty(heap, capacity >> 1);
+
+  // NOTE: Numbers are allocated in new space and won't move until the next
+  // collection, so `elements` stays valid
+  for (uint32_t i = 0; i < capacity; i++) {
+    if (HArray::IsDoubleHole(&elements[i])) continue;
+
+    *HValue::As<HMap>(map)->GetSlotAddress(i) =
+        HNumber::New(heap, Heap::kTenureNew, elements[i]);
+  }
+
+  char** map_addr = HObject::MapSlot(obj);
+  heap->MarkingBarrier(*map_addr);
+  *map_addr = map;
+  heap->RecordWrite(obj, map);
+
+  *HObject::MaskSlot(obj) = HArray::DenseMask(capacity >> 1);
+  HValue::SetRepresentation<HArray::Representation>(obj, HArray::kDense);
+}
+
+
 char* RuntimeToString(Heap* heap, char* value) {
   Heap::HeapTag tag = HValue::GetTag(value);
 
@@ -381,6 +645,8 @@ intptr_t RuntimeStrictCompare(Heap* heap, char* lhs, char* rhs) {
 
   switch (tag) {
     case Heap::kTagString:
+      // Interned strings are different if their addresses are
+      if (HString::IsInterned(lhs) && HString::IsInterned(rhs)) return -1;
       return RuntimeStringCompare(heap, lhs, rhs);
     case Heap::kTagFunction:
     case Heap::kTagObject:
@@ -426,6 +692,14 @@ char* RuntimeConcatenateStrings(Heap* heap,
            HString::Value(heap, lhs), lhs_length);
     memcpy(HString::Value(heap, result) + lhs_length,
            HString::Value(heap, rhs), rhs_length);
+  } else if (HString::IsFlatCons(lhs) ||
+             (HString::Depth(lhs) >= HString::kMaxConsDepth &&
+              HString::Depth(HString::LeftCons(lhs)) + 1 ==
+                  HString::Depth(lhs) &&
+              !HString::IsForked(lhs))) {
+    // Flattened string or a long chain of `a = a + x` is appended to -
+    // collapse it into string builder instead of growing cons tree
+    result = HString::Append(heap, lhs, rhs);
   } else {
     result = HString::NewCons(heap,
                               Heap::kTenureNew,
@@ -693,18 +967,39 @@ char* RuntimeKeysof(Heap* heap, char* value) {
   // Fast-case - return empty array
   if (tag != Heap::kTagArray && tag != Heap::kTagObject) return result;
 
+  uint32_t index = 0;
+
+  // Double elements are kept out of map
+  if (tag == Heap::kTagArray && HArray::IsDouble(value)) {
+    double* elements = HArray::DoubleElements(value);
+    uint32_t capacity = HArray::Capacity(value);
+    for (uint32_t i = 0; i < capacity; i++) {
+      if (HArray::IsDoubleHole(&elements[i])) continue;
+
+      char** slot = HObject::LookupProperty(heap,
+                                            result,
+                                            HNumber::ToPointer(index),
+                                            1);
+      *slot = HNumber::ToPointer(i);
+      index++;
+    }
+
+    return result;
+  }
+
   // Slow-case visit all map's slots and put them into array
   HMap* map = HValue::As<HMap>(HObject::Map(value));
 
-  uint32_t size = map->size();
-  uint32_t index = 0;
+  // Dense array's keys are indexes of non-empty slots
+  bool dense = tag == Heap::kTagArray && HArray::IsDense(value);
+  uint32_t size = dense ? HArray::Capacity(value) : map->size();
   for (uint32_t i = 0; i < size; i++) {
     if (map->GetSlot(i) != HValue::Cast(HNil::New())) {
       char** slot = HObject::LookupProperty(heap,
                                             result,
                                             HNumber::ToPointer(index),
                                             1);
-      *slot = map->GetSlot(i)->addr();
+      *slot = dense ? HNumber::ToPointer(i) : map->GetSlot(i)->addr();
       index++;
     }
   }
@@ -722,7 +1017,7 @@ char* RuntimeCloneObject(Heap* heap, char* obj) {
 
   char* result = heap->AllocateTagged(Heap::kTagObject,
                                       Heap::kTenureNew,
-                                      2 * HValue::kPointerSize);
+                                      3 * HValue::kPointerSize);
 
   char* map = heap->AllocateTagged(
       Heap::kTagMap,
@@ -736,8 +1031,9 @@ char* RuntimeCloneObject(Heap* heap, char* obj) {
   // Set map
   *reinterpret_cast<char**>(result + HObject::kMapOffset) = map;
 
-  // Set map's proto
-  *reinterpret_cast<void**>(obj + HObject::kProtoOffset) = source_map;
+  // Same keys in the same slots
+  HObject::SetShape(result,
+                    tag == Heap::kTagObject ? source_obj->shape() : NULL);
 
   // Set map's size
   *reinterpret_cast<intptr_t*>(map + HMap::kSizeOffset) = source_map->size();
@@ -756,19 +1052,25 @@ void RuntimeDeleteProperty(Heap* heap, char* obj, char* property) {
 
   intptr_t offset = RuntimeLookupProperty(heap, obj, property, 0);
 
-  // Reset proto, IC could not work with this object anymore
-  char** proto_slot = HObject::ProtoSlot(obj);
-  *reinterpret_cast<intptr_t*>(proto_slot) = Heap::kICDisabledValue;
+  // Nothing to delete beyond dense array's end
+  if (offset == Heap::kTagNil) return;
+
+  // Switch to dictionary mode, IC could not work with this object anymore
+  HObject::SetShape(obj, NULL);
 
   // Dense arrays doesn't have keys
   if (HValue::GetTag(obj) != Heap::kTagArray || !HArray::IsDense(obj)) {
     // Nil property
     intptr_t keyoffset = offset - HObject::Mask(obj) - HValue::kPointerSize;
-    *reinterpret_cast<intptr_t*>(HObject::Map(obj) + keyoffset) = Heap::kTagNil;
+    char** keyslot = reinterpret_cast<char**>(HObject::Map(obj) + keyoffset);
+    heap->MarkingBarrier(*keyslot);
+    *reinterpret_cast<intptr_t*>(keyslot) = Heap::kTagNil;
   }
 
   // Nil value
-  *reinterpret_cast<intptr_t*>(HObject::Map(obj) + offset) = Heap::kTagNil;
+  char** slot = reinterpret_cast<char**>(HObject::Map(obj) + offset);
+  heap->MarkingBarrier(*slot);
+  *reinterpret_cast<intptr_t*>(slot) = Heap::kTagNil;
 }
 
 
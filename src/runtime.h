@@ -34,13 +34,32 @@
 namespace candor {
 namespace internal {
 
-// Wrapper for heap()->new_space()->Allocate()
+// Wrapper for heap()->AllocateTagged(), large objects are going to
+// large object space
 typedef char* (*RuntimeAllocateCallback)(Heap* heap,
-                                         uint32_t bytes);
-char* RuntimeAllocate(Heap* heap, uint32_t bytes);
-
-typedef void (*RuntimeCollectGarbageCallback)(Heap* heap, char* stack_top);
-void RuntimeCollectGarbage(Heap* heap, char* stack_top);
+                                         uint32_t bytes,
+                                         uint32_t tag);
+char* RuntimeAllocate(Heap* heap, uint32_t bytes, uint32_t tag);
+
+// Slow part of literal allocation in optimized code, object and its map are
+// allocated in the space chosen by allocation site
+typedef char* (*RuntimeAllocateObjectCallback)(Heap* heap,
+                                               AllocationSite* site);
+char* RuntimeAllocateObject(Heap* heap, AllocationSite* site);
+
+typedef void (*RuntimeCollectGarbageCallback)(Heap* heap,
+                                              char* stack_top,
+                                              char* frame);
+void RuntimeCollectGarbage(Heap* heap, char* stack_top, char* frame);
+
+// Slow part of the write barrier, adds `host` to the remembered set
+typedef void (*RuntimeRecordWriteCallback)(Heap* heap,
+                                           char* host,
+                                           char** slot);
+void RuntimeRecordWrite(Heap* heap, char* host, char** slot);
+
+typedef void (*RuntimeMarkingBarrierCallback)(Heap* heap, char* value);
+void RuntimeMarkingBarrier(Heap* heap, char* value);
 
 typedef intptr_t (*RuntimeGetHashCallback)(Heap* heap, char* value);
 intptr_t RuntimeGetHash(Heap* heap, char* value);
@@ -61,6 +80,24 @@ typedef char* (*RuntimeGrowObjectCallback)(Heap* heap,
                                            uint32_t min_size);
 char* RuntimeGrowObject(Heap* heap, char* obj, uint32_t min_size);
 
+// Converts or grows dense array's elements so `value` could be stored at
+// `key` without calling runtime, returns 0 if it couldn't be done
+typedef intptr_t (*RuntimeGrowElementsCallback)(Heap* heap,
+                                                char* obj,
+                                                char* key,
+                                                char* value);
+intptr_t RuntimeGrowElements(Heap* heap, char* obj, char* key, char* value);
+
+// Converts smi-only array to double elements and grows them to fit `key`,
+// returns 0 if array should stay generic
+typedef intptr_t (*RuntimeDoubleElementsCallback)(Heap* heap,
+                                                  char* obj,
+                                                  char* key);
+intptr_t RuntimeDoubleElements(Heap* heap, char* obj, char* key);
+
+// Boxes array's double elements, so it could hold any value
+void RuntimeGenericElements(Heap* heap, char* obj);
+
 typedef char* (*RuntimeCoerceCallback)(Heap* heap, char* value);
 char* RuntimeToString(Heap* heap, char* value);
 char* RuntimeToNumber(Heap* heap, char* value);
@@ -61,5 +61,30 @@ SourceInfo* SourceMap::Get(char* addr) {
   return SourceMapBase::Find(NumberKey::New(addr_o));
 }
 
+
+void SafepointMap::Push(const uint32_t jit_offset) {
+  pending()->Push(new Safepoint(jit_offset));
+}
+
+
+void SafepointMap::Commit(char* addr) {
+  Safepoint* safepoint;
+  while ((safepoint = queue()->Shift()) != NULL) {
+    safepoint->addr(addr + safepoint->jit_offset());
+
+    SafepointMapBase::Insert(NumberKey::New(safepoint->addr()), safepoint);
+  }
+}
+
+
+Safepoint* SafepointMap::Get(char* addr) {
+  Safepoint* safepoint = SafepointMapBase::Find(NumberKey::New(addr));
+
+  // Find() returns closest item below `addr`
+  if (safepoint == NULL || safepoint->addr() != addr) return NULL;
+
+  return safepoint;
+}
+
 }  // namespace internal
 }  // namespace candor
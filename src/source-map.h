@@ -31,9 +31,12 @@ namespace internal {
 
 // Forward declaration
 class SourceInfo;
+class Safepoint;
 
 typedef SplayTree<NumberKey, SourceInfo, DeletePolicy<SourceInfo*>, EmptyClass>
     SourceMapBase;
+typedef SplayTree<NumberKey, Safepoint, DeletePolicy<Safepoint*>, EmptyClass>
+    SafepointMapBase;
 
 class SourceMap : SourceMapBase {
  public:
@@ -84,6 +87,57 @@ class SourceInfo {
   const uint32_t jit_offset_;
 };
 
+// Stack maps of optimized code, keyed by return addresses of its calls
+class SafepointMap : SafepointMapBase {
+ public:
+  typedef List<Safepoint*, EmptyClass> SafepointQueue;
+
+  SafepointMap() {
+  }
+
+  // Called by Masm for every call emitted in optimized code,
+  // live slots are set by LGen once instruction is generated
+  void Push(const uint32_t jit_offset);
+  void Commit(char* addr);
+
+  // Returns NULL if `addr` isn't a return address of optimized code
+  Safepoint* Get(char* addr);
+
+  inline SafepointQueue* pending() { return &pending_; }
+  inline SafepointQueue* queue() { return &queue_; }
+
+ private:
+  SafepointQueue pending_;
+  SafepointQueue queue_;
+};
+
+// Spill slots holding live values at some call site of optimized code,
+// other spill slots of the frame contain garbage
+class Safepoint {
+ public:
+  explicit Safepoint(const uint32_t jit_offset) : addr_(NULL),
+                                                  jit_offset_(jit_offset),
+                                                  spill_count_(0),
+                                                  live_(0) {
+  }
+
+  inline char* addr() { return addr_; }
+  inline void addr(char* addr) { addr_ = addr; }
+  inline uint32_t jit_offset() { return jit_offset_; }
+
+  inline int spill_count() { return spill_count_; }
+  inline void spill_count(int spill_count) { spill_count_ = spill_count; }
+
+  inline void SetLive(int index) { live_.Set(index); }
+  inline bool IsLive(int index) { return live_.Test(index); }
+
+ private:
+  char* addr_;
+  const uint32_t jit_offset_;
+  int spill_count_;
+  BitField<EmptyClass> live_;
+};
+
 }  // namespace internal
 }  // namespace candor
 
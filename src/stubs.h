@@ -39,9 +39,12 @@ namespace internal {
     V(Entry)\
     V(Allocate)\
     V(AllocateObject)\
+    V(AllocateSiteObject)\
     V(AllocateFunction)\
     V(CallBinding)\
     V(CollectGarbage)\
+    V(RecordWrite)\
+    V(MarkingBarrier)\
     V(Throw)\
     V(Typeof)\
     V(Sizeof)\
@@ -51,6 +54,7 @@ namespace internal {
     V(CoerceToBoolean)\
     V(CloneObject)\
     V(DeleteProperty)\
+    V(GrowElements)\
     V(HashValue)\
     V(StackTrace)\
     V(LoadVarArg)\
@@ -30,6 +30,7 @@
 #include <string.h>  // strncmp, memset
 #include <unistd.h>  // sysconf or getpagesize, intptr_t
 #include <assert.h>  // assert
+#include <sys/time.h>  // gettimeofday
 
 namespace candor {
 namespace internal {
@@ -933,6 +934,15 @@ inline uint32_t GetPageSize() {
 #endif
 }
 
+
+// Current time in microseconds
+inline uint64_t GetTimeUs() {
+  timeval tv;
+  gettimeofday(&tv, NULL);
+
+  return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
 }  // namespace internal
 }  // namespace candor
 
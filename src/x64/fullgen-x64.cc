@@ -124,17 +124,19 @@ void FStoreContext::Generate(Masm* masm) {
   // Global can't be replaced
   if (depth == -1) return;
 
-  __ mov(scratch, context_reg);
+  __ mov(rbx, context_reg);
 
   // Lookup context
   while (--depth >= 0) {
-    Operand parent(scratch, HContext::kParentOffset);
-    __ mov(scratch, parent);
+    Operand parent(rbx, HContext::kParentOffset);
+    __ mov(rbx, parent);
   }
 
-  Operand res(scratch, HContext::GetIndexDisp(inputs[0]->index()));
+  Operand res(rbx, HContext::GetIndexDisp(inputs[0]->index()));
+  __ MarkingBarrier(res);
   __ mov(rax, *inputs[1]->ToOperand());
   __ mov(res, rax);
+  __ RecordWrite(rbx, rax, reg_nil);
 }
 
 
@@ -189,7 +191,9 @@ void FStoreProperty::Generate(Masm* masm) {
   __ addq(rax, rbx);
 
   Operand slot(rax, 0);
+  __ MarkingBarrier(slot);
   __ mov(slot, rcx);
+  __ RecordWrite(rbx, rcx, rax);
 
   __ bind(&done);
 }
@@ -229,6 +233,8 @@ void FDeleteProperty::Generate(Masm* masm) {
 
 
 void FAllocateObject::Generate(Masm* masm) {
+  Shape* shape = masm->heap()->RootShape(size_);
+  __ mov(rdx, Immediate(reinterpret_cast<intptr_t>(shape)));
   __ push(Immediate(HNumber::Tag(size_)));
   __ pushb(Immediate(HNumber::Tag(Heap::kTagObject)));
   __ Call(masm->stubs()->GetAllocateObjectStub());
@@ -237,6 +243,8 @@ void FAllocateObject::Generate(Masm* masm) {
 
 
 void FAllocateArray::Generate(Masm* masm) {
+  // Arrays are always in dictionary mode
+  __ xorq(rdx, rdx);
   __ push(Immediate(HNumber::Tag(size_)));
   __ pushb(Immediate(HNumber::Tag(Heap::kTagArray)));
   __ Call(masm->stubs()->GetAllocateObjectStub());
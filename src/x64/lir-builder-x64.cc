@@ -78,8 +78,7 @@ void LGen::VisitFunction(HIRInstruction* instr) {
   HIRFunction* fn = HIRFunction::Cast(instr);
 
   LInstruction* op = Bind(new LFunction(fn->ast()->label(), fn->arg_count))
-      ->MarkHasCall()
-      ->AddScratch(CreateVirtual());
+      ->MarkHasCall();
 
   ResultFromFixed(op, rax);
 }
@@ -184,7 +183,13 @@ void LGen::VisitLoadProperty(HIRInstruction* instr) {
       ->AddArg(lhs, LUse::kRegister)
       ->AddArg(rhs, LUse::kRegister);
 
-  if (instr->right()->Is(HIRInstruction::kLiteral)) {
+  // Numeric keys are used with arrays, which can't be cached by PIC
+  // (loop variables have unknown representation at this point)
+  if (instr->right()->IsSmi() ||
+      instr->right()->representation() ==
+          HIRInstruction::kUnknownRepresentation) {
+    load->SetSmiKey();
+  } else if (instr->right()->Is(HIRInstruction::kLiteral)) {
     load->SetMonomorphicProperty();
   }
 
@@ -202,7 +207,13 @@ void LGen::VisitStoreProperty(HIRInstruction* instr) {
       ->AddArg(lhs, LUse::kRegister)
       ->AddArg(rhs, LUse::kRegister);
 
-  if (instr->right()->Is(HIRInstruction::kLiteral)) {
+  // Numeric keys are used with arrays, which can't be cached by PIC
+  // (loop variables have unknown representation at this point)
+  if (instr->right()->IsSmi() ||
+      instr->right()->representation() ==
+          HIRInstruction::kUnknownRepresentation) {
+    store->SetSmiKey();
+  } else if (instr->right()->Is(HIRInstruction::kLiteral)) {
     store->SetMonomorphicProperty();
   }
 }
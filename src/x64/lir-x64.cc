@@ -27,6 +27,7 @@
 #include "lir-instructions.h"
 #include "lir-instructions-inl.h"
 #include "macroassembler.h"
+#include "pic.h"
 #include "stubs.h"  // Stubs
 
 namespace candor {
@@ -59,7 +60,7 @@ void LEntry::Generate(Masm* masm) {
   __ mov(rbp, rsp);
 
   // Allocate spills
-  __ AllocateSpills();
+  __ AllocateOptimizedSpills();
 
   // Save argc
   Operand argc(rbp, -HValue::kPointerSize * 2);
@@ -130,16 +131,16 @@ void LLiteral::Generate(Masm* masm) {
 
 
 void LAllocateObject::Generate(Masm* masm) {
-  __ push(Immediate(HNumber::Tag(size_)));
-  __ pushb(Immediate(HNumber::Tag(Heap::kTagObject)));
-  __ Call(masm->stubs()->GetAllocateObjectStub());
+  AllocationSite* site = masm->heap()->CreateAllocationSite(Heap::kTagObject,
+                                                            size_);
+  __ AllocateObjectLiteral(site, rax);
 }
 
 
 void LAllocateArray::Generate(Masm* masm) {
-  __ push(Immediate(HNumber::Tag(size_)));
-  __ pushb(Immediate(HNumber::Tag(Heap::kTagArray)));
-  __ Call(masm->stubs()->GetAllocateObjectStub());
+  AllocationSite* site = masm->heap()->CreateAllocationSite(Heap::kTagArray,
+                                                            size_);
+  __ AllocateObjectLiteral(site, rax);
 }
 
 
@@ -180,15 +181,47 @@ void LBranchNumber::Generate(Masm* masm) {
 }
 
 
+// Both halves of double array's hole
+static const uint64_t kDoubleHole =
+    (static_cast<uint64_t>(HArray::kDoubleHoleHalf) << 32) |
+    HArray::kDoubleHoleHalf;
+
+
 void LLoadProperty::Generate(Masm* masm) {
-  Label done;
+  Label done, slow;
   Masm::Spill rax_s(masm, rax);
 
   // rax <- object
   // rbx <- propery
+  if (HasSmiKey()) {
+    Label doubles, hole;
+
+    // Fast case: dense array's element
+    __ DenseArrayElement(rax, rbx, rdx, &doubles);
+    Operand element(rdx, 0);
+    __ mov(rax, element);
+    __ jmp(&done);
+
+    // Fast case: double array's element, boxed on load
+    __ bind(&doubles);
+    __ DoubleArrayElement(rax, rbx, rdx, &slow);
+    __ mov(scratch, Immediate(kDoubleHole));
+    __ cmpq(scratch, element);
+    __ jmp(kEq, &hole);
+    __ movd(xmm1, element);
+    __ AllocateNumber(xmm1, rax);
+    __ jmp(&done);
+
+    __ bind(&hole);
+    __ mov(rax, Immediate(Heap::kTagNil));
+    __ jmp(&done);
+
+    __ bind(&slow);
+  }
+
   __ mov(rcx, Immediate(0));
   if (HasMonomorphicProperty()) {
-    __ Call(masm->space()->CreatePIC());
+    masm->space()->CreatePIC()->GenerateInline(masm);
   } else {
     __ Call(masm->stubs()->GetLookupPropertyStub());
   }
@@ -207,16 +240,99 @@ void LLoadProperty::Generate(Masm* masm) {
 
 
 void LStoreProperty::Generate(Masm* masm) {
-  Label done;
+  Label done, slow;
   Masm::Spill rax_s(masm, rax);
   Masm::Spill rcx_s(masm, rcx);
 
   // rax <- object
   // rbx <- propery
   // rcx <- value
+  if (HasSmiKey()) {
+    Label retry, store, doubles, unboxed, hole, grow, length, length_set;
+    Operand repr(rax, HValue::kRepresentationOffset);
+    Operand element(rdx, 0);
+
+    __ bind(&retry);
+
+    // Fast case: dense array's element
+    __ DenseArrayElement(rax, rbx, rdx, &doubles);
+
+    // Smi-only array switches to double elements on number store,
+    // and becomes generic on any other value
+    __ cmpb(repr, Immediate(HArray::kDenseSmi));
+    __ jmp(kNe, &store);
+    __ IsUnboxed(rcx, NULL, &store);
+    __ IsNil(rcx, NULL, &store);
+    __ IsHeapObject(Heap::kTagNumber, rcx, NULL, &grow);
+    __ movb(repr, Immediate(HArray::kDense));
+
+    __ bind(&store);
+    Operand qmap(rax, HObject::kMapOffset);
+    __ MarkingBarrier(element);
+    __ mov(element, rcx);
+    __ mov(scratch, qmap);
+    __ RecordWrite(scratch, rcx, rdx);
+    __ jmp(&length);
+
+    // Fast case: double array's element
+    __ bind(&doubles);
+    __ DoubleArrayElement(rax, rbx, rdx, &grow);
+    __ IsUnboxed(rcx, NULL, &unboxed);
+    __ IsNil(rcx, NULL, &hole);
+    __ IsHeapObject(Heap::kTagNumber, rcx, &slow, NULL);
+    Operand qvalue(rcx, HNumber::kValueOffset);
+    __ movd(fscratch, qvalue);
+    __ movd(element, fscratch);
+    __ jmp(&length);
+
+    __ bind(&unboxed);
+    __ mov(scratch, rcx);
+    __ Untag(scratch);
+    __ xorqd(fscratch, fscratch);
+    __ cvtsi2sd(fscratch, scratch);
+    __ movd(element, fscratch);
+    __ jmp(&length);
+
+    __ bind(&hole);
+    __ mov(scratch, Immediate(kDoubleHole));
+    __ mov(element, scratch);
+    __ jmp(&length);
+
+    // Elements should be converted or grown to fit the value,
+    // only arrays and non-negative smi keys are interesting
+    __ bind(&grow);
+    __ IsUnboxed(rax, NULL, &slow);
+    __ IsNil(rax, NULL, &slow);
+    __ IsHeapObject(Heap::kTagArray, rax, &slow, NULL);
+    __ IsUnboxed(rbx, &slow, NULL);
+    __ cmpq(rbx, Immediate(0));
+    __ jmp(kLt, &slow);
+    __ Call(masm->stubs()->GetGrowElementsStub());
+    __ cmpq(rax, Immediate(0));
+    rax_s.Unspill();
+    __ jmp(kNe, &retry);
+    __ jmp(&slow);
+
+    // Update length if it was increased
+    __ bind(&length);
+    Operand qlength(rax, HArray::kLengthOffset);
+    __ Untag(rbx);
+    __ inc(rbx);
+    __ cmpq(rbx, qlength);
+    __ jmp(kLe, &length_set);
+    __ mov(qlength, rbx);
+    __ bind(&length_set);
+
+    // Raw length shouldn't be seen by GC
+    __ xorq(rbx, rbx);
+    __ jmp(&done);
+
+    __ bind(&slow);
+  }
+
   __ mov(rcx, Immediate(1));
   if (HasMonomorphicProperty()) {
-    __ Call(masm->space()->CreatePIC());
+    masm->space()->CreatePIC()->GenerateInline(masm);
   } else {
     __ Call(masm->stubs()->GetLookupPropertyStub());
   }
@@ -234,7 +350,9 @@ void LStoreProperty::Generate(Masm* masm) {
   __ addq(rax, rbx);
 
   Operand slot(rax, 0);
+  __ MarkingBarrier(slot);
   __ mov(slot, rcx);
+  __ RecordWrite(rbx, rcx, rax);
 
   __ bind(&done);
 }
@@ -342,18 +460,45 @@ void LBinOpNumber::Generate(Masm* masm) {
 #undef BINARY_SUB_ENUM
 #undef BINARY_SUB_TYPES
 
-void LFunction::Generate(Masm* masm) {
+static void LoadFunctionBody(Masm* masm, Label* label, Register reg) {
   // Get function's body address from relocation info
-  __ mov(scratches[0]->ToRegister(), Immediate(0));
+  __ mov(reg, Immediate(0));
   RelocationInfo* addr = new RelocationInfo(RelocationInfo::kAbsolute,
                                             RelocationInfo::kQuad,
                                             masm->offset() - 8);
-  label_->AddUse(masm, addr);
+  label->AddUse(masm, addr);
+}
+
 
-  // Call stub
+void LFunction::Generate(Masm* masm) {
+  Label runtime, done;
+
+  // Fast case: bump-allocate function in new space
+  __ AllocateInline(5 * HValue::kPointerSize, rax, &runtime);
+
+  Operand qtag(rax, HValue::kTagOffset);
+  Operand qparent(rax, HFunction::kParentOffset);
+  Operand qaddr(rax, HFunction::kCodeOffset);
+  Operand qroot(rax, HFunction::kRootOffset);
+  Operand qargc(rax, HFunction::kArgcOffset);
+
+  __ mov(qtag, Immediate(Heap::kTagFunction));
+  __ mov(qparent, context_reg);
+  __ mov(qroot, root_reg);
+  LoadFunctionBody(masm, label_, scratch);
+  __ mov(qaddr, scratch);
+  __ mov(qargc, Immediate(HNumber::Tag(arg_count_)));
+  __ xorq(scratch, scratch);
+  __ jmp(&done);
+
+  // Slow case: call stub
+  __ bind(&runtime);
+  LoadFunctionBody(masm, label_, scratch);
   __ push(Immediate(HNumber::Tag(arg_count_)));
-  __ push(scratches[0]->ToRegister());
+  __ push(scratch);
   __ Call(masm->stubs()->GetAllocateFunctionStub());
+
+  __ bind(&done);
 }
 
 
@@ -524,7 +669,11 @@ void LStoreContext::Generate(Masm* masm) {
 
   Operand res(scratches[0]->ToRegister(),
               HContext::GetIndexDisp(slot()->index()));
+  __ MarkingBarrier(res);
   __ mov(res, inputs[0]->ToRegister());
+  __ RecordWrite(scratches[0]->ToRegister(),
+                 inputs[0]->ToRegister(),
+                 reg_nil);
 }
 
 
@@ -31,45 +31,48 @@ namespace internal {
 #define __ masm->
 
 void PIC::Generate(Masm* masm) {
-  __ push(rbp);
-  __ mov(rbp, rsp);
+  Label miss;
+  Operand shape_op(rax, HObject::kShapeOffset);
+  Operand qmap(rax, HObject::kMapOffset);
 
-  // Place for spills
-  __ pushb(Immediate(Heap::kTagNil));
-  __ pushb(Immediate(Heap::kTagNil));
+  // rdx <- shape (NULL for non-objects)
+  __ xorq(rdx, rdx);
 
-  Label miss, end;
-  Operand rdx_op(rdx, 0);
-  Operand proto_op(rax, HObject::kProtoOffset);
-  Operand rax_s(rbp, -16), rbx_s(rbp, -24);
+  // Fast-case non-object
+  __ IsNil(rax, NULL, &miss);
+  __ IsUnboxed(rax, NULL, &miss);
+  __ IsHeapObject(Heap::kTagObject, rax, &miss, NULL);
 
-  __ mov(rax_s, rax);
-  __ mov(rbx_s, rbx);
-
-  if (size_ != 0) {
-    // Fast-case non-object
-    __ IsNil(rax, NULL, &miss);
-    __ IsUnboxed(rax, NULL, &miss);
-    __ IsHeapObject(Heap::kTagObject, rax, &miss, NULL);
-
-    // Load proto
-    __ mov(rdx, proto_op);
-    __ cmpq(rdx, Immediate(Heap::kICDisabledValue));
-    __ jmp(kEq, &miss);
-  }
+  // Load shape (NULL in dictionary mode never matches)
+  __ mov(rdx, shape_op);
 
+  // NOTE: Hits don't need a frame, only scratch and rdx are clobbered
   for (int i = size_ - 1; i >= 0; i--) {
     Label local_miss;
 
-    __ mov(rbx, Immediate(reinterpret_cast<intptr_t>(protos_[i])));
-    proto_offsets_[i] = reinterpret_cast<char**>(static_cast<intptr_t>(
-          masm->offset() - 8));
-    __ cmpq(rdx, rbx);
+    __ mov(scratch, Immediate(reinterpret_cast<intptr_t>(shapes_[i])));
+    __ cmpq(rdx, scratch);
     __ jmp(kNe, &local_miss);
+
+    if (transitions_[i] != NULL) {
+      // Shape guarantees that key's slot is empty: insert key and move
+      // object to the next shape
+      // key_offset = value_offset - mask - 8
+      intptr_t key_offset = results_[i] - HValue::kPointerSize -
+          (shapes_[i]->size() - 1) * HValue::kPointerSize;
+      Operand qkey(rdx, key_offset);
+
+      __ mov(rdx, qmap);
+      __ mov(qkey, rbx);
+      __ mov(scratch, rdx);
+      __ addq(scratch, Immediate(key_offset));
+      __ RecordWrite(rdx, rbx, scratch);
+
+      __ mov(scratch, Immediate(reinterpret_cast<intptr_t>(transitions_[i])));
+      __ mov(shape_op, scratch);
+    }
+
     __ mov(rax, Immediate(results_[i]));
-    __ xorq(rbx, rbx);
-    __ mov(rsp, rbp);
-    __ pop(rbp);
     __ ret(0);
     __ bind(&local_miss);
   }
@@ -77,14 +80,20 @@ void PIC::Generate(Masm* masm) {
   // Cache failed - call runtime
   __ bind(&miss);
 
-  if (size_ != 0) {
-    __ mov(rbx, rbx_s);
-    __ mov(rax, rax_s);
-  }
+  __ push(rbp);
+  __ mov(rbp, rsp);
+
+  // Place for spills (and padding to keep stack aligned)
+  Operand rax_s(rbp, -8), shape_s(rbp, -16);
+  __ push(rax);
+  __ push(rdx);
+
   __ Call(space_->stubs()->GetLookupPropertyStub());
 
-  // Miss(this, object, result, ip)
+  // Miss(this, object, result, ip, shape)
   Operand caller_ip(rbp, 8);
+  __ pushb(Immediate(Heap::kTagNil));
+  __ push(shape_s);
   __ push(caller_ip);
   __ push(rax);
   __ push(rax_s);
@@ -93,12 +102,43 @@ void PIC::Generate(Masm* masm) {
   __ Call(space_->stubs()->GetPICMissStub());
 
   // Return value
-  __ bind(&end);
   __ xorq(rbx, rbx);
   __ mov(rsp, rbp);
   __ pop(rbp);
   __ ret(0);
 }
 
+
+void PIC::GenerateInline(Masm* masm) {
+  Label miss, done;
+  Operand shape_op(rax, HObject::kShapeOffset);
+
+  // rax <- object
+  // rbx <- property
+  // rcx <- change flag
+  __ IsNil(rax, NULL, &miss);
+  __ IsUnboxed(rax, NULL, &miss);
+  __ IsHeapObject(Heap::kTagObject, rax, &miss, NULL);
+
+  // Shape and result are patched by Miss()
+  __ mov(rdx, Immediate(Heap::kICZapValue));
+  intptr_t shape_imm = masm->offset() - HValue::kPointerSize;
+  __ cmpq(rdx, shape_op);
+  __ jmp(kNe, &miss);
+  __ mov(rax, Immediate(Heap::kICZapValue));
+  intptr_t result_imm = masm->offset() - HValue::kPointerSize;
+  __ jmp(&done);
+
+  __ bind(&miss);
+  __ mov(scratch, Immediate(reinterpret_cast<intptr_t>(addr())));
+  intptr_t call_imm = masm->offset() - HValue::kPointerSize;
+  __ Call(scratch);
+
+  __ bind(&done);
+
+  inline_shape_ = call_imm - shape_imm;
+  inline_result_ = call_imm - result_imm;
+}
+
 }  // namespace internal
 }  // namespace candor
@@ -212,9 +212,16 @@ void AllocateStub::Generate() {
   __ mov(scratch, scratch_op);
   __ mov(scratch_op, rbx);
 
+  // Set tag
+  Operand qtag(rax, HValue::kTagOffset);
+  __ mov(scratch, tag);
+  __ Untag(scratch);
+  __ mov(qtag, scratch);
+
   __ jmp(&done);
 
   // Invoke runtime allocation stub
+  // (large objects are allocated there too)
   __ bind(&runtime_allocate);
 
   // Remove junk from registers
@@ -227,25 +234,32 @@ void AllocateStub::Generate() {
     Masm::Align a(masm());
     __ Pushad();
 
-    // Two arguments: heap, size
+    // AllocateNumber keeps the value in xmm1, which is caller-saved in C++
+    // (pushed twice to keep the stack aligned)
+    __ movd(scratch, xmm1);
+    __ push(scratch);
+    __ push(scratch);
+
+    // Three arguments: heap, size, tag (runtime will set it)
     __ mov(rdi, heapref);
     __ mov(rsi, size);
+    __ Untag(rsi);
+    __ mov(rdx, tag);
+    __ Untag(rdx);
 
     __ mov(scratch, Immediate(*reinterpret_cast<intptr_t*>(&allocate)));
 
     __ Call(scratch);
+
+    __ pop(scratch);
+    __ pop(scratch);
+    __ movd(xmm1, scratch);
     __ Popad(rax);
   }
 
   // Voila result and result_end are pointers
   __ bind(&done);
 
-  // Set tag
-  Operand qtag(rax, HValue::kTagOffset);
-  __ mov(scratch, tag);
-  __ Untag(scratch);
-  __ mov(qtag, scratch);
-
   // Rax will hold resulting pointer
   __ pop(rbx);
   GenerateEpilogue(2);
@@ -288,10 +302,17 @@ void AllocateObjectStub::Generate() {
   Operand size(rbp, 24);
   Operand tag(rbp, 16);
 
+  // rdx <- shape
+  Masm::Spill rdx_s(masm(), rdx);
+
   __ mov(rcx, tag);
   __ mov(rbx, size);
   __ AllocateObjectLiteral(Heap::kTagNil, rcx, rbx, rax);
 
+  Operand qshape(rax, HObject::kShapeOffset);
+  rdx_s.Unspill(rbx);
+  __ mov(qshape, rbx);
+
   GenerateEpilogue(2);
 }
 
@@ -338,6 +359,34 @@ void CallBindingStub::Generate() {
 }
 
 
+void AllocateSiteObjectStub::Generate() {
+  GeneratePrologue();
+
+  // Arguments
+  Operand site(rbp, 16);
+
+  RuntimeAllocateObjectCallback allocate = &RuntimeAllocateObject;
+  __ Pushad();
+
+  {
+    Masm::Align a(masm());
+
+    // RuntimeAllocateObject(heap, site)
+    __ mov(rdi, Immediate(reinterpret_cast<intptr_t>(masm()->heap())));
+    __ mov(rsi, site);
+    __ mov(rax, Immediate(*reinterpret_cast<intptr_t*>(&allocate)));
+    __ Call(rax);
+  }
+
+  __ Popad(rax);
+
+  __ CheckGC();
+
+  // site + site
+  GenerateEpilogue(2);
+}
+
+
 void CollectGarbageStub::Generate() {
   GeneratePrologue();
 
@@ -347,9 +396,10 @@ void CollectGarbageStub::Generate() {
   {
     Masm::Align a(masm());
 
-    // RuntimeCollectGarbage(heap, stack_top)
+    // RuntimeCollectGarbage(heap, stack_top, frame)
     __ mov(rdi, Immediate(reinterpret_cast<intptr_t>(masm()->heap())));
     __ mov(rsi, rsp);
+    __ mov(rdx, rbp);
     __ mov(rax, Immediate(*reinterpret_cast<intptr_t*>(&gc)));
     __ Call(rax);
   }
@@ -360,6 +410,60 @@ void CollectGarbageStub::Generate() {
 }
 
 
+void RecordWriteStub::Generate() {
+  GeneratePrologue();
+
+  // Arguments
+  Operand host(rbp, 24);
+  Operand slot(rbp, 16);
+
+  RuntimeRecordWriteCallback record = &RuntimeRecordWrite;
+  __ Pushad();
+
+  {
+    Masm::Align a(masm());
+
+    // RuntimeRecordWrite(heap, host, slot)
+    __ mov(rdi, Immediate(reinterpret_cast<intptr_t>(masm()->heap())));
+    __ mov(rsi, host);
+    __ mov(rdx, slot);
+    __ mov(rax, Immediate(*reinterpret_cast<intptr_t*>(&record)));
+    __ Call(rax);
+  }
+
+  __ Popad(reg_nil);
+
+  // host + slot
+  GenerateEpilogue(2);
+}
+
+
+void MarkingBarrierStub::Generate() {
+  GeneratePrologue();
+
+  // Arguments
+  Operand value(rbp, 16);
+
+  RuntimeMarkingBarrierCallback barrier = &RuntimeMarkingBarrier;
+  __ Pushad();
+
+  {
+    Masm::Align a(masm());
+
+    // RuntimeMarkingBarrier(heap, value)
+    __ mov(rdi, Immediate(reinterpret_cast<intptr_t>(masm()->heap())));
+    __ mov(rsi, value);
+    __ mov(rax, Immediate(*reinterpret_cast<intptr_t*>(&barrier)));
+    __ Call(rax);
+  }
+
+  __ Popad(reg_nil);
+
+  // value + value
+  GenerateEpilogue(2);
+}
+
+
 void TypeofStub::Generate() {
   GeneratePrologue();
 
@@ -434,7 +538,7 @@ void KeysofStub::Generate() {
 void LookupPropertyStub::Generate() {
   GeneratePrologue();
 
-  Label is_object, is_array, cleanup, slow_case;
+  Label is_object, is_array, probe_cache, cleanup, slow_case;
   Label non_object_error, done;
 
   // rax <- object
@@ -462,6 +566,26 @@ void LookupPropertyStub::Generate() {
 
     __ StringHash(rbx, rdx);
 
+    // Flattened cons string is interned by its left part
+    Label flat_key;
+    Operand krepr(rbx, HValue::kRepresentationOffset);
+    Operand kleft(rbx, HString::kLeftConsOffset);
+    Operand kright(rbx, HString::kRightConsOffset);
+    __ cmpb(krepr, Immediate(HString::kCons));
+    __ jmp(kNe, &flat_key);
+    __ cmpq(kright, Immediate(Heap::kTagNil));
+    __ jmp(kNe, &flat_key);
+
+    // String builder's buffer is bigger than the string itself
+    Operand klength(rbx, HString::kLengthOffset);
+    Operand kleft_length(rsi, HString::kLengthOffset);
+    __ mov(rsi, kleft);
+    __ mov(scratch, klength);
+    __ cmpq(scratch, kleft_length);
+    __ jmp(kNe, &flat_key);
+    __ mov(rbx, rsi);
+    __ bind(&flat_key);
+
     Operand qmask(rax, HObject::kMaskOffset);
     __ mov(rsi, qmask);
 
@@ -470,7 +594,7 @@ void LookupPropertyStub::Generate() {
     __ addqb(rdx, Immediate(HMap::kSpaceOffset));
 
     Operand qmap(rax, HObject::kMapOffset);
-    Operand qproto(rax, HObject::kProtoOffset);
+    Operand qshape(rax, HObject::kShapeOffset);
     __ mov(scratch, qmap);
     __ addq(scratch, rdx);
 
@@ -487,7 +611,7 @@ void LookupPropertyStub::Generate() {
 
     // or nil
     __ cmpq(scratch, Immediate(Heap::kTagNil));
-    __ jmp(kNe, &cleanup);
+    __ jmp(kNe, &probe_cache);
 
     __ bind(&match);
 
@@ -498,10 +622,16 @@ void LookupPropertyStub::Generate() {
     __ jmp(kEq, &fast_case_end);
 
     // Inserting key in map is required
-    // invalidate IC if key wasn't the same
+    // new key changes object's shape - let runtime do transition
     __ IsNil(scratch, &same_key, NULL);
 
-    __ mov(qproto, Immediate(Heap::kICDisabledValue));
+    __ cmpq(qshape, Immediate(0));
+    __ jmp(kNe, &cleanup);
+
+    // Only interned keys are put into maps - let runtime intern it
+    Operand qgcmark(rbx, HValue::kGCMarkOffset);
+    __ testb(qgcmark, Immediate(HValue::kInternedBit));
+    __ jmp(kEq, &cleanup);
     __ bind(&same_key);
 
     // Restore map's interior pointer
@@ -510,6 +640,9 @@ void LookupPropertyStub::Generate() {
 
     // Put the key into slot
     __ mov(slot, rbx);
+    __ mov(rcx, qmap);
+    __ RecordWrite(rcx, rbx, scratch);
+    change_s.Unspill();
 
     __ bind(&fast_case_end);
 
@@ -527,6 +660,42 @@ void LookupPropertyStub::Generate() {
     GenerateEpilogue(0);
   }
 
+  // Slot is occupied by another key - try megamorphic stub cache
+  __ bind(&probe_cache);
+  {
+    StubCache* cache = masm()->heap()->stub_cache();
+    Operand qshape(rax, HObject::kShapeOffset);
+
+    // Objects in dictionary mode aren't cached
+    __ mov(rdx, qshape);
+    __ cmpq(rdx, Immediate(0));
+    __ jmp(kEq, &cleanup);
+
+    // scratch <- entry
+    __ mov(scratch, rdx);
+    __ xorq(scratch, rbx);
+    __ mov(rsi, Immediate(StubCache::kIndexMask));
+    __ andq(scratch, rsi);
+    __ mov(rsi, Immediate(reinterpret_cast<intptr_t>(cache->table())));
+    __ addq(scratch, rsi);
+
+    Operand eshape(scratch, StubCache::kShapeOffset);
+    Operand ekey(scratch, StubCache::kKeyOffset);
+    Operand eoffset(scratch, StubCache::kOffsetOffset);
+    __ cmpq(rdx, eshape);
+    __ jmp(kNe, &cleanup);
+    __ cmpq(rbx, ekey);
+    __ jmp(kNe, &cleanup);
+    __ mov(rax, eoffset);
+
+    // Cleanup
+    __ xorq(rdx, rdx);
+    rsi_s.Unspill();
+
+    // Return value
+    GenerateEpilogue(0);
+  }
+
   __ bind(&is_array);
   // Fast case: dense array and a unboxed key
   {
@@ -536,6 +705,14 @@ void LookupPropertyStub::Generate() {
     __ jmp(kLe, &slow_case);
     __ IsDenseArray(rax, &slow_case, NULL);
 
+    // Smi-only array could receive any value now
+    Label smi_kept;
+    Operand repr(rax, HValue::kRepresentationOffset);
+    __ cmpq(rcx, Immediate(0));
+    __ jmp(kEq, &smi_kept);
+    __ movb(repr, Immediate(HArray::kDense));
+    __ bind(&smi_kept);
+
     // Get mask
     Operand qmask(rax, HObject::kMaskOffset);
     __ mov(rdx, qmask);
@@ -621,6 +798,7 @@ void PICMissStub::Generate() {
   Operand object(rbp, 24);
   Operand result(rbp, 32);
   Operand ip(rbp, 40);
+  Operand shape(rbp, 48);
 
   // Amend PIC
   __ Pushad();
@@ -629,6 +807,7 @@ void PICMissStub::Generate() {
   __ mov(rsi, object);
   __ mov(rdx, result);
   __ mov(rcx, ip);
+  __ mov(r8, shape);
 
   PIC::MissCallback miss_cb = &PIC::Miss;
   __ mov(rax, Immediate(*reinterpret_cast<intptr_t*>(&miss_cb)));
@@ -699,6 +878,9 @@ void CloneObjectStub::Generate() {
   __ IsNil(rax, NULL, &non_object);
   __ IsHeapObject(Heap::kTagObject, rax, &non_object, NULL);
 
+  // Keep object alive while allocating, GC may free shapes of dead objects
+  Masm::Spill object_s(masm(), rax);
+
   // Get map
   Operand qmap(rax, HObject::kMapOffset);
   __ mov(rax, qmap);
@@ -718,9 +900,12 @@ void CloneObjectStub::Generate() {
   Operand qmap_rbx(rbx, HObject::kMapOffset);
   __ mov(rbx, qmap_rbx);
 
-  // Set proto
-  Operand qproto(rdx, HObject::kProtoOffset);
-  __ mov(qproto, rax);
+  // Clone has the same layout
+  Operand qshape(scratch, HObject::kShapeOffset);
+  Operand qshape_rdx(rdx, HObject::kShapeOffset);
+  object_s.Unspill(scratch);
+  __ mov(scratch, qshape);
+  __ mov(qshape_rdx, scratch);
 
   // Skip headers
   __ addqb(rax, Immediate(HMap::kSpaceOffset));
@@ -758,6 +943,10 @@ void CloneObjectStub::Generate() {
   // Allocate new object
   __ AllocateObjectLiteral(Heap::kTagObject, reg_nil, rcx, rax);
 
+  Operand qshape_rax(rax, HObject::kShapeOffset);
+  Shape* shape = masm()->heap()->RootShape(16);
+  __ mov(qshape_rax, Immediate(reinterpret_cast<intptr_t>(shape)));
+
   __ bind(&done);
 
   GenerateEpilogue(0);
@@ -786,6 +975,31 @@ void DeletePropertyStub::Generate() {
   GenerateEpilogue(0);
 }
 
+void GrowElementsStub::Generate() {
+  GeneratePrologue();
+
+  // rax <- array
+  // rbx <- key
+  // rcx <- value
+  //
+  RuntimeGrowElementsCallback grow = &RuntimeGrowElements;
+
+  __ Pushad();
+
+  // RuntimeGrowElements(heap, array, key, value)
+  __ mov(rdi, Immediate(reinterpret_cast<intptr_t>(masm()->heap())));
+  __ mov(rsi, rax);
+  __ mov(rdx, rbx);
+  __ mov(rax, Immediate(*reinterpret_cast<intptr_t*>(&grow)));
+  __ callq(rax);
+
+  // rax <- 1 if array's fast case could be retried
+  __ Popad(rax);
+
+  GenerateEpilogue(0);
+}
+
+
 
 void HashValueStub::Generate() {
   GeneratePrologue();
@@ -1204,6 +1418,7 @@ void LoadVarArgStub::Generate() {
 
   // Put argument in array
   __ mov(slot, offset);
+  __ RecordWrite(arr, offset, scratch);
 
   arr_s.Unspill();
 
@@ -1240,7 +1455,7 @@ void StoreVarArgStub::Generate() {
 
   // rax <- varg
   Label loop, not_array, odd_end, r1_nil, r2_nil;
-  Masm::Spill index_s(masm()), map_s(masm()), array_s(masm()), r1(masm());
+  Masm::Spill index_s(masm()), array_s(masm()), r1(masm());
   Masm::Spill stack_s(masm(), stack);
   Operand slot(rax, 0);
 
@@ -1248,9 +1463,8 @@ void StoreVarArgStub::Generate() {
   __ IsNil(varg, NULL, &not_array);
   __ IsHeapObject(Heap::kTagArray, varg, &not_array, NULL);
 
-  Operand qmap(varg, HObject::kMapOffset);
-  __ mov(map, qmap);
-  map_s.SpillReg(map);
+  // NOTE: Lookup may box array's double elements, map is loaded after it
+  Operand qmap(map, HObject::kMapOffset);
 
   // index = sizeof(array)
   Operand qlength(varg, HArray::kLengthOffset);
@@ -1277,7 +1491,8 @@ void StoreVarArgStub::Generate() {
   __ Call(masm()->stubs()->GetLookupPropertyStub());
 
   __ IsNil(rax, NULL, &r1_nil);
-  map_s.Unspill();
+  array_s.Unspill(map);
+  __ mov(map, qmap);
   __ addq(rax, map);
   __ mov(rax, slot);
 
@@ -1302,7 +1517,8 @@ void StoreVarArgStub::Generate() {
   __ Call(masm()->stubs()->GetLookupPropertyStub());
 
   __ IsNil(rax, NULL, &r2_nil);
-  map_s.Unspill();
+  array_s.Unspill(map);
+  __ mov(map, qmap);
   __ addq(rax, map);
   __ mov(rax, slot);
 
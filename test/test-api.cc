@@ -1,4 +1,5 @@
 #include "test.h"
+#include <heap-snapshot.h>
 
 static Value* Callback(uint32_t argc, Value* argv[]) {
   ASSERT(argc == 3);
@@ -82,6 +83,43 @@ static Value* GetWeak(uint32_t argc, Value* argv[]) {
   return *obj;
 }
 
+static int gc_events = 0;
+static int gc_scavenges = 0;
+static uint64_t gc_pause = 0;
+
+static void GCEventCallback(const Isolate::GCEvent* event) {
+  gc_events++;
+  gc_pause += event->pause;
+  if (event->type == Isolate::GCEvent::kScavenge) {
+    gc_scavenges++;
+    ASSERT(event->new_space_after != 0);
+  }
+}
+
+static int oom_called = 0;
+
+static void OnOutOfMemory() {
+  oom_called++;
+}
+
+static const int64_t kExternalChunk = 1024 * 1024;
+static int external_released = 0;
+
+static void ExternalWeakCallback(Value* data) {
+  Isolate::GetCurrent()->AdjustExternalMemory(-kExternalChunk);
+  external_released++;
+}
+
+static Value* NewExternal(uint32_t argc, Value* argv[]) {
+  ASSERT(argc == 0);
+
+  CData* data = CData::New(sizeof(int));
+  data->SetWeakCallback(ExternalWeakCallback);
+  Isolate::GetCurrent()->AdjustExternalMemory(kExternalChunk);
+
+  return data;
+}
+
 struct CDataStruct {
   int x;
   int y;
@@ -352,6 +390,281 @@ TEST_START(api)
     ASSERT(wrapper_destroyed == 1);
   }
 
+  // Heap options
+  {
+    Isolate::Options options;
+    options.new_space_size = 2 * 1024 * 1024;
+    options.max_new_space_size = 8 * 1024 * 1024;
+    options.old_space_size = 4 * 1024 * 1024;
+    options.max_old_space_size = 16 * 1024 * 1024;
+    options.growth_factor = 1.5;
+    options.heap_limit = 256 * 1024 * 1024;
+
+    Isolate i(options);
+
+    const char* code = "keep = { list: nil, count: 0 }\n"
+                       "j = 0\n"
+                       "while (j < 50000) {\n"
+                       "  garbage = { x: { y: j } }\n"
+                       "  keep.list = { next: keep.list }\n"
+                       "  j++\n"
+                       "}\n"
+                       "l = keep.list\n"
+                       "c = 0\n"
+                       "while (l) {\n"
+                       "  c++\n"
+                       "  l = l.next\n"
+                       "}\n"
+                       "return c";
+
+    Function* f = Function::New("api", code, strlen(code));
+
+    Value* ret = f->Call(0, NULL);
+    ASSERT(ret->As<Number>()->Value() == 50000);
+  }
+
+  // Heap limit terminates the script, but not the process
+  {
+    Isolate::Options options;
+    options.heap_limit = 16 * 1024 * 1024;
+    options.oom_callback = OnOutOfMemory;
+
+    Isolate i(options);
+
+    const char* code = "keep = { list: nil }\n"
+                       "while (true) {\n"
+                       "  keep.list = { next: keep.list, x: [ 1, 2, 3 ] }\n"
+                       "}\n"
+                       "return 1";
+
+    Function* f = Function::New("api", code, strlen(code));
+
+    Value* ret = f->Call(0, NULL);
+    ASSERT(ret->Is<Nil>());
+    ASSERT(oom_called == 1);
+    ASSERT(i.HasError());
+
+    const char* next = "return { x: 1 }.x + 1";
+    Function* g = Function::New("api", next, strlen(next));
+    ASSERT(!i.HasError());
+
+    ret = g->Call(0, NULL);
+    ASSERT(ret->As<Number>()->Value() == 2);
+  }
+
+  // Page pool
+  {
+    Isolate i;
+    i.EnableHugePages();
+    i.SetPageUncommitDelay(0);
+
+    const char* code = "keep = []\n"
+                       "j = 0\n"
+                       "while (j < 100000) {\n"
+                       "  garbage = { x: { y: j } }\n"
+                       "  keep[j] = { x: j }\n"
+                       "  j++\n"
+                       "}\n"
+                       "__$gc()\n__$gc()\n"
+                       "return keep[99999].x";
+
+    Function* f = Function::New("api", code, strlen(code));
+
+    Value* ret = f->Call(0, NULL);
+    ASSERT(ret->As<Number>()->Value() == 99999);
+  }
+
+  // Heap statistics and GC events
+  {
+    Isolate i;
+    i.SetGCCallback(GCEventCallback);
+
+    const char* code = "keep = []\n"
+                       "j = 0\n"
+                       "while (j < 100000) {\n"
+                       "  garbage = { x: { y: j } }\n"
+                       "  keep[j] = { x: j }\n"
+                       "  j++\n"
+                       "}\n"
+                       "__$gc()\n"
+                       "return keep[99999].x";
+
+    Function* f = Function::New("api", code, strlen(code));
+
+    Value* ret = f->Call(0, NULL);
+    ASSERT(ret->As<Number>()->Value() == 99999);
+
+    Isolate::HeapStatistics stats;
+    i.GetHeapStatistics(&stats);
+
+    ASSERT(gc_events > 0);
+    ASSERT(gc_scavenges > 0);
+    ASSERT(stats.scavenges == static_cast<uint32_t>(gc_scavenges));
+    ASSERT(stats.total_pause == gc_pause);
+    ASSERT(stats.old_space_size != 0);
+    ASSERT(stats.total_size == stats.new_space_size +
+                               stats.old_space_size +
+                               stats.large_space_size);
+  }
+
+  // External memory
+  {
+    Isolate i;
+    const char* code = "alloc = global.alloc\n"
+                       "j = 0\n"
+                       "while (j < 1000) {\n"
+                       "  x = alloc()\n"
+                       "  j++\n"
+                       "}";
+
+    Function* f = Function::New("api", code, strlen(code));
+
+    Object* global = Object::New();
+    global->Set(String::New("alloc", 5), Function::New(NewExternal));
+    f->SetContext(global);
+
+    f->Call(0, NULL);
+
+    // Small wrappers alone would never trigger collection
+    Isolate::HeapStatistics stats;
+    i.GetHeapStatistics(&stats);
+    ASSERT(external_released > 0);
+    ASSERT(stats.external_memory ==
+           (1000 - external_released) * kExternalChunk);
+    ASSERT(stats.external_memory <= 2 * GC::kExternalMemoryLimit);
+  }
+
+  // Idle-time GC
+  {
+    Isolate i;
+    const char* code = "keep = []\n"
+                       "j = 0\n"
+                       "while (j < 50000) {\n"
+                       "  garbage = { x: { y: j } }\n"
+                       "  keep[j % 10000] = { x: j }\n"
+                       "  j++\n"
+                       "}\n"
+                       "return keep";
+
+    Function* f = Function::New("api", code, strlen(code));
+    Handle<Array> keep(f->Call(0, NULL)->As<Array>());
+
+    int rounds = 0;
+    while (i.IdleNotification(1000000)) {
+      ASSERT(++rounds < 100);
+    }
+
+    Heap* heap = Heap::Current();
+    ASSERT(!heap->is_marking());
+    ASSERT(!heap->old_space()->is_sweeping());
+    ASSERT(heap->needs_gc() == Heap::kGCNone);
+
+    Isolate::HeapStatistics stats;
+    i.GetHeapStatistics(&stats);
+    ASSERT(stats.new_space_used * 100 <
+           stats.new_space_limit * GC::kIdleScavengeRatio);
+
+    Value* x = keep->Get(9999)->As<Object>()->Get("x");
+    ASSERT(x->As<Number>()->Value() == 49999);
+  }
+
+  // Heap snapshot
+  {
+    Isolate i;
+    const char* code = "list = []\n"
+                       "j = 0\n"
+                       "while (j < 1000) {\n"
+                       "  list[j] = { x: j }\n"
+                       "  j++\n"
+                       "}\n"
+                       "return list";
+
+    Function* f = Function::New("api", code, strlen(code));
+    Handle<Array> list(f->Call(0, NULL)->As<Array>());
+
+    HeapSnapshot snapshot(Heap::Current());
+    snapshot.Take();
+
+    HeapSnapshot::Node* node = snapshot.Find(
+        reinterpret_cast<char*>(*list));
+    ASSERT(node != NULL);
+    ASSERT(node->dominator == HeapSnapshot::kRoot);
+
+    // Array's map and every element are retained only by the array
+    HeapSnapshot::Node* child = NULL;
+    HeapSnapshot::Edge* edge = snapshot.edge(node->first_edge);
+    for (uint32_t j = 0; j < node->edge_count; j++, edge++) {
+      if (edge->type != HeapSnapshot::kEdgeMap) continue;
+      child = snapshot.node(edge->to);
+    }
+    ASSERT(child != NULL);
+    ASSERT(child->dominator == static_cast<uint32_t>(node - snapshot.root()));
+    ASSERT(node->retained > node->size + child->size + 1000 * 32);
+    ASSERT(snapshot.root()->retained >= node->retained);
+
+    char filename[] = "/tmp/candor-snapshot-XXXXXX";
+    int fd = mkstemp(filename);
+    ASSERT(fd != -1);
+    close(fd);
+
+    ASSERT(i.WriteHeapSnapshot(filename));
+    struct stat st;
+    ASSERT(stat(filename, &st) == 0 && st.st_size > 0);
+    unlink(filename);
+
+    ASSERT(!i.WriteHeapSnapshot("/nonexistent/snapshot.json"));
+  }
+
+  // Sliced strings
+  {
+    Isolate i;
+    const char* code = "return (str, flat, obj) {\n"
+                       "  __$gc()\n"
+                       "  __$gc()\n"
+                       "  return str == flat && obj[flat] === 1\n"
+                       "}";
+
+    char buf[4096];
+    memset(buf, 'x', sizeof(buf));
+    memcpy(buf + 100, "hello sliced world!!", 20);
+
+    Handle<String> parent(String::New(buf, sizeof(buf)));
+    Handle<String> small(parent->Slice(100, 20));
+    Handle<String> big(parent->Slice(50, 3000));
+    Handle<String> nested(big->Slice(50, 20));
+    Handle<String> clamped(parent->Slice(4090, 100));
+
+    ASSERT(HValue::GetRepresentation<HString::Representation>(
+          small->addr()) == HString::kSliced);
+    ASSERT(HValue::GetRepresentation<HString::Representation>(
+          nested->addr()) == HString::kSliced);
+    ASSERT(HString::Parent(nested->addr()) == parent->addr());
+    ASSERT(nested->Length() == 20);
+    ASSERT(strncmp(nested->Value(), "hello sliced world!!", 20) == 0);
+    ASSERT(clamped->Length() == 6);
+    ASSERT(parent->Slice(5000, 1)->Length() == 0);
+
+    Handle<Object> obj(Object::New());
+    obj->Set(*small, Number::NewIntegral(1));
+
+    Function* f = Function::New("api", code, strlen(code));
+    Handle<Function> fn(f->Call(0, NULL)->As<Function>());
+    Value* argv[3];
+    argv[0] = *nested;
+    argv[1] = String::New("hello sliced world!!", 20);
+    argv[2] = *obj;
+    ASSERT(fn->Call(3, argv)->As<Boolean>()->IsTrue());
+
+    // Small slice is copied out of its parent, big one is still a slice
+    ASSERT(HValue::GetRepresentation<HString::Representation>(
+          small->addr()) == HString::kNormal);
+    ASSERT(HValue::GetRepresentation<HString::Representation>(
+          big->addr()) == HString::kSliced);
+    ASSERT(HString::Parent(big->addr()) == parent->addr());
+    ASSERT(strncmp(small->Value(), "hello sliced world!!", 20) == 0);
+    ASSERT(strncmp(big->Value() + 50, "hello sliced world!!", 20) == 0);
+  }
+
   // Regressions
   {
     Isolate i;
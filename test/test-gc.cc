@@ -36,6 +36,54 @@ TEST_START(gc)
     ASSERT(result->As<Number>()->Value() == 1);
   })
 
+  // Old space objects referencing new space
+  FUN_TEST("x = { y : 1 }\n"
+           "__$gc()\n__$gc()\n__$gc()\n"
+           "__$gc()\n__$gc()\n__$gc()\n"
+           "x.y = { z : 2 }\n"
+           "__$gc()\n__$gc()\n"
+           "return x.y.z", {
+    ASSERT(result->As<Number>()->Value() == 2);
+  })
+
+  // Large maps referencing new space (remembered by cards)
+  FUN_TEST("a = []\no = {}\ni = 0\n"
+           "while (i < 4096) {\n"
+           "  a[i] = i\n"
+           "  o['k' + i] = i\n"
+           "  i++\n"
+           "}\n"
+           "j = 0\n"
+           "while (j < 100000) {\n"
+           "  a[(j * 7) % 4096] = { v: j }\n"
+           "  o['k' + (j % 4096)] = { v: j }\n"
+           "  garbage = { x: { y: j } }\n"
+           "  j++\n"
+           "}\n"
+           "bad = 0\nk = 0\n"
+           "while (k < 4096) {\n"
+           "  if (a[k].v < 100000 - 4096 || (a[k].v * 7) % 4096 != k) bad++\n"
+           "  if (o['k' + k].v < 100000 - 4096 || o['k' + k].v % 4096 != k) {\n"
+           "    bad++\n"
+           "  }\n"
+           "  k++\n"
+           "}\n"
+           "return bad", {
+    ASSERT(result->As<Number>()->Value() == 0);
+  })
+
+  FUN_TEST("x = 1\n"
+           "a() {\n"
+           "  x = [ 3 ]\n"
+           "}\n"
+           "__$gc()\n__$gc()\n__$gc()\n"
+           "__$gc()\n__$gc()\n__$gc()\n"
+           "a()\n"
+           "__$gc()\n__$gc()\n"
+           "return x[0]", {
+    ASSERT(result->As<Number>()->Value() == 3);
+  })
+
   // Stress test
   FUN_TEST("a = 0\ny = 30\nz=1.0\n"
            "while(--y) {\n"
@@ -48,4 +96,226 @@ TEST_START(gc)
            "return a.x.y", {
     ASSERT(result->Is<Object>());
   })
+
+  // Incremental marking: tenured objects mutated while marking is in progress
+  FUN_TEST("keep = { list: nil, count: 0 }\nz = 1.0\ni = 30000\n"
+           "while (i--) {\n"
+           "  garbage = { x: { y: i } }\n"
+           "  keep.list = { next: keep.list, v: i }\n"
+           "}\n"
+           "l = keep.list\n"
+           "while (l) {\n"
+           "  keep.count++\n"
+           "  l = l.next\n"
+           "}\n"
+           "return keep.count", {
+    ASSERT(result->As<Number>()->Value() == 30000);
+  })
+  // Sweeping and compaction of fragmented old space
+  FUN_TEST("keep = { list: nil }\nz = 1.0\n"
+           "skip(n) {\n"
+           "  while (n) {\n"
+           "    if (n.v == 0) return n\n"
+           "    n = n.next\n"
+           "  }\n"
+           "  return nil\n"
+           "}\n"
+           "j = 0\n"
+           "while (j < 3) {\n"
+           "  i = 2000\n"
+           "  while (i--) {\n"
+           "    keep.list = { next: keep.list, v: 0 }\n"
+           "    k = 15\n"
+           "    while (k--) {\n"
+           "      garbage = { x: { y: k } }\n"
+           "      keep.list = { next: keep.list, v: 1 }\n"
+           "    }\n"
+           "  }\n"
+           "  l = keep.list\n"
+           "  while (l) {\n"
+           "    l.next = skip(l.next)\n"
+           "    l = l.next\n"
+           "  }\n"
+           "  j++\n"
+           "}\n"
+           "c = 0\n"
+           "l = keep.list\n"
+           "while (l) {\n"
+           "  c++\n"
+           "  l = l.next\n"
+           "}\n"
+           "return c", {
+    ASSERT(result->As<Number>()->Value() == 6001);
+  })
+  // Large object space
+  FUN_TEST("keep = []\n"
+           "k = 0\n"
+           "while (k < 20) {\n"
+           "  big = []\n"
+           "  i = 0\n"
+           "  while (i < 10000) {\n"
+           "    big[i] = { v: i }\n"
+           "    i++\n"
+           "  }\n"
+           "  if (k > 15) {\n"
+           "    keep[k - 16] = big\n"
+           "  }\n"
+           "  k++\n"
+           "}\n"
+           "__$gc()\n__$gc()\n"
+           "return keep[0][9999].v + keep[3][9998].v", {
+    ASSERT(result->As<Number>()->Value() == 19997);
+  })
+  // Safepoints: dead spill slots of optimized frames are ignored
+  FUN_TEST("build(depth) {\n"
+           "  if (depth == 0) {\n"
+           "    return { v: 0 }\n"
+           "  }\n"
+           "  a = { x: depth }\n"
+           "  b = [depth, depth + 1]\n"
+           "  child = build(depth - 1)\n"
+           "  j = 0\n"
+           "  while (j < 20) {\n"
+           "    garbage = { y: j, z: [j] }\n"
+           "    j++\n"
+           "  }\n"
+           "  return { v: a.x + b[1] + child.v - b[0] }\n"
+           "}\n"
+           "i = 0\n"
+           "total = 0\n"
+           "while (i < 100) {\n"
+           "  total = total + build(100).v\n"
+           "  i++\n"
+           "}\n"
+           "return total", {
+    ASSERT(result->As<Number>()->Value() == 515000);
+  })
+  // Inline allocation, crossing page boundaries
+  FUN_TEST("i = 0\n"
+           "sum = 0\n"
+           "while (i < 30000) {\n"
+           "  f = (x) { return x + 0.5 }\n"
+           "  o = { a: i, b: [i, f] }\n"
+           "  sum = sum + o.b[1](o.a)\n"
+           "  i++\n"
+           "}\n"
+           "return sum", {
+    ASSERT(result->As<Number>()->Value() == 450000000);
+  })
+  // Allocation-site pretenuring: cache entries survive, garbage doesn't
+  FUN_TEST("cache = { list: nil }\n"
+           "i = 0\n"
+           "while (i < 30000) {\n"
+           "  cache.list = { next: cache.list, v: [i, { x: i }] }\n"
+           "  garbage = { y: [i] }\n"
+           "  i++\n"
+           "}\n"
+           "c = 0\n"
+           "l = cache.list\n"
+           "while (l) {\n"
+           "  c = c + l.v[1].x - l.v[0]\n"
+           "  l.v[1] = { x: 1 }\n"
+           "  l = l.next\n"
+           "}\n"
+           "__$gc()\n__$gc()\n"
+           "l = cache.list\n"
+           "while (l) {\n"
+           "  c = c + l.v[1].x\n"
+           "  l = l.next\n"
+           "}\n"
+           "return c", {
+    ASSERT(result->As<Number>()->Value() == 30000);
+  })
+  // Shapes of dead objects are freed when shape table is full
+  FUN_TEST("first = { a0: 1, b0: 2, c0: 3, d0: 4 }\n"
+           "a = 0\n"
+           "while (a < 3) {\n"
+           "  b = 0\n"
+           "  while (b < 32) {\n"
+           "    c = 0\n"
+           "    while (c < 32) {\n"
+           "      d = 0\n"
+           "      while (d < 32) {\n"
+           "        o = {}\n"
+           "        o['a' + a] = a\n"
+           "        o['b' + b] = b\n"
+           "        o['c' + c] = c\n"
+           "        o['d' + d] = d\n"
+           "        d++\n"
+           "      }\n"
+           "      c++\n"
+           "    }\n"
+           "    b++\n"
+           "  }\n"
+           "  a++\n"
+           "}\n"
+           "o = {}\n"
+           "o.fresh = first.a0 + first.b0 + first.c0 + first.d0\n"
+           "return o", {
+    char* obj = reinterpret_cast<char*>(result);
+    ASSERT(Heap::Current()->shapes()->length() < Heap::kMaxShapes);
+    ASSERT(HObject::GetShape(obj) != NULL);
+    ASSERT(result->As<Object>()->Get("fresh")->As<Number>()->Value() == 10);
+  })
+  // Parallel scavenge
+  {
+    Isolate::Options options;
+    options.gc_threads = 4;
+    Isolate i(options);
+    const char* code = "keep = { list: nil }\n"
+                       "j = 0\n"
+                       "while (j < 20000) {\n"
+                       "  keep.list = { next: keep.list, v: [j, { x: j }] }\n"
+                       "  garbage = { y: { z: j } }\n"
+                       "  j++\n"
+                       "}\n"
+                       "c = 0\n"
+                       "l = keep.list\n"
+                       "while (l) {\n"
+                       "  c = c + l.v[1].x\n"
+                       "  l = l.next\n"
+                       "}\n"
+                       "return c";
+    Function* f = Function::New("test", code, strlen(code));
+    if (i.HasError()) {
+      i.PrintError();
+      abort();
+    }
+    Value* result = f->Call(0, NULL);
+    ASSERT(result->As<Number>()->Value() == 199990000);
+  }
+  // Parallel scavenge of objects, arrays, doubles and strings, different
+  // new space sizes move collections (and page ends) to different points
+  for (uint32_t size = 256; size <= 2048; size <<= 1) {
+    Isolate::Options options;
+    options.gc_threads = 4;
+    options.new_space_size = size * 1024;
+    options.max_new_space_size = size * 1024;
+    Isolate i(options);
+    const char* code = "keep = []\n"
+                       "j = 0\n"
+                       "while (j < 40000) {\n"
+                       "  keep[j] = { a: j, b: [j, j + 0.5], c: 'k' + j }\n"
+                       "  garbage = { x: [j, j + 0.25], y: 'g' + j }\n"
+                       "  j++\n"
+                       "}\n"
+                       "bad = 0\n"
+                       "j = 0\n"
+                       "while (j < 40000) {\n"
+                       "  o = keep[j]\n"
+                       "  if (o.a != j) bad++\n"
+                       "  if (o.b[0] != j) bad++\n"
+                       "  if (o.b[1] != j + 0.5) bad++\n"
+                       "  if (o.c != 'k' + j) bad++\n"
+                       "  j++\n"
+                       "}\n"
+                       "return bad";
+    Function* f = Function::New("test", code, strlen(code));
+    if (i.HasError()) {
+      i.PrintError();
+      abort();
+    }
+    Value* result = f->Call(0, NULL);
+    ASSERT(result->As<Number>()->Value() == 0);
+  }
 TEST_END(gc)
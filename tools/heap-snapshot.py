@@ -0,0 +1,81 @@
+#!/usr/bin/env python
+#
+# Summarise heap snapshot written by `can --heap-snapshot=<file>` or
+# `Isolate::WriteHeapSnapshot()`.
+#
+# Usage: tools/heap-snapshot.py snapshot.json [top]
+#
+
+import json
+import sys
+
+
+def main():
+  if len(sys.argv) < 2:
+    print("Usage: %s snapshot.json [top]" % sys.argv[0])
+    return 1
+
+  top = 20
+  if len(sys.argv) > 2:
+    top = int(sys.argv[2])
+
+  f = open(sys.argv[1], "r")
+  data = json.load(f)
+  f.close()
+
+  meta = data["snapshot"]
+  width = len(meta["node_fields"])
+  types = meta["node_types"]
+  raw = data["nodes"]
+
+  nodes = []
+  for i in range(0, len(raw), width):
+    nodes.append({
+      "id": raw[i],
+      "type": types[raw[i + 1]],
+      "size": raw[i + 2],
+      "retained": raw[i + 3],
+      "dominator": raw[i + 4]
+    })
+
+  # Per-type statistics
+  stats = {}
+  for node in nodes[1:]:
+    entry = stats.setdefault(node["type"], [0, 0])
+    entry[0] += 1
+    entry[1] += node["size"]
+
+  print("%-10s %10s %12s" % ("type", "count", "self size"))
+  total = [0, 0]
+  for name, entry in sorted(stats.items(), key=lambda e: -e[1][1]):
+    print("%-10s %10d %12d" % (name, entry[0], entry[1]))
+    total[0] += entry[0]
+    total[1] += entry[1]
+  print("%-10s %10d %12d" % ("total", total[0], total[1]))
+  print("")
+
+  # Top retainers
+  order = sorted(range(1, len(nodes)), key=lambda i: -nodes[i]["retained"])
+  print("%-8s %-10s %10s %12s  %s" % ("index", "type", "self", "retained",
+                                       "dominators"))
+  for i in order[:top]:
+    node = nodes[i]
+    chain = []
+    dom = node["dominator"]
+    while dom > 0 and len(chain) < 4:
+      chain.append("%s@%d" % (nodes[dom]["type"], dom))
+      dom = nodes[dom]["dominator"]
+    if dom == 0:
+      chain.append("root")
+    elif dom < 0:
+      chain.append("unreachable")
+    else:
+      chain.append("...")
+    print("%-8d %-10s %10d %12d  %s" % (i, node["type"], node["size"],
+                                         node["retained"], " <- ".join(chain)))
+
+  return 0
+
+
+if __name__ == "__main__":
+  sys.exit(main())